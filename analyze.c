@@ -0,0 +1,785 @@
+#include <dwarfw.h>
+#include <string.h>
+
+// DWARF register numbers for x86_64
+#define REG_FP 6
+#define REG_SP 7
+
+// Register numbers in instruction encodings
+#define ENC_SP 4
+#define ENC_FP 5
+
+// The return address is pushed by the call instruction
+#define RA_OFFSET -8
+
+// Forward branches whose target state is remembered at once
+#define BRANCHES_LEN 64
+
+struct insn {
+	uint8_t rex; // 0 if none
+	bool opsize; // 0x66 prefix
+	uint8_t map; // 0: one-byte opcodes, 1: 0F, 2: 0F 38, 3: 0F 3A
+	bool vex; // VEX or EVEX encoded
+	uint8_t opcode;
+	bool has_modrm;
+	uint8_t mod, reg, rm; // reg and rm are extended with REX
+	long long int disp;
+	long long int imm;
+	bool mem_sp; // the memory operand is [rsp + disp]
+};
+
+static long long int read_signed(const uint8_t *code, size_t size) {
+	switch (size) {
+	case 1:
+		return (int8_t)code[0];
+	case 2:;
+		int16_t v16;
+		memcpy(&v16, code, sizeof(v16));
+		return v16;
+	case 4:;
+		int32_t v32;
+		memcpy(&v32, code, sizeof(v32));
+		return v32;
+	case 8:;
+		int64_t v64;
+		memcpy(&v64, code, sizeof(v64));
+		return v64;
+	}
+	return 0;
+}
+
+// Immediate sizes of one-byte opcodes. z is 2 with a 0x66 prefix, 4
+// otherwise. Returns -1 for opcodes invalid in 64-bit mode.
+static int one_byte_imm(const struct insn *insn, int z) {
+	uint8_t op = insn->opcode;
+	if (op < 0x40) {
+		switch (op & 0x07) {
+		case 4:
+			return 1;
+		case 5:
+			return z;
+		case 6:
+		case 7:
+			return -1; // Prefixes and 0x0F are handled before
+		default:
+			return 0;
+		}
+	}
+	switch (op) {
+	case 0x60:
+	case 0x61:
+	case 0x82:
+	case 0x9A:
+	case 0xC4: // VEX, handled before
+	case 0xC5:
+	case 0xD4:
+	case 0xD5:
+	case 0xD6:
+	case 0xEA:
+	case 0xCE:
+		return -1;
+	case 0x68:
+	case 0x69:
+	case 0x81:
+	case 0xA9:
+	case 0xC7:
+		return z;
+	case 0xE8:
+	case 0xE9:
+		return 4; // rel32
+	case 0x6A:
+	case 0x6B:
+	case 0x80:
+	case 0x83:
+	case 0xA8:
+	case 0xC0:
+	case 0xC1:
+	case 0xC6:
+	case 0xCD:
+	case 0xEB:
+		return 1;
+	case 0xC2:
+	case 0xCA:
+		return 2;
+	case 0xC8:
+		return 3;
+	case 0xA0:
+	case 0xA1:
+	case 0xA2:
+	case 0xA3:
+		return 8; // moffs
+	case 0xF6:
+		return insn->reg == 0 || insn->reg == 1 ? 1 : 0;
+	case 0xF7:
+		return insn->reg == 0 || insn->reg == 1 ? z : 0;
+	}
+	if ((op >= 0x70 && op <= 0x7F) || (op >= 0xE0 && op <= 0xE7) ||
+			(op >= 0xB0 && op <= 0xB7)) {
+		return 1;
+	}
+	if (op >= 0xB8 && op <= 0xBF) {
+		return insn->rex & 0x08 ? 8 : z;
+	}
+	return 0;
+}
+
+static bool one_byte_has_modrm(uint8_t op) {
+	if (op < 0x40) {
+		return (op & 0x07) < 4;
+	}
+	switch (op) {
+	case 0x63:
+	case 0x69:
+	case 0x6B:
+	case 0xC0:
+	case 0xC1:
+	case 0xC6:
+	case 0xC7:
+	case 0xF6:
+	case 0xF7:
+	case 0xFE:
+	case 0xFF:
+		return true;
+	}
+	return (op >= 0x80 && op <= 0x8F) || (op >= 0xD0 && op <= 0xD3) ||
+		(op >= 0xD8 && op <= 0xDF);
+}
+
+static bool two_byte_has_modrm(uint8_t op) {
+	switch (op) {
+	case 0x05:
+	case 0x06:
+	case 0x07:
+	case 0x08:
+	case 0x09:
+	case 0x0B:
+	case 0x0E:
+	case 0x77:
+	case 0xA0:
+	case 0xA1:
+	case 0xA2:
+	case 0xA8:
+	case 0xA9:
+	case 0xAA:
+		return false;
+	}
+	return !(op >= 0x30 && op <= 0x37) && !(op >= 0x80 && op <= 0x8F) &&
+		!(op >= 0xC8 && op <= 0xCF);
+}
+
+static int two_byte_imm(uint8_t op) {
+	if (op >= 0x80 && op <= 0x8F) {
+		return 4; // jcc rel32
+	}
+	switch (op) {
+	case 0x0F: // 3DNow!
+	case 0x70:
+	case 0x71:
+	case 0x72:
+	case 0x73:
+	case 0xA4:
+	case 0xAC:
+	case 0xBA:
+	case 0xC2:
+	case 0xC4:
+	case 0xC5:
+	case 0xC6:
+		return 1;
+	}
+	return 0;
+}
+
+// Decodes the ModRM, SIB and displacement bytes. Returns their length, 0 if
+// truncated.
+static size_t modrm_decode(const uint8_t *code, size_t len,
+		struct insn *insn) {
+	if (len < 1) {
+		return 0;
+	}
+	uint8_t modrm = code[0];
+	insn->has_modrm = true;
+	insn->mod = modrm >> 6;
+	insn->reg = ((modrm >> 3) & 0x07) | ((insn->rex & 0x04) << 1);
+	insn->rm = (modrm & 0x07) | ((insn->rex & 0x01) << 3);
+	if (insn->mod == 3) {
+		return 1;
+	}
+
+	size_t n = 1, disp_size = 0;
+	if ((modrm & 0x07) == ENC_SP) {
+		if (len < 2) {
+			return 0;
+		}
+		uint8_t sib = code[1];
+		++n;
+		// Base rsp and no index
+		insn->mem_sp = (sib & 0x3F) == (ENC_SP << 3 | ENC_SP) &&
+			!(insn->rex & 0x03);
+		if (insn->mod == 0 && (sib & 0x07) == ENC_FP) {
+			disp_size = 4;
+		}
+	} else if (insn->mod == 0 && (modrm & 0x07) == ENC_FP) {
+		disp_size = 4; // rip-relative
+	}
+	if (insn->mod == 1) {
+		disp_size = 1;
+	} else if (insn->mod == 2) {
+		disp_size = 4;
+	}
+
+	if (len < n + disp_size) {
+		return 0;
+	}
+	insn->disp = read_signed(code + n, disp_size);
+	return n + disp_size;
+}
+
+// Decodes the length of an x86_64 instruction and the fields needed to track
+// the stack. Returns 0 for invalid or truncated instructions.
+static size_t insn_decode(const uint8_t *code, size_t len, struct insn *insn) {
+	memset(insn, 0, sizeof(*insn));
+
+	size_t n = 0;
+	bool addrsize = false;
+	while (n < len) {
+		uint8_t b = code[n];
+		if (b == 0x66) {
+			insn->opsize = true;
+		} else if (b == 0x67) {
+			addrsize = true;
+		} else if (b != 0xF0 && b != 0xF2 && b != 0xF3 && b != 0x2E &&
+				b != 0x36 && b != 0x3E && b != 0x26 && b != 0x64 &&
+				b != 0x65) {
+			break;
+		}
+		if (++n > 14) {
+			return 0;
+		}
+	}
+	if (n < len && (code[n] & 0xF0) == 0x40) {
+		insn->rex = code[n];
+		++n;
+	}
+	if (n >= len) {
+		return 0;
+	}
+
+	uint8_t op = code[n];
+	++n;
+	int imm_size = 0;
+	if (op == 0xC4 || op == 0xC5 || op == 0x62) {
+		// VEX and EVEX: the map is in the prefix, there is always a ModRM
+		size_t prefix_len = op == 0xC5 ? 1 : op == 0xC4 ? 2 : 3;
+		if (len < n + prefix_len + 1) {
+			return 0;
+		}
+		uint8_t p0 = code[n];
+		insn->map = op == 0xC5 ? 1 : op == 0xC4 ? (p0 & 0x1F) : (p0 & 0x07);
+		insn->vex = true;
+		n += prefix_len;
+		insn->opcode = code[n];
+		++n;
+		insn->has_modrm = !(insn->map == 1 && insn->opcode == 0x77);
+		if (insn->map == 0) {
+			return 0;
+		} else if (insn->map == 3 ||
+				(insn->map == 1 && two_byte_imm(insn->opcode) == 1)) {
+			imm_size = 1;
+		}
+	} else if (op == 0x0F) {
+		if (n >= len) {
+			return 0;
+		}
+		insn->opcode = code[n];
+		++n;
+		insn->map = 1;
+		if (insn->opcode == 0x38 || insn->opcode == 0x3A) {
+			if (n >= len) {
+				return 0;
+			}
+			insn->map = insn->opcode == 0x38 ? 2 : 3;
+			insn->opcode = code[n];
+			++n;
+			insn->has_modrm = true;
+			imm_size = insn->map == 3 ? 1 : 0;
+		} else {
+			insn->has_modrm = two_byte_has_modrm(insn->opcode);
+			imm_size = two_byte_imm(insn->opcode);
+		}
+	} else {
+		insn->opcode = op;
+		insn->has_modrm = one_byte_has_modrm(op);
+	}
+
+	if (insn->has_modrm) {
+		size_t modrm_len = modrm_decode(code + n, len - n, insn);
+		if (!modrm_len) {
+			return 0;
+		}
+		n += modrm_len;
+	}
+
+	if (insn->map == 0) {
+		bool w = insn->rex & 0x08;
+		imm_size = one_byte_imm(insn, insn->opsize && !w ? 2 : 4);
+		if (imm_size < 0) {
+			return 0;
+		}
+		if (op >= 0xA0 && op <= 0xA3 && addrsize) {
+			imm_size = 4;
+		}
+	}
+
+	if (len < n + imm_size) {
+		return 0;
+	}
+	if (imm_size == 3) {
+		// enter: 16-bit size and 8-bit nesting level
+		insn->imm = (code[n] | code[n + 1] << 8) | code[n + 2] << 16;
+	} else if (imm_size <= 4) {
+		insn->imm = read_signed(code + n, imm_size);
+	}
+	return n + imm_size;
+}
+
+struct analyze_state {
+	struct dwarfw_unwind_row row;
+	bool sp_known;
+	long long int sp_offset; // CFA - rsp, if sp_known
+};
+
+struct branch {
+	size_t target;
+	struct analyze_state state;
+};
+
+static bool pushed(struct analyze_state *state, long long int size) {
+	if (!state->sp_known) {
+		return state->row.cfa_register == REG_FP;
+	}
+	state->sp_offset += size;
+	if (state->row.cfa_register == REG_SP) {
+		state->row.cfa_offset = state->sp_offset;
+	}
+	return true;
+}
+
+// rsp was changed in a way which isn't tracked
+static bool sp_clobbered(struct analyze_state *state) {
+	state->sp_known = false;
+	return state->row.cfa_register == REG_FP;
+}
+
+// rbp was changed, the CFA can't be computed from it anymore
+static bool fp_clobbered(struct analyze_state *state) {
+	if (state->row.cfa_register != REG_FP) {
+		return true;
+	}
+	if (!state->sp_known) {
+		return false;
+	}
+	state->row.cfa_register = REG_SP;
+	state->row.cfa_offset = state->sp_offset;
+	return true;
+}
+
+static bool insn_is_terminator(const struct insn *insn) {
+	if (insn->map != 0) {
+		return false;
+	}
+	switch (insn->opcode) {
+	case 0xC2:
+	case 0xC3:
+	case 0xE9:
+	case 0xEB:
+		return true;
+	case 0xFF:
+		return insn->reg == 4 || insn->reg == 5; // jmp r/m
+	}
+	return false;
+}
+
+static bool insn_is_call(const struct insn *insn) {
+	return insn->map == 0 && (insn->opcode == 0xE8 ||
+		(insn->opcode == 0xFF && (insn->reg == 2 || insn->reg == 3)));
+}
+
+static bool insn_is_nop(const struct insn *insn) {
+	return (insn->map == 0 && insn->opcode == 0x90 && !(insn->rex & 0x01)) ||
+		(insn->map == 1 && insn->opcode == 0x1F && !insn->vex);
+}
+
+// Returns whether the instruction is a direct jump, and its target relative
+// to the end of the instruction
+static bool insn_branch(const struct insn *insn, long long int *target) {
+	uint8_t op = insn->opcode;
+	bool branch = insn->map == 0 ?
+		(op >= 0x70 && op <= 0x7F) || op == 0xE3 || op == 0xE9 || op == 0xEB :
+		insn->map == 1 && !insn->vex && op >= 0x80 && op <= 0x8F;
+	*target = insn->imm;
+	return branch;
+}
+
+// Registers written by common instructions, -1 if none or unknown. Only
+// needed to notice unexpected writes to rsp and rbp.
+static int insn_written_register(const struct insn *insn) {
+	uint8_t op = insn->opcode;
+	if (insn->vex) {
+		return -1;
+	} else if (insn->map == 1) {
+		// cmov, imul, movzx, movsx, popcnt, bsf, bsr
+		if ((op >= 0x40 && op <= 0x4F) || op == 0xAF || op == 0xB6 ||
+				op == 0xB7 || op == 0xB8 || op == 0xBC || op == 0xBD ||
+				op == 0xBE || op == 0xBF) {
+			return insn->reg;
+		}
+		return -1;
+	} else if (insn->map != 0) {
+		return -1;
+	}
+
+	if (op < 0x40 && (op & 0x07) < 4) {
+		bool to_rm = (op & 0x02) == 0;
+		if ((op & 0x38) == 0x38) {
+			return -1; // cmp
+		}
+		if (to_rm) {
+			return insn->mod == 3 ? insn->rm : -1;
+		}
+		return insn->reg;
+	}
+	switch (op) {
+	case 0x63:
+	case 0x69:
+	case 0x6B:
+	case 0x8B:
+	case 0x8D:
+		return insn->reg;
+	case 0x81:
+	case 0x83:
+		return insn->mod == 3 && insn->reg != 7 ? insn->rm : -1;
+	case 0x89:
+	case 0xC7:
+	case 0xC1:
+	case 0xD1:
+	case 0xD3:
+		return insn->mod == 3 ? insn->rm : -1;
+	case 0xF7:
+		// not, neg
+		return insn->mod == 3 && (insn->reg == 2 || insn->reg == 3) ?
+			insn->rm : -1;
+	case 0xFF:
+		// inc, dec
+		return insn->mod == 3 && insn->reg <= 1 ? insn->rm : -1;
+	case 0x87:
+		return insn->mod == 3 ? insn->rm : insn->reg;
+	}
+	if ((op >= 0x91 && op <= 0x97) || (op >= 0xB8 && op <= 0xBF)) {
+		// xchg with rax, mov imm
+		return (op & 0x07) | ((insn->rex & 0x01) << 3);
+	}
+	return -1;
+}
+
+// Runs an instruction. Returns false if the CFA can't be tracked anymore.
+// *shrinks is set if the instruction is part of an epilogue.
+static bool insn_run(struct analyze_state *state, const struct insn *insn,
+		bool *shrinks) {
+	struct dwarfw_unwind_row *row = &state->row;
+	bool w = insn->rex & 0x08;
+	uint8_t op = insn->opcode;
+	*shrinks = false;
+
+	if (insn->map == 0 && op >= 0x50 && op <= 0x57) {
+		// push r64
+		uint8_t reg = (op & 0x07) | ((insn->rex & 0x01) << 3);
+		if (!pushed(state, 8)) {
+			return false;
+		}
+		if (reg == ENC_FP && row->fp_offset == 0 && state->sp_known) {
+			row->fp_offset = -state->sp_offset;
+		}
+		return true;
+	}
+	if (insn->map == 0 && op >= 0x58 && op <= 0x5F) {
+		// pop r64
+		uint8_t reg = (op & 0x07) | ((insn->rex & 0x01) << 3);
+		*shrinks = true;
+		if (reg == ENC_SP) {
+			return sp_clobbered(state);
+		}
+		bool restores_fp = reg == ENC_FP && state->sp_known &&
+			row->fp_offset == -state->sp_offset;
+		if (!pushed(state, -8)) {
+			return false;
+		}
+		if (reg == ENC_FP) {
+			if (restores_fp) {
+				row->fp_offset = 0;
+			}
+			return fp_clobbered(state);
+		}
+		return true;
+	}
+
+	if (insn->map == 0) {
+		switch (op) {
+		case 0x68:
+		case 0x6A:
+		case 0x9C:
+			return pushed(state, 8); // push imm, pushfq
+		case 0x9D:
+			*shrinks = true;
+			return pushed(state, -8); // popfq
+		case 0xFF:
+			if (insn->reg == 6) {
+				return pushed(state, 8); // push r/m64
+			}
+			break;
+		case 0x8F:
+			if (insn->reg == 0) {
+				*shrinks = true;
+				return pushed(state, -8); // pop r/m64
+			}
+			break;
+		case 0x81:
+		case 0x83:
+			if (w && insn->mod == 3 && insn->rm == ENC_SP &&
+					(insn->reg == 0 || insn->reg == 5)) {
+				// add/sub rsp, imm
+				long long int size = insn->reg == 5 ? insn->imm : -insn->imm;
+				*shrinks = size < 0;
+				return pushed(state, size);
+			}
+			break;
+		case 0x8D:
+			if (w && insn->reg == ENC_SP && insn->mod != 3) {
+				*shrinks = true;
+				if (insn->rm == ENC_SP && insn->mem_sp) {
+					// lea rsp, [rsp + disp]
+					return pushed(state, -insn->disp);
+				} else if (insn->rm == ENC_FP && insn->mod != 0 &&
+						row->cfa_register == REG_FP) {
+					// lea rsp, [rbp + disp]
+					state->sp_known = true;
+					state->sp_offset = row->cfa_offset - insn->disp;
+					return true;
+				}
+				return sp_clobbered(state);
+			}
+			break;
+		case 0x89:
+		case 0x8B:
+			if (w && insn->mod == 3) {
+				uint8_t dst = op == 0x89 ? insn->rm : insn->reg;
+				uint8_t src = op == 0x89 ? insn->reg : insn->rm;
+				if (dst == ENC_FP && src == ENC_SP) {
+					// mov rbp, rsp
+					if (!state->sp_known) {
+						return false;
+					}
+					row->cfa_register = REG_FP;
+					row->cfa_offset = state->sp_offset;
+					return true;
+				} else if (dst == ENC_SP && src == ENC_FP) {
+					// mov rsp, rbp
+					*shrinks = true;
+					if (row->cfa_register != REG_FP) {
+						return sp_clobbered(state);
+					}
+					state->sp_known = true;
+					state->sp_offset = row->cfa_offset;
+					return true;
+				}
+			}
+			break;
+		case 0xC9:
+			// leave: mov rsp, rbp; pop rbp
+			*shrinks = true;
+			if (row->cfa_register != REG_FP) {
+				return false;
+			}
+			state->sp_known = true;
+			state->sp_offset = row->cfa_offset;
+			if (row->fp_offset == -state->sp_offset) {
+				row->fp_offset = 0;
+			}
+			state->sp_offset -= 8;
+			row->cfa_register = REG_SP;
+			row->cfa_offset = state->sp_offset;
+			return true;
+		case 0xC8:
+			// enter size, 0: push rbp; mov rbp, rsp; sub rsp, size
+			if ((insn->imm >> 16) != 0 || !state->sp_known ||
+					!pushed(state, 8)) {
+				return false;
+			}
+			if (row->fp_offset == 0) {
+				row->fp_offset = -state->sp_offset;
+			}
+			row->cfa_register = REG_FP;
+			row->cfa_offset = state->sp_offset;
+			state->sp_offset += insn->imm & 0xFFFF;
+			return true;
+		}
+	}
+
+	int written = insn_written_register(insn);
+	if (written == ENC_SP) {
+		return sp_clobbered(state);
+	} else if (written == ENC_FP) {
+		return fp_clobbered(state);
+	}
+	return true;
+}
+
+static bool state_equal(const struct analyze_state *a,
+		const struct analyze_state *b) {
+	return a->row.cfa_register == b->row.cfa_register &&
+		a->row.cfa_offset == b->row.cfa_offset &&
+		a->row.fp_offset == b->row.fp_offset &&
+		a->sp_known == b->sp_known && a->sp_offset == b->sp_offset;
+}
+
+// Drops the branches whose target has been passed
+static size_t branches_prune(struct branch *branches, size_t branches_len,
+		size_t offset) {
+	size_t len = 0;
+	for (size_t i = 0; i < branches_len; ++i) {
+		if (branches[i].target >= offset) {
+			branches[len++] = branches[i];
+		}
+	}
+	return len;
+}
+
+static const struct branch *branch_find(const struct branch *branches,
+		size_t branches_len, size_t target) {
+	for (size_t i = 0; i < branches_len; ++i) {
+		if (branches[i].target == target) {
+			return &branches[i];
+		}
+	}
+	return NULL;
+}
+
+static bool row_push(struct dwarfw_unwind_row *rows, size_t *rows_len,
+		size_t rows_cap, struct dwarfw_unwind_row *row, size_t offset) {
+	row->offset = offset;
+	struct dwarfw_unwind_row *last = &rows[*rows_len - 1];
+	if (last->cfa_register == row->cfa_register &&
+			last->cfa_offset == row->cfa_offset &&
+			last->fp_offset == row->fp_offset) {
+		return true;
+	}
+	if (last->offset == offset) {
+		*last = *row;
+		return true;
+	}
+	if (*rows_len == rows_cap) {
+		return false;
+	}
+	rows[*rows_len] = *row;
+	++*rows_len;
+	return true;
+}
+
+size_t dwarfw_unwind_rows_analyze(const char *code, size_t code_len,
+		struct dwarfw_unwind_row *rows, size_t rows_cap) {
+	if (rows_cap == 0 || code_len > UINT32_MAX) {
+		return 0;
+	}
+
+	struct analyze_state state = {
+		.row = {
+			.cfa_register = REG_SP,
+			.cfa_offset = 8,
+			.ra_offset = RA_OFFSET,
+		},
+		.sp_known = true,
+		.sp_offset = 8,
+	};
+	rows[0] = state.row;
+	size_t rows_len = 1;
+
+	// Code after a return or a jump is reached from elsewhere. It gets the
+	// state of a forward branch to it, or else, after a return or a tail
+	// call, the state before the epilogue: a run of instructions shrinking
+	// the stack. Padding after a call means that it doesn't return.
+	struct branch branches[BRANCHES_LEN];
+	size_t branches_len = 0;
+	struct analyze_state body;
+	bool in_epilogue = false, unreachable = false, after_call = false;
+
+	const uint8_t *buf = (const uint8_t *)code;
+	size_t offset = 0;
+	while (offset < code_len) {
+		struct insn insn;
+		size_t n = insn_decode(buf + offset, code_len - offset, &insn);
+		if (!n) {
+			return 0;
+		}
+
+		// Padding can come between the jump and the code reached from
+		// elsewhere
+		bool nop = insn_is_nop(&insn);
+		unreachable |= after_call && nop;
+		after_call = insn_is_call(&insn);
+		if (unreachable && !nop) {
+			const struct branch *branch =
+				branch_find(branches, branches_len, offset);
+			if (branch != NULL) {
+				state = branch->state;
+				if (!row_push(rows, &rows_len, rows_cap, &state.row, offset)) {
+					return 0;
+				}
+			}
+			unreachable = false;
+		}
+		offset += n;
+
+		struct analyze_state prev = state;
+		bool shrinks;
+		if (!insn_run(&state, &insn, &shrinks)) {
+			return 0;
+		}
+		// Epilogues end with a return or a jump, a call or a conditional
+		// branch means that the stack shrank in the middle of the body
+		long long int target;
+		bool branch = insn_branch(&insn, &target);
+		bool terminator = insn_is_terminator(&insn);
+		if (shrinks && !in_epilogue) {
+			body = prev;
+			in_epilogue = true;
+		} else if (!shrinks && (!state_equal(&prev, &state) || after_call ||
+				(branch && !terminator))) {
+			in_epilogue = false;
+		}
+
+		if (branch && target > 0 &&
+				(size_t)target < code_len - offset &&
+				(branches_len < BRANCHES_LEN ||
+				(branches_len = branches_prune(branches, branches_len,
+					offset)) < BRANCHES_LEN)) {
+			branches[branches_len].target = offset + target;
+			branches[branches_len].state = prev;
+			++branches_len;
+		}
+
+		if (terminator) {
+			if (in_epilogue && state.sp_known &&
+					state.sp_offset == -RA_OFFSET) {
+				state = body;
+			}
+			in_epilogue = false;
+			unreachable = true;
+		}
+
+		if (offset < code_len &&
+				!row_push(rows, &rows_len, rows_cap, &state.row, offset)) {
+			return 0;
+		}
+	}
+
+	return rows_len;
+}
@@ -0,0 +1,619 @@
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <dwarfw-inline.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATE_STACK_LEN 32
+
+enum directive {
+	DIRECTIVE_STARTPROC,
+	DIRECTIVE_ENDPROC,
+	DIRECTIVE_SECTIONS,
+	DIRECTIVE_DEF_CFA,
+	DIRECTIVE_DEF_CFA_REGISTER,
+	DIRECTIVE_DEF_CFA_OFFSET,
+	DIRECTIVE_ADJUST_CFA_OFFSET,
+	DIRECTIVE_OFFSET,
+	DIRECTIVE_REL_OFFSET,
+	DIRECTIVE_VAL_OFFSET,
+	DIRECTIVE_RESTORE,
+	DIRECTIVE_UNDEFINED,
+	DIRECTIVE_SAME_VALUE,
+	DIRECTIVE_REGISTER,
+	DIRECTIVE_REMEMBER_STATE,
+	DIRECTIVE_RESTORE_STATE,
+	DIRECTIVE_ESCAPE,
+};
+
+// Names without the ".cfi_" prefix
+static const struct {
+	const char *name;
+	size_t len;
+	enum directive directive;
+} directives[] = {
+	{ "offset", 6, DIRECTIVE_OFFSET },
+	{ "def_cfa_offset", 14, DIRECTIVE_DEF_CFA_OFFSET },
+	{ "adjust_cfa_offset", 17, DIRECTIVE_ADJUST_CFA_OFFSET },
+	{ "def_cfa_register", 16, DIRECTIVE_DEF_CFA_REGISTER },
+	{ "def_cfa", 7, DIRECTIVE_DEF_CFA },
+	{ "startproc", 9, DIRECTIVE_STARTPROC },
+	{ "endproc", 7, DIRECTIVE_ENDPROC },
+	{ "rel_offset", 10, DIRECTIVE_REL_OFFSET },
+	{ "restore", 7, DIRECTIVE_RESTORE },
+	{ "remember_state", 14, DIRECTIVE_REMEMBER_STATE },
+	{ "restore_state", 13, DIRECTIVE_RESTORE_STATE },
+	{ "val_offset", 10, DIRECTIVE_VAL_OFFSET },
+	{ "undefined", 9, DIRECTIVE_UNDEFINED },
+	{ "same_value", 10, DIRECTIVE_SAME_VALUE },
+	{ "register", 8, DIRECTIVE_REGISTER },
+	{ "escape", 6, DIRECTIVE_ESCAPE },
+	{ "sections", 8, DIRECTIVE_SECTIONS },
+};
+
+// Register names to DWARF register numbers for x86_64
+static const char registers[][4] = {
+	"rax", "rdx", "rcx", "rbx", "rsi", "rdi", "rbp", "rsp",
+	"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rip",
+};
+
+// A slice of the input text, tokens are never copied
+struct token {
+	const char *s;
+	size_t len;
+};
+
+struct asm_state {
+	struct dwarfw_asm *out;
+	struct dwarfw_cie *cie;
+	size_t fdes_cap;
+	size_t instructions_len, instructions_cap; // of out->instructions
+
+	bool in_proc;
+	uint64_t address; // end of the last instruction
+	uint64_t location; // of the last row
+	struct dwarfw_fde *fde; // being assembled
+	size_t instructions_start; // of fde
+
+	// Only tracked for .cfi_adjust_cfa_offset and .cfi_rel_offset
+	uint64_t cfa_register;
+	long long int cfa_offset;
+	struct {
+		uint64_t cfa_register;
+		long long int cfa_offset;
+	} stack[STATE_STACK_LEN];
+	size_t stack_len;
+
+	// CFA after the CIE initial instructions
+	uint64_t initial_cfa_register;
+	long long int initial_cfa_offset;
+};
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+static void skip_spaces(struct token *t) {
+	while (t->len > 0 && is_space(t->s[0])) {
+		++t->s;
+		--t->len;
+	}
+}
+
+// Splits the next comma-separated argument off args
+static bool next_arg(struct token *args, struct token *arg) {
+	skip_spaces(args);
+	if (args->len == 0) {
+		return false;
+	}
+	const char *comma = memchr(args->s, ',', args->len);
+	size_t len = comma != NULL ? (size_t)(comma - args->s) : args->len;
+	arg->s = args->s;
+	arg->len = len;
+	while (arg->len > 0 && is_space(arg->s[arg->len - 1])) {
+		--arg->len;
+	}
+	args->s += len;
+	args->len -= len;
+	if (comma != NULL) {
+		++args->s;
+		--args->len;
+	}
+	return arg->len > 0;
+}
+
+static bool args_end(struct token *args) {
+	skip_spaces(args);
+	return args->len == 0;
+}
+
+static bool parse_u64(struct token t, uint64_t *value) {
+	if (t.len == 0) {
+		return false;
+	}
+	uint64_t v = 0;
+	if (t.len > 2 && t.s[0] == '0' && (t.s[1] == 'x' || t.s[1] == 'X')) {
+		for (size_t i = 2; i < t.len; ++i) {
+			int d = hex_digit(t.s[i]);
+			if (d < 0) {
+				return false;
+			}
+			v = (v << 4) | d;
+		}
+	} else {
+		for (size_t i = 0; i < t.len; ++i) {
+			if (t.s[i] < '0' || t.s[i] > '9') {
+				return false;
+			}
+			v = 10 * v + (t.s[i] - '0');
+		}
+	}
+	*value = v;
+	return true;
+}
+
+static bool parse_int(struct token t, long long int *value) {
+	bool negative = t.len > 0 && t.s[0] == '-';
+	if (t.len > 0 && (t.s[0] == '-' || t.s[0] == '+')) {
+		++t.s;
+		--t.len;
+	}
+	uint64_t v;
+	if (!parse_u64(t, &v)) {
+		return false;
+	}
+	*value = negative ? -(long long int)v : (long long int)v;
+	return true;
+}
+
+static bool parse_register(struct token t, uint64_t *reg) {
+	if (t.len > 0 && t.s[0] == '%') {
+		++t.s;
+		--t.len;
+	}
+	if (t.len > 0 && t.s[0] >= '0' && t.s[0] <= '9') {
+		return parse_u64(t, reg);
+	}
+	if (t.len < 2 || t.len > 3) {
+		return false;
+	}
+	for (size_t i = 0; i < sizeof(registers) / sizeof(registers[0]); ++i) {
+		if (memcmp(registers[i], t.s, t.len) == 0 &&
+				registers[i][t.len] == '\0') {
+			*reg = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool parse_reg_int(struct token *args, uint64_t *reg,
+		long long int *value) {
+	struct token arg;
+	return next_arg(args, &arg) && parse_register(arg, reg) &&
+		next_arg(args, &arg) && parse_int(arg, value) && args_end(args);
+}
+
+static bool parse_reg(struct token *args, uint64_t *reg) {
+	struct token arg;
+	return next_arg(args, &arg) && parse_register(arg, reg) && args_end(args);
+}
+
+static bool parse_one_int(struct token *args, long long int *value) {
+	struct token arg;
+	return next_arg(args, &arg) && parse_int(arg, value) && args_end(args);
+}
+
+// Counts the bytes of the hexadecimal byte column of an instruction line
+static size_t count_bytes(struct token t) {
+	size_t n = 0;
+	skip_spaces(&t);
+	while (t.len >= 2 && hex_digit(t.s[0]) >= 0 && hex_digit(t.s[1]) >= 0 &&
+			(t.len == 2 || is_space(t.s[2]))) {
+		++n;
+		t.s += 2;
+		t.len -= 2;
+		// The column is padded with spaces and followed by a tab
+		if (t.len > 0 && t.s[0] == '\t') {
+			break;
+		} else if (t.len > 0) {
+			++t.s;
+			--t.len;
+		}
+	}
+	return n;
+}
+
+// Address lines start with a hexadecimal address followed by ':', optionally
+// with the function name in between, as in objdump output:
+//   0000000000401000 <main>:
+//     401000:	55                   	push   %rbp
+// Directives following an instruction take effect after it, so the returned
+// address is the end of the instruction.
+static bool parse_address(struct token line, uint64_t *address) {
+	uint64_t v = 0;
+	size_t i = 0;
+	if (line.len > 2 && line.s[0] == '0' &&
+			(line.s[1] == 'x' || line.s[1] == 'X')) {
+		i = 2;
+	}
+	size_t digits_start = i;
+	for (; i < line.len; ++i) {
+		int d = hex_digit(line.s[i]);
+		if (d < 0) {
+			break;
+		}
+		v = (v << 4) | d;
+	}
+	if (i == digits_start || i == line.len) {
+		return false;
+	}
+
+	if (line.s[i] != ':') {
+		// Function label
+		if (line.s[i] != ' ') {
+			return false;
+		}
+		const char *end = memchr(line.s + i, '>', line.len - i);
+		if (line.s[i + 1] != '<' || end == NULL ||
+				end + 1 == line.s + line.len || end[1] != ':') {
+			return false;
+		}
+	} else {
+		struct token bytes = { .s = line.s + i + 1, .len = line.len - i - 1 };
+		v += count_bytes(bytes);
+	}
+
+	*address = v;
+	return true;
+}
+
+// Makes room for an instruction at the end of the buffer. Instructions are
+// encoded in memory with the inline encoders, they produce the same bytes as
+// the dwarfw_cie_write_* ones without going through stdio for each byte.
+static char *reserve(struct asm_state *state) {
+	struct dwarfw_asm *out = state->out;
+	if (state->instructions_cap - state->instructions_len <
+			DWARFW_INLINE_INSTRUCTION_MAX) {
+		size_t cap = state->instructions_cap == 0 ?
+			4096 : 2 * state->instructions_cap;
+		char *instructions = realloc(out->instructions, cap);
+		if (instructions == NULL) {
+			return NULL;
+		}
+		out->instructions = instructions;
+		state->instructions_cap = cap;
+	}
+	return out->instructions + state->instructions_len;
+}
+
+static bool is_aligned(struct asm_state *state, long long int offset) {
+	return offset % state->cie->data_alignment == 0;
+}
+
+// Writes the location advance to the current address, before a new row
+static bool advance(struct asm_state *state) {
+	if (state->address < state->location) {
+		return false;
+	}
+	uint64_t delta = state->address - state->location;
+	if (delta == 0) {
+		return true;
+	}
+	if (delta > UINT32_MAX || delta % state->cie->code_alignment != 0) {
+		return false;
+	}
+	char *buf = reserve(state);
+	if (buf == NULL) {
+		return false;
+	}
+	state->instructions_len += dwarfw_inline_advance_loc(buf, delta,
+		state->cie->code_alignment);
+	state->location = state->address;
+	return true;
+}
+
+static bool startproc(struct asm_state *state) {
+	struct dwarfw_asm *out = state->out;
+	if (state->in_proc) {
+		return false;
+	}
+
+	if (out->fdes_len == state->fdes_cap) {
+		size_t cap = state->fdes_cap == 0 ? 64 : 2 * state->fdes_cap;
+		struct dwarfw_fde *fdes = realloc(out->fdes,
+			cap * sizeof(struct dwarfw_fde));
+		if (fdes == NULL) {
+			return false;
+		}
+		out->fdes = fdes;
+		state->fdes_cap = cap;
+	}
+
+	state->fde = &out->fdes[out->fdes_len];
+	memset(state->fde, 0, sizeof(*state->fde));
+	state->fde->cie = state->cie;
+	state->fde->initial_location = state->address;
+
+	state->in_proc = true;
+	state->location = state->address;
+	state->instructions_start = state->instructions_len;
+	state->cfa_register = state->initial_cfa_register;
+	state->cfa_offset = state->initial_cfa_offset;
+	state->stack_len = 0;
+	return true;
+}
+
+static bool endproc(struct asm_state *state) {
+	struct dwarfw_fde *fde = state->fde;
+	if (!state->in_proc || state->address < (uint64_t)fde->initial_location) {
+		return false;
+	}
+	uint64_t range = state->address - fde->initial_location;
+	if (range > UINT32_MAX) {
+		return false;
+	}
+	fde->address_range = range;
+	fde->instructions_length =
+		state->instructions_len - state->instructions_start;
+	++state->out->fdes_len;
+	state->in_proc = false;
+	return true;
+}
+
+static bool escape(struct asm_state *state, struct token *args) {
+	struct token arg;
+	while (next_arg(args, &arg)) {
+		uint64_t byte;
+		if (!parse_u64(arg, &byte) || byte > 0xFF) {
+			return false;
+		}
+		char *buf = reserve(state);
+		if (buf == NULL) {
+			return false;
+		}
+		buf[0] = byte;
+		++state->instructions_len;
+	}
+	return args_end(args);
+}
+
+static bool directive_run(struct asm_state *state, enum directive directive,
+		struct token *args) {
+	switch (directive) {
+	case DIRECTIVE_STARTPROC:;
+		// "simple" only drops the initial instructions, which come from
+		// the caller's CIE anyway
+		struct token arg;
+		if (next_arg(args, &arg) &&
+				(arg.len != 6 || memcmp(arg.s, "simple", 6) != 0)) {
+			return false;
+		}
+		return args_end(args) && startproc(state);
+	case DIRECTIVE_SECTIONS:
+		return true; // Only .eh_frame is written
+	case DIRECTIVE_ENDPROC:
+		return args_end(args) && endproc(state);
+	default:
+		break;
+	}
+
+	if (!state->in_proc || !advance(state)) {
+		return false;
+	}
+
+	if (directive == DIRECTIVE_ESCAPE) {
+		return escape(state, args);
+	}
+	char *buf = reserve(state);
+	if (buf == NULL) {
+		return false;
+	}
+
+	int64_t data_alignment = state->cie->data_alignment;
+	uint64_t reg, reg2;
+	long long int value;
+	size_t n = 0;
+	switch (directive) {
+	case DIRECTIVE_DEF_CFA:
+		if (parse_reg_int(args, &reg, &value) &&
+				(value >= 0 || is_aligned(state, value))) {
+			n = dwarfw_inline_def_cfa(buf, reg, value, data_alignment);
+			state->cfa_register = reg;
+			state->cfa_offset = value;
+		}
+		break;
+	case DIRECTIVE_DEF_CFA_REGISTER:
+		if (parse_reg(args, &reg)) {
+			n = dwarfw_inline_def_cfa_register(buf, reg);
+			state->cfa_register = reg;
+		}
+		break;
+	case DIRECTIVE_DEF_CFA_OFFSET:
+		if (parse_one_int(args, &value) &&
+				(value >= 0 || is_aligned(state, value))) {
+			n = dwarfw_inline_def_cfa_offset(buf, value, data_alignment);
+			state->cfa_offset = value;
+		}
+		break;
+	case DIRECTIVE_ADJUST_CFA_OFFSET:
+		if (parse_one_int(args, &value)) {
+			value += state->cfa_offset;
+			if (value >= 0 || is_aligned(state, value)) {
+				n = dwarfw_inline_def_cfa_offset(buf, value, data_alignment);
+				state->cfa_offset = value;
+			}
+		}
+		break;
+	case DIRECTIVE_OFFSET:
+		if (parse_reg_int(args, &reg, &value) && is_aligned(state, value)) {
+			n = dwarfw_inline_offset(buf, reg, value, data_alignment);
+		}
+		break;
+	case DIRECTIVE_REL_OFFSET:
+		// Relative to the CFA register instead of the CFA
+		if (!parse_reg_int(args, &reg, &value)) {
+			break;
+		}
+		value -= state->cfa_offset;
+		if (is_aligned(state, value)) {
+			n = dwarfw_inline_offset(buf, reg, value, data_alignment);
+		}
+		break;
+	case DIRECTIVE_VAL_OFFSET:
+		if (parse_reg_int(args, &reg, &value) && is_aligned(state, value)) {
+			n = dwarfw_inline_val_offset(buf, reg, value, data_alignment);
+		}
+		break;
+	case DIRECTIVE_RESTORE:
+		if (parse_reg(args, &reg)) {
+			n = dwarfw_inline_restore(buf, reg);
+		}
+		break;
+	case DIRECTIVE_UNDEFINED:
+		if (parse_reg(args, &reg)) {
+			n = dwarfw_inline_undefined(buf, reg);
+		}
+		break;
+	case DIRECTIVE_SAME_VALUE:
+		if (parse_reg(args, &reg)) {
+			n = dwarfw_inline_same_value(buf, reg);
+		}
+		break;
+	case DIRECTIVE_REGISTER:;
+		struct token arg;
+		if (next_arg(args, &arg) && parse_register(arg, &reg) &&
+				parse_reg(args, &reg2)) {
+			n = dwarfw_inline_register(buf, reg, reg2);
+		}
+		break;
+	case DIRECTIVE_REMEMBER_STATE:
+		if (args_end(args) && state->stack_len < STATE_STACK_LEN) {
+			state->stack[state->stack_len].cfa_register = state->cfa_register;
+			state->stack[state->stack_len].cfa_offset = state->cfa_offset;
+			++state->stack_len;
+			n = dwarfw_inline_remember_state(buf);
+		}
+		break;
+	case DIRECTIVE_RESTORE_STATE:
+		if (args_end(args) && state->stack_len > 0) {
+			--state->stack_len;
+			state->cfa_register = state->stack[state->stack_len].cfa_register;
+			state->cfa_offset = state->stack[state->stack_len].cfa_offset;
+			n = dwarfw_inline_restore_state(buf);
+		}
+		break;
+	default:
+		break;
+	}
+	if (!n) {
+		return false;
+	}
+	state->instructions_len += n;
+	return true;
+}
+
+static bool line_run(struct asm_state *state, struct token line) {
+	// Comments run until the end of the line
+	const char *comment = memchr(line.s, '#', line.len);
+	if (comment != NULL) {
+		line.len = comment - line.s;
+	}
+	skip_spaces(&line);
+	if (line.len == 0) {
+		return true;
+	}
+
+	if (line.s[0] != '.') {
+		uint64_t address;
+		if (parse_address(line, &address)) {
+			state->address = address;
+		}
+		return true; // Labels and instructions are ignored
+	}
+
+	if (line.len < 5 || memcmp(line.s, ".cfi_", 5) != 0) {
+		return true; // Other directives are ignored
+	}
+	struct token name = { .s = line.s + 5, .len = 0 };
+	while (5 + name.len < line.len && !is_space(name.s[name.len])) {
+		++name.len;
+	}
+	struct token args = {
+		.s = name.s + name.len,
+		.len = line.len - 5 - name.len,
+	};
+
+	for (size_t i = 0; i < sizeof(directives) / sizeof(directives[0]); ++i) {
+		if (directives[i].len == name.len &&
+				memcmp(directives[i].name, name.s, name.len) == 0) {
+			return directive_run(state, directives[i].directive, &args);
+		}
+	}
+	return false; // Unsupported directive
+}
+
+bool dwarfw_asm_init(struct dwarfw_asm *out, struct dwarfw_cie *cie,
+		const char *text, size_t text_len) {
+	memset(out, 0, sizeof(*out));
+
+	struct asm_state state = { .out = out, .cie = cie };
+
+	// The CFA set by the CIE is needed to track CFA offset adjustments
+	struct dwarfw_fde empty = { .cie = cie };
+	struct dwarfw_cfi_row row;
+	if (!dwarfw_cfi_eval(&empty, 0, &row)) {
+		return false;
+	}
+	state.initial_cfa_register = row.cfa.reg;
+	state.initial_cfa_offset = row.cfa.offset;
+
+	size_t line_number = 0;
+	const char *s = text, *end = text + text_len;
+	while (s < end) {
+		++line_number;
+		const char *eol = memchr(s, '\n', end - s);
+		if (eol == NULL) {
+			eol = end;
+		}
+		struct token line = { .s = s, .len = eol - s };
+		if (!line_run(&state, line)) {
+			goto error;
+		}
+		s = eol + 1;
+	}
+	if (state.in_proc) {
+		goto error; // Missing .cfi_endproc
+	}
+
+	// Instructions of all FDEs follow each other in the buffer, which can
+	// move while it grows
+	size_t offset = 0;
+	for (size_t i = 0; i < out->fdes_len && out->instructions != NULL; ++i) {
+		out->fdes[i].instructions = out->instructions + offset;
+		offset += out->fdes[i].instructions_length;
+	}
+	return true;
+
+error:
+	dwarfw_asm_finish(out);
+	out->error_line = line_number;
+	return false;
+}
+
+void dwarfw_asm_finish(struct dwarfw_asm *out) {
+	free(out->fdes);
+	free(out->instructions);
+	memset(out, 0, sizeof(*out));
+}
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+#include <dwarfw.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define ASYNC_BUFFER_SIZE (1 << 20)
+#define ASYNC_BUFFERS 4
+#define ASYNC_THREADS 2
+
+struct async_buffer {
+	char *data;
+	size_t len;
+	uint64_t offset; // in the file
+	bool in_flight;
+	struct async_buffer *next; // in the thread pool queue
+};
+
+struct async {
+	int fd;
+	uint64_t start, offset; // in the file
+	struct dwarfw_async_stats *stats_out;
+	struct dwarfw_async_stats stats;
+	uint64_t depth_sum;
+	struct timespec opened;
+
+	struct async_buffer buffers[ASYNC_BUFFERS];
+	struct async_buffer *current; // being filled, NULL if none
+	size_t in_flight;
+	bool failed;
+
+#ifdef HAVE_LIBURING
+	struct io_uring ring;
+#endif
+
+	// pwrite thread pool, used when io_uring isn't available. Buffers are
+	// handed over with the mutex held.
+	pthread_mutex_t mutex;
+	pthread_cond_t queued, done;
+	struct async_buffer *queue, **queue_tail;
+	bool closing;
+	pthread_t threads[ASYNC_THREADS];
+	size_t threads_len;
+};
+
+static bool pwrite_all(int fd, const char *buf, size_t len, uint64_t offset) {
+	while (len > 0) {
+		ssize_t n = pwrite(fd, buf, len, offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		buf += n;
+		len -= n;
+		offset += n;
+	}
+	return true;
+}
+
+static void *worker_run(void *data) {
+	struct async *a = data;
+
+	pthread_mutex_lock(&a->mutex);
+	while (true) {
+		while (a->queue == NULL && !a->closing) {
+			pthread_cond_wait(&a->queued, &a->mutex);
+		}
+		struct async_buffer *buf = a->queue;
+		if (buf == NULL) {
+			break; // Closing, and nothing left to write
+		}
+		a->queue = buf->next;
+		if (a->queue == NULL) {
+			a->queue_tail = &a->queue;
+		}
+
+		pthread_mutex_unlock(&a->mutex);
+		bool ok = pwrite_all(a->fd, buf->data, buf->len, buf->offset);
+		pthread_mutex_lock(&a->mutex);
+
+		buf->in_flight = false;
+		--a->in_flight;
+		a->failed |= !ok;
+		pthread_cond_broadcast(&a->done);
+	}
+	pthread_mutex_unlock(&a->mutex);
+	return NULL;
+}
+
+#ifdef HAVE_LIBURING
+// Submit functions return the number of buffers in flight, 0 on error
+static size_t uring_submit(struct async *a, struct async_buffer *buf) {
+	// There are as many submission queue entries as buffers
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&a->ring);
+	if (sqe == NULL) {
+		return 0;
+	}
+	io_uring_prep_write(sqe, a->fd, buf->data, buf->len, buf->offset);
+	io_uring_sqe_set_data(sqe, buf);
+	if (io_uring_submit(&a->ring) < 0) {
+		return 0;
+	}
+	buf->in_flight = true;
+	return ++a->in_flight;
+}
+
+static void uring_wait_one(struct async *a) {
+	struct io_uring_cqe *cqe;
+	int ret;
+	do {
+		ret = io_uring_wait_cqe(&a->ring, &cqe);
+	} while (ret == -EINTR);
+	if (ret < 0) {
+		a->failed = true;
+		return;
+	}
+
+	struct async_buffer *buf = io_uring_cqe_get_data(cqe);
+	if (cqe->res < 0) {
+		a->failed = true;
+	} else if ((size_t)cqe->res < buf->len) {
+		// Short writes are rare, finish them synchronously
+		a->failed |= !pwrite_all(a->fd, buf->data + cqe->res,
+			buf->len - cqe->res, buf->offset + cqe->res);
+	}
+	io_uring_cqe_seen(&a->ring, cqe);
+	buf->in_flight = false;
+	--a->in_flight;
+}
+#else
+static size_t uring_submit(struct async *a, struct async_buffer *buf) {
+	return 0;
+}
+
+static void uring_wait_one(struct async *a) {
+	// Unreachable
+}
+#endif
+
+static size_t pool_submit(struct async *a, struct async_buffer *buf) {
+	pthread_mutex_lock(&a->mutex);
+	buf->in_flight = true;
+	size_t in_flight = ++a->in_flight;
+	buf->next = NULL;
+	*a->queue_tail = buf;
+	a->queue_tail = &buf->next;
+	pthread_cond_signal(&a->queued);
+	pthread_mutex_unlock(&a->mutex);
+	return in_flight;
+}
+
+static void pool_wait_one(struct async *a) {
+	pthread_mutex_lock(&a->mutex);
+	size_t in_flight = a->in_flight;
+	while (a->in_flight == in_flight && in_flight > 0) {
+		pthread_cond_wait(&a->done, &a->mutex);
+	}
+	pthread_mutex_unlock(&a->mutex);
+}
+
+static bool submit(struct async *a) {
+	struct async_buffer *buf = a->current;
+	a->current = NULL;
+	if (buf == NULL || buf->len == 0) {
+		return true;
+	}
+
+	size_t depth = a->stats.io_uring ?
+		uring_submit(a, buf) : pool_submit(a, buf);
+	if (depth == 0) {
+		return false;
+	}
+
+	++a->stats.writes;
+	a->stats.bytes += buf->len;
+	a->depth_sum += depth;
+	if (depth > a->stats.max_queue_depth) {
+		a->stats.max_queue_depth = depth;
+	}
+	return true;
+}
+
+// Waits for at least one in-flight buffer to be written
+static void wait_one(struct async *a) {
+	if (a->stats.io_uring) {
+		uring_wait_one(a);
+	} else {
+		pool_wait_one(a);
+	}
+}
+
+static size_t in_flight(struct async *a) {
+	pthread_mutex_lock(&a->mutex);
+	size_t n = a->in_flight;
+	pthread_mutex_unlock(&a->mutex);
+	return n;
+}
+
+static bool failed(struct async *a) {
+	pthread_mutex_lock(&a->mutex);
+	bool ret = a->failed;
+	pthread_mutex_unlock(&a->mutex);
+	return ret;
+}
+
+static void drain(struct async *a) {
+	while (in_flight(a) > 0) {
+		wait_one(a);
+	}
+}
+
+static struct async_buffer *acquire(struct async *a) {
+	if (in_flight(a) == ASYNC_BUFFERS) {
+		++a->stats.waits;
+		wait_one(a);
+	}
+
+	pthread_mutex_lock(&a->mutex);
+	struct async_buffer *buf = NULL;
+	for (size_t i = 0; i < ASYNC_BUFFERS && buf == NULL; ++i) {
+		if (!a->buffers[i].in_flight) {
+			buf = &a->buffers[i];
+		}
+	}
+	pthread_mutex_unlock(&a->mutex);
+
+	if (buf != NULL) {
+		buf->len = 0;
+		buf->offset = a->offset;
+		a->current = buf;
+	}
+	return buf;
+}
+
+static ssize_t async_write(void *data, const char *buf, size_t len) {
+	struct async *a = data;
+
+	size_t written = 0;
+	while (written < len) {
+		if (a->current == NULL && acquire(a) == NULL) {
+			return -1;
+		}
+		struct async_buffer *current = a->current;
+		size_t n = ASYNC_BUFFER_SIZE - current->len;
+		if (n > len - written) {
+			n = len - written;
+		}
+		memcpy(current->data + current->len, buf + written, n);
+		current->len += n;
+		written += n;
+		a->offset += n;
+
+		if (current->len == ASYNC_BUFFER_SIZE && !submit(a)) {
+			return -1;
+		}
+	}
+
+	// Report write errors as soon as possible
+	return failed(a) ? -1 : (ssize_t)len;
+}
+
+static int async_seek(void *data, off64_t *offset, int whence) {
+	struct async *a = data;
+
+	uint64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = a->start + *offset;
+		break;
+	case SEEK_CUR:
+		pos = a->offset + *offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < a->start) {
+		return -1;
+	}
+
+	if (pos != a->offset) {
+		// Later writes could overwrite in-flight ones, complete them first
+		if (!submit(a)) {
+			return -1;
+		}
+		drain(a);
+		a->offset = pos;
+	}
+
+	*offset = pos - a->start;
+	return 0;
+}
+
+static void async_destroy(struct async *a) {
+	if (a->threads_len > 0) {
+		pthread_mutex_lock(&a->mutex);
+		a->closing = true;
+		pthread_cond_broadcast(&a->queued);
+		pthread_mutex_unlock(&a->mutex);
+		for (size_t i = 0; i < a->threads_len; ++i) {
+			pthread_join(a->threads[i], NULL);
+		}
+	}
+#ifdef HAVE_LIBURING
+	if (a->stats.io_uring) {
+		io_uring_queue_exit(&a->ring);
+	}
+#endif
+	pthread_cond_destroy(&a->queued);
+	pthread_cond_destroy(&a->done);
+	pthread_mutex_destroy(&a->mutex);
+	for (size_t i = 0; i < ASYNC_BUFFERS; ++i) {
+		free(a->buffers[i].data);
+	}
+	free(a);
+}
+
+static int async_close(void *data) {
+	struct async *a = data;
+
+	bool ok = submit(a);
+	drain(a);
+	ok = ok && !failed(a);
+
+	if (a->stats_out != NULL) {
+		struct timespec closed;
+		clock_gettime(CLOCK_MONOTONIC, &closed);
+		a->stats.seconds = (closed.tv_sec - a->opened.tv_sec) +
+			(closed.tv_nsec - a->opened.tv_nsec) / 1e9;
+		if (a->stats.writes > 0) {
+			a->stats.mean_queue_depth = (double)a->depth_sum / a->stats.writes;
+		}
+		*a->stats_out = a->stats;
+	}
+
+	async_destroy(a);
+	return ok ? 0 : -1;
+}
+
+FILE *dwarfw_async_open(int fd, uint64_t offset,
+		struct dwarfw_async_stats *stats) {
+	struct async *a = calloc(1, sizeof(struct async));
+	if (a == NULL) {
+		return NULL;
+	}
+	a->fd = fd;
+	a->start = a->offset = offset;
+	a->stats_out = stats;
+	a->queue_tail = &a->queue;
+	clock_gettime(CLOCK_MONOTONIC, &a->opened);
+	pthread_mutex_init(&a->mutex, NULL);
+	pthread_cond_init(&a->queued, NULL);
+	pthread_cond_init(&a->done, NULL);
+
+	for (size_t i = 0; i < ASYNC_BUFFERS; ++i) {
+		a->buffers[i].data = malloc(ASYNC_BUFFER_SIZE);
+		if (a->buffers[i].data == NULL) {
+			goto error;
+		}
+	}
+
+#ifdef HAVE_LIBURING
+	// io_uring can be missing or disabled, even if liburing is there
+	a->stats.io_uring = io_uring_queue_init(ASYNC_BUFFERS, &a->ring, 0) == 0;
+#endif
+	if (!a->stats.io_uring) {
+		for (size_t i = 0; i < ASYNC_THREADS; ++i) {
+			if (pthread_create(&a->threads[i], NULL, worker_run, a) != 0) {
+				goto error;
+			}
+			++a->threads_len;
+		}
+	}
+
+	cookie_io_functions_t funcs = {
+		.write = async_write,
+		.seek = async_seek,
+		.close = async_close,
+	};
+	FILE *f = fopencookie(a, "w", funcs);
+	if (f == NULL) {
+		goto error;
+	}
+	return f;
+
+error:
+	async_destroy(a);
+	return NULL;
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <dwarfw.h>
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifndef ELFCOMPRESS_ZSTD
+#define ELFCOMPRESS_ZSTD 2
+#endif
+
+#define OUT_BUF_SIZE 16384
+
+struct compressor {
+	FILE *f;
+	uint32_t type;
+	long header_offset;
+	uint64_t size; // uncompressed
+	bool failed;
+#ifdef HAVE_ZLIB
+	z_stream zlib;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_CStream *zstd;
+#endif
+	char out[OUT_BUF_SIZE];
+};
+
+#ifdef HAVE_ZLIB
+static bool zlib_compress(struct compressor *c, const char *buf, size_t len,
+		int flush) {
+	c->zlib.next_in = (Bytef *)buf;
+	c->zlib.avail_in = len;
+	int ret;
+	do {
+		c->zlib.next_out = (Bytef *)c->out;
+		c->zlib.avail_out = sizeof(c->out);
+		ret = deflate(&c->zlib, flush);
+		if (ret == Z_STREAM_ERROR) {
+			return false;
+		}
+		size_t n = sizeof(c->out) - c->zlib.avail_out;
+		if (n > 0 && fwrite(c->out, 1, n, c->f) != n) {
+			return false;
+		}
+	} while (c->zlib.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+	return true;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static bool zstd_compress(struct compressor *c, const char *buf, size_t len,
+		ZSTD_EndDirective end) {
+	ZSTD_inBuffer in = { .src = buf, .size = len };
+	size_t remaining;
+	do {
+		ZSTD_outBuffer out = { .dst = c->out, .size = sizeof(c->out) };
+		remaining = ZSTD_compressStream2(c->zstd, &out, &in, end);
+		if (ZSTD_isError(remaining)) {
+			return false;
+		}
+		if (out.pos > 0 && fwrite(c->out, 1, out.pos, c->f) != out.pos) {
+			return false;
+		}
+	} while (in.pos < in.size || (end == ZSTD_e_end && remaining > 0));
+	return true;
+}
+#endif
+
+static ssize_t compressor_write(void *data, const char *buf, size_t len) {
+	struct compressor *c = data;
+	bool ok = false;
+	switch (c->type) {
+#ifdef HAVE_ZLIB
+	case ELFCOMPRESS_ZLIB:
+		ok = zlib_compress(c, buf, len, Z_NO_FLUSH);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ELFCOMPRESS_ZSTD:
+		ok = zstd_compress(c, buf, len, ZSTD_e_continue);
+		break;
+#endif
+	}
+	if (!ok) {
+		c->failed = true;
+		return -1;
+	}
+	c->size += len;
+	return len;
+}
+
+static void compressor_destroy(struct compressor *c) {
+	switch (c->type) {
+#ifdef HAVE_ZLIB
+	case ELFCOMPRESS_ZLIB:
+		deflateEnd(&c->zlib);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ELFCOMPRESS_ZSTD:
+		ZSTD_freeCStream(c->zstd);
+		break;
+#endif
+	}
+	free(c);
+}
+
+static int compressor_close(void *data) {
+	struct compressor *c = data;
+
+	bool ok = !c->failed;
+	switch (c->type) {
+#ifdef HAVE_ZLIB
+	case ELFCOMPRESS_ZLIB:
+		ok = ok && zlib_compress(c, NULL, 0, Z_FINISH);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ELFCOMPRESS_ZSTD:
+		ok = ok && zstd_compress(c, NULL, 0, ZSTD_e_end);
+		break;
+#endif
+	}
+
+	// Now that the uncompressed size is known, patch the header
+	long end = ftell(c->f);
+	uint64_t ch_size = c->size;
+	ok = ok && end >= 0 &&
+		fseek(c->f, c->header_offset + offsetof(Elf64_Chdr, ch_size),
+			SEEK_SET) == 0 &&
+		fwrite(&ch_size, 1, sizeof(ch_size), c->f) == sizeof(ch_size) &&
+		fseek(c->f, end, SEEK_SET) == 0;
+
+	compressor_destroy(c);
+	return ok ? 0 : EOF;
+}
+
+FILE *dwarfw_compress_open(uint32_t type, uint64_t addralign, FILE *f) {
+	struct compressor *c = calloc(1, sizeof(struct compressor));
+	if (c == NULL) {
+		return NULL;
+	}
+	c->f = f;
+	c->type = type;
+
+	switch (type) {
+#ifdef HAVE_ZLIB
+	case ELFCOMPRESS_ZLIB:
+		if (deflateInit(&c->zlib, Z_BEST_COMPRESSION) != Z_OK) {
+			free(c);
+			return NULL;
+		}
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ELFCOMPRESS_ZSTD:
+		c->zstd = ZSTD_createCStream();
+		if (c->zstd == NULL) {
+			free(c);
+			return NULL;
+		}
+		break;
+#endif
+	default:
+		free(c);
+		return NULL; // Unsupported compression
+	}
+
+	// ch_size is filled in when the stream is closed
+	Elf64_Chdr chdr = {
+		.ch_type = type,
+		.ch_addralign = addralign,
+	};
+	c->header_offset = ftell(f);
+	if (c->header_offset < 0 ||
+			fwrite(&chdr, 1, sizeof(chdr), f) != sizeof(chdr)) {
+		goto error;
+	}
+
+	cookie_io_functions_t funcs = {
+		.write = compressor_write,
+		.close = compressor_close,
+	};
+	FILE *compressed = fopencookie(c, "w", funcs);
+	if (compressed == NULL) {
+		goto error;
+	}
+	return compressed;
+
+error:
+	compressor_destroy(c);
+	return NULL;
+}
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <dwarf.h>
 #include <dwarfw.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,34 +9,81 @@
 #include "pointer.h"
 
 #define ADDRESS_SIZE sizeof(uint32_t)
-
-static size_t cfi_section_length_length(size_t body_length) {
+#define DWARF64_ADDRESS_SIZE sizeof(uint64_t)
+// .debug_frame isn't loaded, addresses are target-sized and absolute
+#define DEBUG_FRAME_ADDRESS_SIZE sizeof(uint64_t)
+#define DEBUG_FRAME_VERSION 4
+#define DEBUG_FRAME_CIE_ID 0xFFFFFFFF
+#define DEBUG_FRAME_CIE_ID_64 0xFFFFFFFFFFFFFFFF
+
+static size_t cfi_section_length_length(struct dwarfw_cie *cie) {
 	size_t length = sizeof(uint32_t);
-	if (body_length >= 0xFFFFFFFF) {
-		length += sizeof(uint64_t);
+	if (cie->dwarf64) {
+		length += sizeof(uint64_t); // Extended length
 	}
 	return length;
 }
 
-static size_t cfi_section_length(size_t body_length, size_t *padding_length) {
+// rel is true for records written with REL relocations
+static size_t cfi_address_size(struct dwarfw_cie *cie, bool rel) {
+	if (cie->dwarf64) {
+		return DWARF64_ADDRESS_SIZE;
+	}
+	if (cie->debug_frame) {
+		return DEBUG_FRAME_ADDRESS_SIZE;
+	}
+	if (!rel) {
+		return ADDRESS_SIZE;
+	}
+
+	// Keep 8-byte pointers aligned, so that they can be relocated with RELR
+	switch (cie->augmentation_data.pointer_encoding & 0x0F) {
+	case DW_EH_PE_absptr:
+	case DW_EH_PE_udata8:
+	case DW_EH_PE_sdata8:
+		return sizeof(uint64_t);
+	default:
+		return ADDRESS_SIZE;
+	}
+}
+
+static size_t cfi_section_length(struct dwarfw_cie *cie, size_t body_length,
+		bool rel, size_t *padding_length) {
 	// The length field is not included in the total length
-	size_t header_length = sizeof(uint32_t); // CIE pointer
+	size_t header_length = cie->dwarf64 ? sizeof(uint64_t) : sizeof(uint32_t);
 
+	size_t address_size = cfi_address_size(cie, rel);
 	size_t length = header_length + body_length;
-	*padding_length = ADDRESS_SIZE - (length % ADDRESS_SIZE);
+	// Records are aligned including their length field
+	size_t unaligned = cfi_section_length_length(cie) + length;
+	*padding_length = address_size - (unaligned % address_size);
 
-	return length + *padding_length;
+	length += *padding_length;
+	if (!cie->dwarf64 && length >= 0xFFFFFFFF) {
+		return 0; // Needs the 64-bit format
+	}
+	return length;
 }
 
-static size_t cfi_header_write(size_t length, uint32_t cie_pointer, FILE *f) {
+static size_t cfi_header_write(struct dwarfw_cie *cie, size_t length,
+		uint64_t cie_pointer, FILE *f) {
 	size_t n, written = 0;
 
-	if (length < 0xFFFFFFFF) {
+	if (!cie->dwarf64) {
 		uint32_t length_u32 = length;
 		if (!(n = fwrite(&length_u32, 1, sizeof(length_u32), f))) {
 			return 0;
 		}
 		written += n;
+
+		if (cie_pointer > 0xFFFFFFFF) {
+			return 0; // Needs the 64-bit format
+		}
+		uint32_t cie_pointer_u32 = cie_pointer;
+		if (!(n = fwrite(&cie_pointer_u32, 1, sizeof(cie_pointer_u32), f))) {
+			return 0;
+		}
+		written += n;
 	} else {
 		// Extended length
 		uint32_t length_u32 = 0xFFFFFFFF;
@@ -44,26 +92,103 @@ static size_t cfi_header_write(size_t length, uint32_t cie_pointer, FILE *f) {
 		}
 		written += n;
 
-		uint32_t length_u64 = length;
+		uint64_t length_u64 = length;
 		if (!(n = fwrite(&length_u64, 1, sizeof(length_u64), f))) {
 			return 0;
 		}
 		written += n;
-	}
 
-	if (!(n = fwrite(&cie_pointer, 1, sizeof(cie_pointer), f))) {
-		return 0;
+		if (!(n = fwrite(&cie_pointer, 1, sizeof(cie_pointer), f))) {
+			return 0;
+		}
+		written += n;
 	}
-	written += n;
 
 	return written;
 }
 
+static size_t cfi_header_length(struct dwarfw_cie *cie) {
+	// Length and CIE pointer
+	return cfi_section_length_length(cie) +
+		(cie->dwarf64 ? sizeof(uint64_t) : sizeof(uint32_t));
+}
 
-static size_t cie_header_write(struct dwarfw_cie *cie, FILE *f) {
+// Only fixed-size personalities, so that the augmentation data length is
+// known upfront
+static bool cie_augmentation_data_length(struct dwarfw_cie *cie,
+		size_t *len) {
+	uint8_t personality_enc = cie->augmentation_data.personality_encoding;
+
+	*len = 0;
+	for (const char *c = cie->augmentation + 1; *c != '\0'; ++c) {
+		switch (*c) {
+		case 'R':
+		case 'L':
+			*len += sizeof(uint8_t);
+			break;
+		case 'P':
+			*len += sizeof(uint8_t);
+			if (personality_enc != DW_EH_PE_omit) {
+				size_t n = pointer_size(personality_enc);
+				if (n == 0) {
+					return false;
+				}
+				*len += n;
+			}
+			break;
+		case 'S':
+			break; // Signal frame, no data
+		default:
+			return false; // Unknown augmentation
+		}
+	}
+	return true;
+}
+
+// Length of what cie_header_write writes, without writing it
+static size_t cie_header_length(struct dwarfw_cie *cie) {
+	size_t length = sizeof(uint8_t) + strlen(cie->augmentation) + 1;
+	if (cie->debug_frame) {
+		length += 2 * sizeof(uint8_t);
+	}
+	length += leb128_length_u64(cie->code_alignment);
+	length += leb128_length_s64(cie->data_alignment);
+	length += leb128_length_u64(cie->return_address_register);
+
+	if (cie->augmentation[0] == 'z') {
+		size_t len;
+		if (!cie_augmentation_data_length(cie, &len)) {
+			return 0;
+		}
+		length += leb128_length_u64(len) + len;
+	}
+
+	return length;
+}
+
+// Encoding of the FDE pointers, as written in the "R" augmentation
+static uint8_t cie_pointer_encoding(struct dwarfw_cie *cie) {
+	if (cie->debug_frame) {
+		return DW_EH_PE_absptr | DW_EH_PE_udata8;
+	}
+	return cie->augmentation_data.pointer_encoding;
+}
+
+// offset is the position of the header in the record
+static size_t cie_header_write(struct dwarfw_cie *cie, size_t offset,
+		GElf_Rela *rela, FILE *f) {
 	size_t n, written = 0;
 
-	if (!(n = fwrite(&cie->version, 1, sizeof(cie->version), f))) {
+	if (rela != NULL) {
+		rela->r_offset = 0;
+		rela->r_info = GELF_R_INFO(0, R_X86_64_NONE);
+		rela->r_addend = 0;
+	}
+
+	uint8_t personality_enc = cie->augmentation_data.personality_encoding;
+
+	uint8_t version = cie->debug_frame ? DEBUG_FRAME_VERSION : cie->version;
+	if (!(n = fwrite(&version, 1, sizeof(version), f))) {
 		return 0;
 	}
 	written += n;
@@ -71,6 +196,13 @@ static size_t cie_header_write(struct dwarfw_cie *cie, FILE *f) {
 		return 0;
 	}
 	written += n;
+	if (cie->debug_frame) {
+		uint8_t sizes[] = { DEBUG_FRAME_ADDRESS_SIZE, 0 }; // address, segment
+		if (!(n = fwrite(sizes, 1, sizeof(sizes), f))) {
+			return 0;
+		}
+		written += n;
+	}
 	if (!(n = leb128_write_u64(cie->code_alignment, f, 0))) {
 		return 0;
 	}
@@ -85,56 +217,90 @@ static size_t cie_header_write(struct dwarfw_cie *cie, FILE *f) {
 	written += n;
 
 	if (cie->augmentation[0] == 'z') {
-		uint8_t augmentation_data[1];
-		size_t len = 0;
-
-		if (strchr(cie->augmentation, 'R') != NULL) {
-			augmentation_data[len] = cie->augmentation_data.pointer_encoding;
-			++len;
+		// The augmentation data length comes first
+		size_t len;
+		if (!cie_augmentation_data_length(cie, &len)) {
+			return 0;
 		}
-
 		if (!(n = leb128_write_u64(len, f, 0))) {
 			return 0;
 		}
 		written += n;
-		if (!(n = fwrite(augmentation_data, 1, len, f))) {
-			return 0;
+
+		for (const char *c = cie->augmentation + 1; *c != '\0'; ++c) {
+			uint8_t enc;
+			switch (*c) {
+			case 'R':
+				enc = cie_pointer_encoding(cie);
+				break;
+			case 'P':
+				enc = personality_enc;
+				break;
+			case 'L':
+				enc = cie->augmentation_data.lsda_encoding;
+				break;
+			default:
+				continue;
+			}
+			if (!(n = fwrite(&enc, 1, sizeof(enc), f))) {
+				return 0;
+			}
+			written += n;
+
+			if (*c != 'P' || enc == DW_EH_PE_omit) {
+				continue;
+			}
+			if (rela != NULL) {
+				if (!(n = pointer_write(0, enc, 0, f))) {
+					return 0;
+				}
+				rela->r_offset = offset + written;
+				rela->r_info = GELF_R_INFO(0, pointer_rela_type(enc));
+				rela->r_addend = cie->augmentation_data.personality;
+			} else {
+				n = pointer_write(cie->augmentation_data.personality, enc,
+					offset + written, f);
+				if (!n) {
+					return 0;
+				}
+			}
+			written += n;
 		}
-		written += n;
 	}
 
 	return written;
 }
 
-size_t dwarfw_cie_write(struct dwarfw_cie *cie, FILE *f) {
+static size_t cie_write(struct dwarfw_cie *cie, GElf_Rela *rela, bool rel,
+		FILE *f) {
 	size_t n, written = 0;
 
-	// Encode header
-	size_t header_len;
-	char *header_buf;
-	FILE *header_f = open_memstream(&header_buf, &header_len);
-	if (header_f == NULL) {
+	// We need to know the size of the header, which comes after the length
+	size_t header_len = cie_header_length(cie);
+	if (header_len == 0) {
 		return 0;
 	}
-	if (!cie_header_write(cie, header_f)) {
-		return 0;
-	}
-	fclose(header_f);
 
 	size_t padding_length;
-	size_t length = cfi_section_length(header_len + cie->instructions_length,
-		&padding_length);
+	size_t length = cfi_section_length(cie,
+		header_len + cie->instructions_length, rel, &padding_length);
+	if (length == 0) {
+		return 0;
+	}
 
-	// CIE pointer is always zero for CIEs
-	if (!(n = cfi_header_write(length, 0, f))) {
+	// The CIE pointer of CIEs is a fixed CIE id
+	uint64_t cie_id = 0;
+	if (cie->debug_frame) {
+		cie_id = cie->dwarf64 ? DEBUG_FRAME_CIE_ID_64 : DEBUG_FRAME_CIE_ID;
+	}
+	if (!(n = cfi_header_write(cie, length, cie_id, f))) {
 		return 0;
 	}
 	written += n;
 
-	if (!(n = fwrite(header_buf, 1, header_len, f))) {
+	if (!(n = cie_header_write(cie, written, rela, f))) {
 		return 0;
 	}
-	free(header_buf);
 	written += n;
 
 	if (cie->instructions_length > 0) {
@@ -152,18 +318,91 @@ size_t dwarfw_cie_write(struct dwarfw_cie *cie, FILE *f) {
 	return written;
 }
 
+size_t dwarfw_cie_write(struct dwarfw_cie *cie, FILE *f) {
+	return cie_write(cie, NULL, false, f);
+}
 
-static size_t fde_header_write(struct dwarfw_fde *fde, size_t offset,
-		GElf_Rela *rela, FILE *f) {
-	size_t n, written = 0;
+size_t dwarfw_cie_size(struct dwarfw_cie *cie) {
+	size_t header_len = cie_header_length(cie);
+	if (header_len == 0) {
+		return 0;
+	}
+	size_t padding_length;
+	size_t length = cfi_section_length(cie,
+		header_len + cie->instructions_length, false, &padding_length);
+	if (length == 0) {
+		return 0;
+	}
+	return cfi_section_length_length(cie) + length;
+}
 
-	uint8_t ptr_enc = fde->cie->augmentation_data.pointer_encoding;
-	if (rela == NULL) {
-		if (!(n = pointer_write(fde->initial_location, ptr_enc, offset, f))) {
+size_t dwarfw_cie_write_rela(struct dwarfw_cie *cie, GElf_Rela *rela,
+		FILE *f) {
+	return cie_write(cie, rela, false, f);
+}
+
+size_t dwarfw_cie_write_rel(struct dwarfw_cie *cie, FILE *f) {
+	// The personality would need a relocation
+	GElf_Rela rela;
+	size_t n = cie_write(cie, &rela, true, f);
+	if (n == 0 || GELF_R_TYPE(rela.r_info) != R_X86_64_NONE) {
+		return 0;
+	}
+	return n;
+}
+
+static uint8_t fde_lsda_encoding(struct dwarfw_fde *fde) {
+	if (fde->cie->augmentation[0] != 'z' ||
+			strchr(fde->cie->augmentation, 'L') == NULL) {
+		return DW_EH_PE_omit;
+	}
+	return fde->cie->augmentation_data.lsda_encoding;
+}
+
+static uint8_t fde_pointer_encoding(struct dwarfw_fde *fde) {
+	return cie_pointer_encoding(fde->cie);
+}
+
+// Length of what fde_header_write writes, without writing it
+static size_t fde_header_length(struct dwarfw_fde *fde, size_t offset,
+		GElf_Rela *rela, GElf_Rel *rel) {
+	size_t n, length = 0;
+
+	uint8_t ptr_enc = fde_pointer_encoding(fde);
+	if (rela != NULL) {
+		n = pointer_length(0, ptr_enc, 0);
+	} else if (rel != NULL) {
+		n = pointer_length(fde->initial_location, ptr_enc & 0x0F, 0);
+	} else {
+		n = pointer_length(fde->initial_location, ptr_enc, offset);
+	}
+	if (!n) {
+		return 0;
+	}
+	length += n;
+	if (!(n = pointer_length(fde->address_range, ptr_enc & 0x0F, 0))) {
+		return 0;
+	}
+	length += n;
+
+	if (fde->cie->augmentation[0] == 'z') {
+		uint8_t lsda_enc = fde_lsda_encoding(fde);
+		size_t lsda_len = 0;
+		if (lsda_enc != DW_EH_PE_omit && !(lsda_len = pointer_size(lsda_enc))) {
 			return 0;
 		}
-		written += n;
-	} else {
+		length += leb128_length_u64(lsda_len) + lsda_len;
+	}
+
+	return length;
+}
+
+static size_t fde_header_write(struct dwarfw_fde *fde, size_t offset,
+		GElf_Rela *rela, GElf_Rel *rel, GElf_Rela *lsda_rela, FILE *f) {
+	size_t n, written = 0;
+
+	uint8_t ptr_enc = fde_pointer_encoding(fde);
+	if (rela != NULL) {
 		if (!(n = pointer_write(0, ptr_enc, 0, f))) {
 			return 0;
 		}
@@ -172,57 +411,110 @@ static size_t fde_header_write(struct dwarfw_fde *fde, size_t offset,
 		rela->r_offset = offset;
 		rela->r_info = GELF_R_INFO(0, pointer_rela_type(ptr_enc));
 		rela->r_addend = fde->initial_location;
+	} else if (rel != NULL) {
+		// The addend is stored in place, as is
+		if (!(n = pointer_write(fde->initial_location, ptr_enc & 0x0F, 0, f))) {
+			return 0;
+		}
+		written += n;
+
+		rel->r_offset = offset;
+		rel->r_info = GELF_R_INFO(0, pointer_rela_type(ptr_enc));
+	} else {
+		if (!(n = pointer_write(fde->initial_location, ptr_enc, offset, f))) {
+			return 0;
+		}
+		written += n;
 	}
 
-	// Address range seems to always be a uint32_t for .eh_frame
-	if (!(n = fwrite(&fde->address_range, 1, sizeof(fde->address_range), f))) {
+	// The address range has the size of the initial location, but is never
+	// relative
+	if (!(n = pointer_write(fde->address_range, ptr_enc & 0x0F, 0, f))) {
 		return 0;
 	}
 	written += n;
 
 	if (fde->cie->augmentation[0] == 'z') {
-		if (!(n = leb128_write_u64(0, f, 0))) {
+		uint8_t lsda_enc = fde_lsda_encoding(fde);
+		size_t lsda_len = 0;
+		if (lsda_enc != DW_EH_PE_omit && !(lsda_len = pointer_size(lsda_enc))) {
+			return 0;
+		}
+		if (!(n = leb128_write_u64(lsda_len, f, 0))) {
 			return 0;
 		}
 		written += n;
+
+		if (lsda_len > 0 && !fde->has_lsda) {
+			// A null LSDA isn't relative to anything
+			if (!(n = pointer_write(0, lsda_enc & 0x0F, 0, f))) {
+				return 0;
+			}
+			written += n;
+		} else if (lsda_len > 0 && lsda_rela != NULL) {
+			if (!(n = pointer_write(0, lsda_enc, 0, f))) {
+				return 0;
+			}
+			lsda_rela->r_offset = offset + written;
+			lsda_rela->r_info = GELF_R_INFO(0, pointer_rela_type(lsda_enc));
+			lsda_rela->r_addend = fde->lsda;
+			written += n;
+		} else if (lsda_len > 0) {
+			if (!(n = pointer_write(fde->lsda, lsda_enc, offset + written, f))) {
+				return 0;
+			}
+			written += n;
+		}
 	}
 
 	return written;
 }
 
-size_t dwarfw_fde_write(struct dwarfw_fde *fde, GElf_Rela *rela, FILE *f) {
+static size_t fde_write(struct dwarfw_fde *fde, GElf_Rela *rela, GElf_Rel *rel,
+		GElf_Rela *lsda_rela, FILE *f) {
 	size_t n, written = 0;
 
 	assert(fde->cie != NULL);
-	assert(fde->cie_pointer != 0);
+	assert(fde->cie->debug_frame || fde->cie_pointer != 0);
 
-	// We need to know the size of the header
-	// Encode header and discard it
-	size_t header_len;
-	char *header_buf;
-	FILE *header_f = open_memstream(&header_buf, &header_len);
-	if (header_f == NULL) {
+	if (lsda_rela != NULL) {
+		lsda_rela->r_offset = 0;
+		lsda_rela->r_info = GELF_R_INFO(0, R_X86_64_NONE);
+		lsda_rela->r_addend = 0;
+	}
+	// A relocated FDE needs its LSDA to be relocated too
+	if ((rela != NULL || rel != NULL) && lsda_rela == NULL &&
+			fde_lsda_encoding(fde) != DW_EH_PE_omit) {
 		return 0;
 	}
-	if (!fde_header_write(fde, 0, NULL, header_f)) {
+
+	// We need to know the size of the header, which comes after the length
+	size_t header_offset = cfi_header_length(fde->cie);
+	size_t header_len = fde_header_length(fde, header_offset, rela, rel);
+	if (header_len == 0) {
 		return 0;
 	}
-	fclose(header_f);
-	free(header_buf);
 
 	size_t padding_length;
-	size_t length = cfi_section_length(header_len + fde->instructions_length,
-		&padding_length);
+	size_t length = cfi_section_length(fde->cie,
+		header_len + fde->instructions_length, rel != NULL, &padding_length);
+	if (length == 0) {
+		return 0;
+	}
 
 	// The pointer is a relative position from the start of the section
-	// It needs to be encoded relative to the place it's written
-	size_t cie_pointer = fde->cie_pointer + cfi_section_length_length(length);
-	if (!(n = cfi_header_write(length, cie_pointer, f))) {
+	// It needs to be encoded relative to the place it's written, except in
+	// .debug_frame where it's the offset of the CIE in the section
+	uint64_t cie_pointer = fde->cie_pointer;
+	if (!fde->cie->debug_frame) {
+		cie_pointer += cfi_section_length_length(fde->cie);
+	}
+	if (!(n = cfi_header_write(fde->cie, length, cie_pointer, f))) {
 		return 0;
 	}
 	written += n;
 
-	if (!(n = fde_header_write(fde, written, rela, f))) {
+	if (!(n = fde_header_write(fde, written, rela, rel, lsda_rela, f))) {
 		return 0;
 	}
 	written += n;
@@ -241,3 +533,40 @@ size_t dwarfw_fde_write(struct dwarfw_fde *fde, GElf_Rela *rela, FILE *f) {
 
 	return written;
 }
+
+size_t dwarfw_fde_size(struct dwarfw_fde *fde) {
+	size_t header_len = fde_header_length(fde, cfi_header_length(fde->cie),
+		NULL, NULL);
+	if (header_len == 0) {
+		return 0;
+	}
+	size_t padding_length;
+	size_t length = cfi_section_length(fde->cie,
+		header_len + fde->instructions_length, false, &padding_length);
+	if (length == 0) {
+		return 0;
+	}
+	return cfi_section_length_length(fde->cie) + length;
+}
+
+size_t dwarfw_fde_instructions_offset(struct dwarfw_fde *fde) {
+	size_t header_offset = cfi_header_length(fde->cie);
+	size_t header_len = fde_header_length(fde, header_offset, NULL, NULL);
+	if (header_len == 0) {
+		return 0;
+	}
+	return header_offset + header_len;
+}
+
+size_t dwarfw_fde_write(struct dwarfw_fde *fde, GElf_Rela *rela, FILE *f) {
+	return fde_write(fde, rela, NULL, NULL, f);
+}
+
+size_t dwarfw_fde_write_rel(struct dwarfw_fde *fde, GElf_Rel *rel, FILE *f) {
+	return fde_write(fde, NULL, rel, NULL, f);
+}
+
+size_t dwarfw_fde_write_lsda(struct dwarfw_fde *fde, GElf_Rela *rela,
+		GElf_Rela *lsda_rela, FILE *f) {
+	return fde_write(fde, rela, NULL, lsda_rela, f);
+}
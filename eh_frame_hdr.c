@@ -0,0 +1,274 @@
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pointer.h"
+#include "write.h"
+
+#define EH_FRAME_HDR_VERSION 1
+#define EH_FRAME_PTR_ENC (DW_EH_PE_sdata4 | DW_EH_PE_pcrel)
+#define FDE_COUNT_ENC DW_EH_PE_udata4
+#define TABLE_ENC (DW_EH_PE_sdata4 | DW_EH_PE_datarel)
+
+// Size of version, eh_frame_ptr_enc, fde_count_enc and table_enc
+#define EH_FRAME_HDR_ENCODINGS_SIZE 4
+#define EH_FRAME_HDR_SIZE (EH_FRAME_HDR_ENCODINGS_SIZE + 2 * sizeof(uint32_t))
+
+static int entry_cmp(const void *a, const void *b) {
+	const struct dwarfw_eh_frame_hdr_entry *ea = a, *eb = b;
+	return (ea->initial_location > eb->initial_location) -
+		(ea->initial_location < eb->initial_location);
+}
+
+void dwarfw_eh_frame_hdr_sort(struct dwarfw_eh_frame_hdr_entry *entries,
+		size_t entries_len) {
+	qsort(entries, entries_len, sizeof(*entries), entry_cmp);
+}
+
+static size_t hdr_header_write(long long int eh_frame, size_t entries_len,
+		FILE *f) {
+	size_t n, written = 0;
+
+	if (entries_len > UINT32_MAX) {
+		return 0;
+	}
+
+	uint8_t encodings[EH_FRAME_HDR_ENCODINGS_SIZE] = {
+		EH_FRAME_HDR_VERSION,
+		EH_FRAME_PTR_ENC,
+		FDE_COUNT_ENC,
+		TABLE_ENC,
+	};
+	if (!(n = fwrite(encodings, 1, sizeof(encodings), f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = pointer_write(eh_frame, EH_FRAME_PTR_ENC, written, f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = write_u32(entries_len, f))) {
+		return 0;
+	}
+	written += n;
+
+	return written;
+}
+
+size_t dwarfw_eh_frame_hdr_size(size_t entries_len) {
+	return EH_FRAME_HDR_SIZE +
+		entries_len * sizeof(struct dwarfw_eh_frame_hdr_entry);
+}
+
+size_t dwarfw_eh_frame_hdr_write(long long int eh_frame,
+		struct dwarfw_eh_frame_hdr_entry *entries, size_t entries_len,
+		FILE *f) {
+	size_t n, written = 0;
+
+	if (!(n = hdr_header_write(eh_frame, entries_len, f))) {
+		return 0;
+	}
+	written += n;
+
+	dwarfw_eh_frame_hdr_sort(entries, entries_len);
+	if (entries_len > 0) {
+		if (!(n = fwrite(entries, sizeof(*entries), entries_len, f))) {
+			return 0;
+		}
+		written += n * sizeof(*entries);
+	}
+
+	return written;
+}
+
+const struct dwarfw_eh_frame_hdr_entry *dwarfw_eh_frame_hdr_lookup(
+		const void *hdr, int32_t location) {
+	const uint8_t *encodings = hdr;
+	if (encodings[0] != EH_FRAME_HDR_VERSION ||
+			encodings[1] != EH_FRAME_PTR_ENC ||
+			encodings[2] != FDE_COUNT_ENC ||
+			encodings[3] != TABLE_ENC) {
+		return NULL;
+	}
+
+	uint32_t fde_count;
+	memcpy(&fde_count, encodings + EH_FRAME_HDR_ENCODINGS_SIZE + sizeof(int32_t),
+		sizeof(fde_count));
+	const struct dwarfw_eh_frame_hdr_entry *table =
+		(const void *)(encodings + EH_FRAME_HDR_SIZE);
+
+	// Find the last entry whose initial location is <= location
+	size_t lo = 0, hi = fde_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (table[mid].initial_location <= location) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo > 0 ? &table[lo - 1] : NULL;
+}
+
+// Removed entries are kept as tombstones until they reach the oldest run
+#define SET_TOMBSTONE -1
+#define SET_RUNS_CAP 64
+#define SET_WRITE_CHUNK 256
+
+struct set_entry {
+	int64_t location;
+	int64_t fde; // SET_TOMBSTONE if removed
+};
+
+struct set_run {
+	struct set_entry *entries;
+	size_t len;
+};
+
+// Log-structured set: sorted runs from oldest to newest, each run at least
+// twice as large as the next one. Newer runs shadow older ones.
+struct dwarfw_eh_frame_hdr_set {
+	struct set_run runs[SET_RUNS_CAP];
+	size_t runs_len;
+};
+
+struct dwarfw_eh_frame_hdr_set *dwarfw_eh_frame_hdr_set_create(void) {
+	return calloc(1, sizeof(struct dwarfw_eh_frame_hdr_set));
+}
+
+void dwarfw_eh_frame_hdr_set_destroy(struct dwarfw_eh_frame_hdr_set *set) {
+	if (set == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < set->runs_len; ++i) {
+		free(set->runs[i].entries);
+	}
+	free(set);
+}
+
+// Merges the two newest runs, the newer one wins on equal locations
+static bool set_merge_last(struct dwarfw_eh_frame_hdr_set *set) {
+	struct set_run *older = &set->runs[set->runs_len - 2];
+	struct set_run *newer = &set->runs[set->runs_len - 1];
+	bool oldest = set->runs_len == 2;
+
+	struct set_entry *entries =
+		malloc((older->len + newer->len) * sizeof(struct set_entry));
+	if (entries == NULL) {
+		return false;
+	}
+
+	size_t i = 0, j = 0, len = 0;
+	while (i < older->len || j < newer->len) {
+		struct set_entry entry;
+		if (j == newer->len || (i < older->len &&
+				older->entries[i].location < newer->entries[j].location)) {
+			entry = older->entries[i++];
+		} else {
+			if (i < older->len &&
+					older->entries[i].location == newer->entries[j].location) {
+				++i; // Shadowed
+			}
+			entry = newer->entries[j++];
+		}
+
+		// Nothing older to shadow anymore
+		if (oldest && entry.fde == SET_TOMBSTONE) {
+			continue;
+		}
+		entries[len++] = entry;
+	}
+
+	free(older->entries);
+	free(newer->entries);
+	older->entries = entries;
+	older->len = len;
+	--set->runs_len;
+	return true;
+}
+
+static bool set_insert(struct dwarfw_eh_frame_hdr_set *set,
+		int64_t location, int64_t fde) {
+	if (set->runs_len == SET_RUNS_CAP) {
+		return false; // Can't happen with the size invariant
+	}
+
+	struct set_entry *entries = malloc(sizeof(struct set_entry));
+	if (entries == NULL) {
+		return false;
+	}
+	entries[0] = (struct set_entry){ .location = location, .fde = fde };
+	set->runs[set->runs_len++] = (struct set_run){
+		.entries = entries,
+		.len = 1,
+	};
+
+	// Amortized O(log n): an entry is merged at most once per size doubling
+	while (set->runs_len >= 2 && set->runs[set->runs_len - 2].len <
+			2 * set->runs[set->runs_len - 1].len) {
+		if (!set_merge_last(set)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool dwarfw_eh_frame_hdr_set_add(struct dwarfw_eh_frame_hdr_set *set,
+		int64_t initial_location, size_t fde_offset) {
+	return set_insert(set, initial_location, fde_offset);
+}
+
+bool dwarfw_eh_frame_hdr_set_remove(struct dwarfw_eh_frame_hdr_set *set,
+		int64_t initial_location) {
+	return set_insert(set, initial_location, SET_TOMBSTONE);
+}
+
+size_t dwarfw_eh_frame_hdr_set_write(struct dwarfw_eh_frame_hdr_set *set,
+		long long int eh_frame, FILE *f) {
+	size_t n, written = 0;
+
+	// Compact into a single run, which also drops all tombstones
+	while (set->runs_len >= 2) {
+		if (!set_merge_last(set)) {
+			return 0;
+		}
+	}
+	struct set_run *run = set->runs_len > 0 ? &set->runs[0] : NULL;
+	size_t len = run != NULL ? run->len : 0;
+	if (run != NULL && run->len > 0 && run->entries[0].fde == SET_TOMBSTONE) {
+		// Removal of the only entry, never merged
+		len = 0;
+	}
+
+	if (!(n = hdr_header_write(eh_frame, len, f))) {
+		return 0;
+	}
+	written += n;
+
+	// Locations and FDE offsets are relative to .eh_frame
+	struct dwarfw_eh_frame_hdr_entry chunk[SET_WRITE_CHUNK];
+	for (size_t i = 0; i < len; i += SET_WRITE_CHUNK) {
+		size_t chunk_len = len - i < SET_WRITE_CHUNK ? len - i : SET_WRITE_CHUNK;
+		for (size_t j = 0; j < chunk_len; ++j) {
+			const struct set_entry *entry = &run->entries[i + j];
+			int64_t location = entry->location + eh_frame;
+			int64_t fde = entry->fde + eh_frame;
+			if (location < INT32_MIN || location > INT32_MAX ||
+					fde < INT32_MIN || fde > INT32_MAX) {
+				return 0;
+			}
+			chunk[j].initial_location = location;
+			chunk[j].fde = fde;
+		}
+		if (!(n = fwrite(chunk, sizeof(*chunk), chunk_len, f))) {
+			return 0;
+		}
+		written += n * sizeof(*chunk);
+	}
+
+	return written;
+}
@@ -0,0 +1,83 @@
+#include <dwarfw.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EH_FRAME_INDEX_VERSION 1
+
+// The index is an array of entries in Eytzinger (breadth-first) order,
+// 1-indexed so that the children of k are 2k and 2k+1. Slot 0 is the header:
+// its initial_location holds the version and its fde holds the entry count.
+
+static size_t eytzinger_fill(const struct dwarfw_eh_frame_hdr_entry *sorted,
+		struct dwarfw_eh_frame_hdr_entry *out, size_t len, size_t i,
+		size_t k) {
+	if (k <= len) {
+		i = eytzinger_fill(sorted, out, len, i, 2 * k);
+		out[k] = sorted[i++];
+		i = eytzinger_fill(sorted, out, len, i, 2 * k + 1);
+	}
+	return i;
+}
+
+size_t dwarfw_eh_frame_index_write(struct dwarfw_eh_frame_hdr_entry *entries,
+		size_t entries_len, FILE *f) {
+	if (entries_len > INT32_MAX) {
+		return 0;
+	}
+
+	struct dwarfw_eh_frame_hdr_entry *index =
+		malloc((entries_len + 1) * sizeof(*index));
+	if (index == NULL) {
+		return 0;
+	}
+	index[0].initial_location = EH_FRAME_INDEX_VERSION;
+	index[0].fde = entries_len;
+
+	dwarfw_eh_frame_hdr_sort(entries, entries_len);
+	eytzinger_fill(entries, index, entries_len, 0, 1);
+
+	size_t n = fwrite(index, sizeof(*index), entries_len + 1, f);
+	free(index);
+	if (n != entries_len + 1) {
+		return 0;
+	}
+
+	return n * sizeof(*index);
+}
+
+size_t dwarfw_eh_frame_index_length(const void *index) {
+	const struct dwarfw_eh_frame_hdr_entry *header = index;
+	if (header->initial_location != EH_FRAME_INDEX_VERSION) {
+		return 0;
+	}
+	return header->fde;
+}
+
+const struct dwarfw_eh_frame_hdr_entry *dwarfw_eh_frame_index_lookup(
+		const void *index, int32_t location) {
+	const struct dwarfw_eh_frame_hdr_entry *entries = index;
+	size_t len = dwarfw_eh_frame_index_length(index);
+
+	// Go right whenever the node is <= location: the last node where we went
+	// right is the greatest entry <= location. The loop has no data-dependent
+	// branch, only the trip count varies by one between lookups.
+	size_t k = 1;
+	while (k <= len) {
+#if defined(__GNUC__)
+		// Eight entries fit in a cache line: fetch the great-grandchildren
+		__builtin_prefetch(entries + 8 * k);
+#endif
+		k = 2 * k + (entries[k].initial_location <= location);
+	}
+
+	// Drop the trailing left turns and the last right turn
+#if defined(__GNUC__)
+	k >>= __builtin_ctzll(k) + 1;
+#else
+	while ((k & 1) == 0) {
+		k >>= 1;
+	}
+	k >>= 1;
+#endif
+	return k > 0 ? &entries[k] : NULL;
+}
@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarfw.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+
+struct dwarfw_elf {
+	Elf *elf;
+	size_t shstrndx;
+	Elf_Scn *symtab;
+
+	// Section name -> Elf_Scn *
+	struct hash_table sections;
+	// Section index -> index of its STT_SECTION symbol, or -1
+	int *section_symbols;
+	size_t section_symbols_len;
+
+	// Names of the sections we created
+	char **names;
+	size_t names_len;
+};
+
+static bool index_section(struct dwarfw_elf *ctx, const char *name,
+		Elf_Scn *scn) {
+	struct hash_entry *entry =
+		hash_table_insert(&ctx->sections, name, strlen(name));
+	if (entry == NULL) {
+		return false;
+	}
+	// Like a linear walk, the first section with a given name wins
+	if (entry->value == NULL) {
+		entry->value = scn;
+	}
+	return true;
+}
+
+static bool index_symbols(struct dwarfw_elf *ctx) {
+	GElf_Shdr symtab_shdr;
+	if (!gelf_getshdr(ctx->symtab, &symtab_shdr) ||
+			symtab_shdr.sh_entsize == 0) {
+		return false;
+	}
+	Elf_Data *symtab_data = elf_getdata(ctx->symtab, NULL);
+	if (symtab_data == NULL) {
+		return false;
+	}
+
+	int symbols_nr = symtab_shdr.sh_size / symtab_shdr.sh_entsize;
+	for (int i = 0; i < symbols_nr; ++i) {
+		GElf_Sym sym;
+		if (!gelf_getsym(symtab_data, i, &sym)) {
+			return false;
+		}
+		if (GELF_ST_TYPE(sym.st_info) != STT_SECTION ||
+				sym.st_shndx >= ctx->section_symbols_len) {
+			continue;
+		}
+		if (ctx->section_symbols[sym.st_shndx] < 0) {
+			ctx->section_symbols[sym.st_shndx] = i;
+		}
+	}
+
+	return true;
+}
+
+struct dwarfw_elf *dwarfw_elf_create(Elf *elf) {
+	struct dwarfw_elf *ctx = calloc(1, sizeof(struct dwarfw_elf));
+	if (ctx == NULL) {
+		return NULL;
+	}
+	ctx->elf = elf;
+
+	size_t sections_num;
+	if (elf_getshdrnum(elf, &sections_num) ||
+			elf_getshdrstrndx(elf, &ctx->shstrndx)) {
+		goto error;
+	}
+
+	ctx->section_symbols_len = sections_num;
+	ctx->section_symbols = malloc(sections_num * sizeof(int));
+	if (ctx->section_symbols == NULL) {
+		goto error;
+	}
+
+	for (size_t i = 0; i < sections_num; ++i) {
+		ctx->section_symbols[i] = -1;
+
+		Elf_Scn *scn = elf_getscn(elf, i);
+		GElf_Shdr shdr;
+		if (scn == NULL || !gelf_getshdr(scn, &shdr)) {
+			goto error;
+		}
+
+		const char *name = elf_strptr(elf, ctx->shstrndx, shdr.sh_name);
+		if (name == NULL || !index_section(ctx, name, scn)) {
+			goto error;
+		}
+
+		if (shdr.sh_type == SHT_SYMTAB && ctx->symtab == NULL) {
+			ctx->symtab = scn;
+		}
+	}
+
+	if (ctx->symtab != NULL && !index_symbols(ctx)) {
+		goto error;
+	}
+
+	return ctx;
+
+error:
+	dwarfw_elf_destroy(ctx);
+	return NULL;
+}
+
+void dwarfw_elf_destroy(struct dwarfw_elf *ctx) {
+	if (ctx == NULL) {
+		return;
+	}
+	hash_table_finish(&ctx->sections);
+	free(ctx->section_symbols);
+	for (size_t i = 0; i < ctx->names_len; ++i) {
+		free(ctx->names[i]);
+	}
+	free(ctx->names);
+	free(ctx);
+}
+
+Elf_Scn *dwarfw_elf_find_section(struct dwarfw_elf *ctx, const char *name) {
+	struct hash_entry *entry =
+		hash_table_find(&ctx->sections, name, strlen(name));
+	return entry != NULL ? entry->value : NULL;
+}
+
+int dwarfw_elf_find_section_symbol(struct dwarfw_elf *ctx, size_t index,
+		GElf_Sym *sym) {
+	if (ctx->symtab == NULL || index >= ctx->section_symbols_len) {
+		return -1;
+	}
+
+	int i = ctx->section_symbols[index];
+	if (i < 0) {
+		return -1;
+	}
+
+	Elf_Data *symtab_data = elf_getdata(ctx->symtab, NULL);
+	if (symtab_data == NULL || !gelf_getsym(symtab_data, i, sym)) {
+		return -1;
+	}
+	return i;
+}
+
+Elf_Scn *dwarfw_elf_create_section(struct dwarfw_elf *ctx,
+		const char *name) {
+	Elf_Scn *shstrtab = elf_getscn(ctx->elf, ctx->shstrndx);
+	if (shstrtab == NULL) {
+		return NULL;
+	}
+
+	char **names = realloc(ctx->names, (ctx->names_len + 1) * sizeof(char *));
+	if (names == NULL) {
+		return NULL;
+	}
+	ctx->names = names;
+
+	Elf_Scn *scn = elf_newscn(ctx->elf);
+	if (scn == NULL) {
+		return NULL;
+	}
+
+	GElf_Shdr shdr;
+	if (!gelf_getshdr(scn, &shdr)) {
+		return NULL;
+	}
+
+	// Add section name to .shstrtab
+	GElf_Shdr shstrtab_shdr;
+	if (!gelf_getshdr(shstrtab, &shstrtab_shdr)) {
+		return NULL;
+	}
+
+	Elf_Data *shstrtab_data = elf_newdata(shstrtab);
+	if (shstrtab_data == NULL) {
+		return NULL;
+	}
+	char *name_copy = strdup(name);
+	if (name_copy == NULL) {
+		return NULL;
+	}
+	ctx->names[ctx->names_len++] = name_copy;
+	shstrtab_data->d_buf = name_copy;
+	shstrtab_data->d_size = strlen(name) + 1;
+	shstrtab_data->d_align = 1;
+
+	shdr.sh_name = shstrtab_shdr.sh_size;
+	shstrtab_shdr.sh_size += shstrtab_data->d_size;
+
+	if (!gelf_update_shdr(scn, &shdr)) {
+		return NULL;
+	}
+
+	if (!gelf_update_shdr(shstrtab, &shstrtab_shdr)) {
+		return NULL;
+	}
+
+	if (!index_section(ctx, name_copy, scn)) {
+		return NULL;
+	}
+
+	return scn;
+}
@@ -0,0 +1,272 @@
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pointer.h"
+
+struct cfi_state {
+	struct dwarfw_cfi_row row;
+	// Row after the CIE initial instructions, for DW_CFA_restore
+	const struct dwarfw_cfi_row *initial;
+	// FDE whose instructions are running, NULL for the CIE's
+	struct dwarfw_fde *fde;
+	size_t instructions_offset; // in the FDE record
+
+	// Stack of rows for DW_CFA_remember_state
+	struct dwarfw_cfi_row *stack;
+	size_t stack_len, stack_cap;
+
+	// Append each row to this table, if not NULL
+	struct dwarfw_cfi_table *table;
+	size_t table_cap;
+};
+
+static bool push_row(struct dwarfw_cfi_row **rows, size_t *len, size_t *cap,
+		const struct dwarfw_cfi_row *row) {
+	if (*len == *cap) {
+		size_t new_cap = *cap == 0 ? 4 : 2 * *cap;
+		struct dwarfw_cfi_row *new_rows =
+			realloc(*rows, new_cap * sizeof(*new_rows));
+		if (new_rows == NULL) {
+			return false;
+		}
+		*rows = new_rows;
+		*cap = new_cap;
+	}
+	(*rows)[*len] = *row;
+	++*len;
+	return true;
+}
+
+// Runs instructions until the end or until the location would move past
+// until. Returns false on error, or if an advance moves past until (*done is
+// set in that case).
+static bool cfi_exec(struct cfi_state *state, struct dwarfw_cie *cie,
+		const char *buf, size_t len, uint64_t until, bool *done) {
+	struct dwarfw_cfi_row *row = &state->row;
+
+	size_t read = 0;
+	while (read < len) {
+		struct dwarfw_instruction insn;
+		size_t n = dwarfw_cie_read_instruction(cie, buf + read, len - read,
+			&insn);
+		if (!n) {
+			return false;
+		}
+		read += n;
+
+		struct dwarfw_rule ignored;
+		struct dwarfw_rule *rule = &ignored;
+		if (insn.reg < DWARFW_REGISTERS_LEN) {
+			rule = &row->regs[insn.reg];
+		}
+		switch (insn.opcode) {
+		case DW_CFA_set_loc:
+		case DW_CFA_advance_loc:
+		case DW_CFA_advance_loc1:
+		case DW_CFA_advance_loc2:
+		case DW_CFA_advance_loc4:;
+			uint64_t location = row->location + insn.operand;
+			if (insn.opcode == DW_CFA_set_loc) {
+				if (state->fde == NULL) {
+					return false; // Not allowed in a CIE
+				}
+				// Addresses follow the convention of initial locations,
+				// locations are from the start of the function
+				long long int address = insn.operand;
+				if (pointer_is_relative(cie->augmentation_data.pointer_encoding)) {
+					address += state->instructions_offset + read - n;
+				}
+				long long int offset = address - state->fde->initial_location;
+				if (offset < 0 || (uint64_t)offset < row->location) {
+					return false; // Locations only move forward
+				}
+				location = offset;
+			}
+			if (location > until) {
+				*done = true;
+				return true;
+			}
+			if (state->table != NULL && location != row->location) {
+				if (!push_row(&state->table->rows, &state->table->rows_len,
+						&state->table_cap, row)) {
+					return false;
+				}
+			}
+			row->location = location;
+			break;
+		case DW_CFA_offset:
+		case DW_CFA_offset_extended:
+		case DW_CFA_offset_extended_sf:
+		case DW_CFA_GNU_negative_offset_extended:
+			*rule = (struct dwarfw_rule){
+				.type = DWARFW_RULE_OFFSET,
+				.offset = insn.operand,
+			};
+			break;
+		case DW_CFA_val_offset:
+		case DW_CFA_val_offset_sf:
+			*rule = (struct dwarfw_rule){
+				.type = DWARFW_RULE_VAL_OFFSET,
+				.offset = insn.operand,
+			};
+			break;
+		case DW_CFA_restore:
+		case DW_CFA_restore_extended:
+			if (state->initial == NULL) {
+				return false; // Not allowed in a CIE
+			}
+			if (insn.reg < DWARFW_REGISTERS_LEN) {
+				*rule = state->initial->regs[insn.reg];
+			}
+			break;
+		case DW_CFA_undefined:
+			*rule = (struct dwarfw_rule){ .type = DWARFW_RULE_UNDEFINED };
+			break;
+		case DW_CFA_same_value:
+			*rule = (struct dwarfw_rule){ .type = DWARFW_RULE_SAME_VALUE };
+			break;
+		case DW_CFA_register:
+			*rule = (struct dwarfw_rule){
+				.type = DWARFW_RULE_REGISTER,
+				.reg = insn.operand,
+			};
+			break;
+		case DW_CFA_expression:
+		case DW_CFA_val_expression:
+			*rule = (struct dwarfw_rule){
+				.type = insn.opcode == DW_CFA_expression ?
+					DWARFW_RULE_EXPRESSION : DWARFW_RULE_VAL_EXPRESSION,
+				.expr = insn.expr,
+				.expr_len = insn.expr_len,
+			};
+			break;
+		case DW_CFA_remember_state:
+			if (!push_row(&state->stack, &state->stack_len, &state->stack_cap,
+					row)) {
+				return false;
+			}
+			break;
+		case DW_CFA_restore_state:
+			if (state->stack_len == 0) {
+				return false;
+			}
+			--state->stack_len;
+			// The location isn't part of the saved state
+			uint64_t current = row->location;
+			*row = state->stack[state->stack_len];
+			row->location = current;
+			break;
+		case DW_CFA_def_cfa:
+		case DW_CFA_def_cfa_sf:
+			row->cfa = (struct dwarfw_rule){
+				.type = DWARFW_RULE_REGISTER,
+				.reg = insn.reg,
+				.offset = insn.operand,
+			};
+			break;
+		case DW_CFA_def_cfa_register:
+			if (row->cfa.type != DWARFW_RULE_REGISTER) {
+				return false;
+			}
+			row->cfa.reg = insn.reg;
+			break;
+		case DW_CFA_def_cfa_offset:
+		case DW_CFA_def_cfa_offset_sf:
+			if (row->cfa.type != DWARFW_RULE_REGISTER) {
+				return false;
+			}
+			row->cfa.offset = insn.operand;
+			break;
+		case DW_CFA_def_cfa_expression:
+			row->cfa = (struct dwarfw_rule){
+				.type = DWARFW_RULE_EXPRESSION,
+				.expr = insn.expr,
+				.expr_len = insn.expr_len,
+			};
+			break;
+		case DW_CFA_nop:
+		case DW_CFA_GNU_args_size:
+			break;
+		}
+	}
+
+	return true;
+}
+
+static bool cfi_run(struct cfi_state *state, struct dwarfw_fde *fde,
+		uint64_t until) {
+	struct dwarfw_cie *cie = fde->cie;
+	bool done = false;
+
+	// Location advances aren't allowed in CIEs
+	bool ok = cfi_exec(state, cie, cie->instructions, cie->instructions_length,
+		until, &done) && !done;
+	if (ok) {
+		struct dwarfw_cfi_row initial = state->row;
+		state->initial = &initial;
+		state->fde = fde;
+		state->instructions_offset = dwarfw_fde_instructions_offset(fde);
+		ok = state->instructions_offset > 0 && cfi_exec(state, cie,
+			fde->instructions, fde->instructions_length, until, &done);
+		state->initial = NULL;
+		state->fde = NULL;
+	}
+
+	free(state->stack);
+	state->stack = NULL;
+	state->stack_len = state->stack_cap = 0;
+
+	return ok;
+}
+
+bool dwarfw_cfi_eval(struct dwarfw_fde *fde, uint64_t location,
+		struct dwarfw_cfi_row *row) {
+	struct cfi_state state = {0};
+	if (!cfi_run(&state, fde, location)) {
+		return false;
+	}
+	*row = state.row;
+	return true;
+}
+
+bool dwarfw_cfi_table_init(struct dwarfw_cfi_table *table,
+		struct dwarfw_fde *fde) {
+	memset(table, 0, sizeof(*table));
+
+	struct cfi_state state = { .table = table };
+	if (!cfi_run(&state, fde, UINT64_MAX)) {
+		dwarfw_cfi_table_finish(table);
+		return false;
+	}
+
+	// The last row covers the rest of the function
+	if (!push_row(&table->rows, &table->rows_len, &state.table_cap,
+			&state.row)) {
+		dwarfw_cfi_table_finish(table);
+		return false;
+	}
+
+	return true;
+}
+
+void dwarfw_cfi_table_finish(struct dwarfw_cfi_table *table) {
+	free(table->rows);
+	memset(table, 0, sizeof(*table));
+}
+
+const struct dwarfw_cfi_row *dwarfw_cfi_table_lookup(
+		const struct dwarfw_cfi_table *table, uint64_t location) {
+	// Find the last row whose location is <= location
+	size_t lo = 0, hi = table->rows_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (table->rows[mid].location <= location) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo > 0 ? &table->rows[lo - 1] : NULL;
+}
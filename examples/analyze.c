@@ -0,0 +1,108 @@
+#include <dwarfw.h>
+#include <stdio.h>
+
+struct expected_row {
+	uint32_t offset;
+	uint64_t cfa_register;
+	long long int cfa_offset;
+	long long int fp_offset;
+};
+
+struct function {
+	const char *name;
+	const char *code;
+	size_t code_len;
+	// Rows at these offsets, in effect until the next one
+	const struct expected_row *rows;
+	size_t rows_len;
+};
+
+// push %rbp; mov %rsp,%rbp; push %rbx; sub $0x18,%rsp; test %eax,%eax;
+// je 1f; add $0x18,%rsp; pop %rbx; pop %rbp; ret; 1: xor %eax,%eax; leave;
+// ret
+static const char frame_pointer_code[] =
+	"\x55\x48\x89\xe5\x53\x48\x83\xec\x18\x85\xc0\x74\x07\x48\x83\xc4\x18"
+	"\x5b\x5d\xc3\x31\xc0\xc9\xc3";
+static const struct expected_row frame_pointer_rows[] = {
+	{ 0, 7, 8, 0 },
+	{ 1, 7, 16, -16 },
+	{ 4, 6, 16, -16 },
+	{ 19, 7, 8, 0 },
+	{ 20, 6, 16, -16 },
+	{ 23, 7, 8, 0 },
+};
+
+// push %rbp; push %rbx; sub $8,%rsp; push $1; call f; add $8,%rsp; call f;
+// add $8,%rsp; pop %rbx; pop %rbp; ret; xor %eax,%eax; ret
+// The stack shrinks after the first call without starting the epilogue: the
+// code after the return must get the rows from before the second add.
+static const char pushed_argument_code[] =
+	"\x55\x53\x48\x83\xec\x08\x6a\x01\xe8\x00\x00\x00\x00\x48\x83\xc4\x08"
+	"\xe8\x00\x00\x00\x00\x48\x83\xc4\x08\x5b\x5d\xc3\x31\xc0\xc3";
+static const struct expected_row pushed_argument_rows[] = {
+	{ 0, 7, 8, 0 },
+	{ 1, 7, 16, -16 },
+	{ 2, 7, 24, -16 },
+	{ 6, 7, 32, -16 },
+	{ 8, 7, 40, -16 },
+	{ 17, 7, 32, -16 },
+	{ 26, 7, 24, -16 },
+	{ 27, 7, 16, -16 },
+	{ 28, 7, 8, 0 },
+	{ 29, 7, 32, -16 },
+};
+
+#define FUNCTION(name) { \
+		#name, name##_code, sizeof(name##_code) - 1, \
+		name##_rows, sizeof(name##_rows) / sizeof(name##_rows[0]), \
+	}
+
+static const struct function functions[] = {
+	FUNCTION(frame_pointer),
+	FUNCTION(pushed_argument),
+};
+
+static bool check(const struct function *func) {
+	struct dwarfw_unwind_row rows[64];
+	size_t rows_len = dwarfw_unwind_rows_analyze(func->code, func->code_len,
+		rows, sizeof(rows) / sizeof(rows[0]));
+	if (rows_len == 0) {
+		fprintf(stderr, "%s: failed to analyze\n", func->name);
+		return false;
+	}
+
+	// Compare the rows at every offset of the function
+	bool ok = true;
+	size_t i = 0, j = 0;
+	for (uint32_t offset = 0; offset < func->code_len; ++offset) {
+		while (i + 1 < rows_len && rows[i + 1].offset <= offset) {
+			++i;
+		}
+		while (j + 1 < func->rows_len && func->rows[j + 1].offset <= offset) {
+			++j;
+		}
+
+		const struct dwarfw_unwind_row *row = &rows[i];
+		const struct expected_row *expected = &func->rows[j];
+		if (row->cfa_register != expected->cfa_register ||
+				row->cfa_offset != expected->cfa_offset ||
+				row->fp_offset != expected->fp_offset) {
+			fprintf(stderr, "%s: row mismatch at %u\n", func->name, offset);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int ret = 0;
+	for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i) {
+		if (!check(&functions[i])) {
+			ret = 1;
+		}
+	}
+	if (ret == 0) {
+		printf("rows match\n");
+	}
+	return ret;
+}
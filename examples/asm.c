@@ -0,0 +1,140 @@
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <stdio.h>
+#include <string.h>
+
+// objdump -d output of this function built with gcc -O2
+// -fno-omit-frame-pointer, with the CFI directives of gcc -S placed after the
+// instructions they follow in the assembly:
+//   int f(int n) {
+//   	int buf[16];
+//   	if (n < 0)
+//   		return -1;
+//   	int r = g(buf, n);
+//   	return r + g(buf, r);
+//   }
+static const char text[] =
+	"0000000000000000 <f>:\n"
+	"	.cfi_startproc\n"
+	"   0:	85 ff                	test   %edi,%edi\n"
+	"   2:	78 34                	js     38 <f+0x38>\n"
+	"   4:	55                   	push   %rbp\n"
+	"	.cfi_def_cfa_offset 16\n"
+	"	.cfi_offset 6, -16\n"
+	"   5:	89 fe                	mov    %edi,%esi\n"
+	"   7:	48 89 e5             	mov    %rsp,%rbp\n"
+	"	.cfi_def_cfa_register 6\n"
+	"   a:	41 54                	push   %r12\n"
+	"   c:	53                   	push   %rbx\n"
+	"	.cfi_offset 12, -24\n"
+	"	.cfi_offset 3, -32\n"
+	"   d:	4c 8d 65 b0          	lea    -0x50(%rbp),%r12\n"
+	"  11:	4c 89 e7             	mov    %r12,%rdi\n"
+	"  14:	48 83 ec 40          	sub    $0x40,%rsp\n"
+	"  18:	e8 00 00 00 00       	call   1d <f+0x1d>\n"
+	"  1d:	4c 89 e7             	mov    %r12,%rdi\n"
+	"  20:	89 c6                	mov    %eax,%esi\n"
+	"  22:	89 c3                	mov    %eax,%ebx\n"
+	"  24:	e8 00 00 00 00       	call   29 <f+0x29>\n"
+	"  29:	48 83 c4 40          	add    $0x40,%rsp\n"
+	"  2d:	01 d8                	add    %ebx,%eax\n"
+	"  2f:	5b                   	pop    %rbx\n"
+	"  30:	41 5c                	pop    %r12\n"
+	"  32:	5d                   	pop    %rbp\n"
+	"	.cfi_def_cfa 7, 8\n"
+	"  33:	c3                   	ret\n"
+	"  34:	0f 1f 40 00          	nopl   0x0(%rax)\n"
+	"	.cfi_restore 3\n"
+	"	.cfi_restore 6\n"
+	"	.cfi_restore 12\n"
+	"  38:	b8 ff ff ff ff       	mov    $0xffffffff,%eax\n"
+	"  3d:	c3                   	ret\n"
+	"	.cfi_endproc\n";
+
+// Rows of the FDE gcc emitted, from readelf --debug-dump=frames-interp.
+// Register offsets are from the CFA, 0 if the register isn't saved.
+static const struct {
+	uint64_t location;
+	uint64_t cfa_register;
+	long long int cfa_offset;
+	long long int rbx, rbp, r12;
+} expected[] = {
+	{ 0x00, 7, 8, 0, 0, 0 },
+	{ 0x05, 7, 16, 0, -16, 0 },
+	{ 0x0a, 6, 16, 0, -16, 0 },
+	{ 0x0d, 6, 16, -32, -16, -24 },
+	{ 0x33, 7, 8, -32, -16, -24 },
+	{ 0x38, 7, 8, 0, 0, 0 },
+};
+
+#define RANGE 0x3e
+
+static long long int saved_offset(const struct dwarfw_cfi_row *row, int reg) {
+	if (row->regs[reg].type != DWARFW_RULE_OFFSET) {
+		return 0;
+	}
+	return row->regs[reg].offset;
+}
+
+int main(int argc, char **argv) {
+	struct dwarfw_cie cie = {
+		.version = 1,
+		.augmentation = "zR",
+		.code_alignment = 1,
+		.data_alignment = -8,
+		.return_address_register = 16,
+		.augmentation_data = {
+			.pointer_encoding = DW_EH_PE_sdata4 | DW_EH_PE_pcrel,
+		},
+		// DW_CFA_def_cfa rsp+8, DW_CFA_offset rip at cfa-8
+		.instructions_length = 5,
+		.instructions = "\x0c\x07\x08\x90\x01",
+	};
+
+	struct dwarfw_asm out;
+	if (!dwarfw_asm_init(&out, &cie, text, strlen(text))) {
+		fprintf(stderr, "failed to assemble line %zu\n", out.error_line);
+		return 1;
+	}
+
+	int ret = 0;
+	struct dwarfw_fde *fde = &out.fdes[0];
+	if (out.fdes_len != 1 || fde->address_range != RANGE) {
+		fprintf(stderr, "unexpected FDE range\n");
+		ret = 1;
+		goto out;
+	}
+
+	// Compare the rows at every address of the function
+	size_t j = 0;
+	for (uint64_t location = 0; location < RANGE; ++location) {
+		while (j + 1 < sizeof(expected) / sizeof(expected[0]) &&
+				expected[j + 1].location <= location) {
+			++j;
+		}
+
+		struct dwarfw_cfi_row row;
+		if (!dwarfw_cfi_eval(fde, location, &row)) {
+			fprintf(stderr, "failed to evaluate CFI\n");
+			ret = 1;
+			goto out;
+		}
+
+		if (row.cfa.reg != expected[j].cfa_register ||
+				row.cfa.offset != expected[j].cfa_offset ||
+				saved_offset(&row, 3) != expected[j].rbx ||
+				saved_offset(&row, 6) != expected[j].rbp ||
+				saved_offset(&row, 12) != expected[j].r12) {
+			fprintf(stderr, "row mismatch at 0x%lx\n", (unsigned long)location);
+			ret = 1;
+		}
+	}
+
+	if (ret == 0) {
+		printf("rows match gcc's CFI\n");
+	}
+
+out:
+	dwarfw_asm_finish(&out);
+	return ret;
+}
@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <dwarfw-inline.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+DWARFW_INLINE_ENCODER(x86_64, DW_EH_PE_sdata4 | DW_EH_PE_pcrel, 1, -8)
+
+static struct dwarfw_cie cie = {
+	.version = 1,
+	.augmentation = "zR",
+	.code_alignment = 1,
+	.data_alignment = -8,
+	.return_address_register = 16,
+	.augmentation_data = {
+		.pointer_encoding = DW_EH_PE_sdata4 | DW_EH_PE_pcrel,
+	},
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Frame pointer prologue and epilogue of a function of the given size
+static size_t encode_generic(uint32_t size, char *out, size_t out_len,
+		FILE *insns_f, char *insns) {
+	rewind(insns_f);
+	size_t insns_len = 0;
+	insns_len += dwarfw_cie_write_advance_loc(&cie, 1, insns_f);
+	insns_len += dwarfw_cie_write_def_cfa_offset(&cie, 16, insns_f);
+	insns_len += dwarfw_cie_write_offset(&cie, 6, -16, insns_f);
+	insns_len += dwarfw_cie_write_advance_loc(&cie, 3, insns_f);
+	insns_len += dwarfw_cie_write_def_cfa_register(&cie, 6, insns_f);
+	insns_len += dwarfw_cie_write_advance_loc(&cie, size - 5, insns_f);
+	insns_len += dwarfw_cie_write_def_cfa(&cie, 7, 8, insns_f);
+
+	struct dwarfw_fde fde = {
+		.cie = &cie,
+		.cie_pointer = 32,
+		.initial_location = -0x1000,
+		.address_range = size,
+		.instructions_length = insns_len,
+		.instructions = insns,
+	};
+	FILE *f = fmemopen(out, out_len, "w");
+	if (f == NULL) {
+		return 0;
+	}
+	setvbuf(f, NULL, _IONBF, 0);
+	size_t n = dwarfw_fde_write(&fde, NULL, f);
+	fclose(f);
+	return n;
+}
+
+static size_t encode_inline(uint32_t size, char *out) {
+	char insns[7 * DWARFW_INLINE_INSTRUCTION_MAX];
+	size_t insns_len = 0;
+	insns_len += x86_64_advance_loc(insns + insns_len, 1);
+	insns_len += x86_64_def_cfa_offset(insns + insns_len, 16);
+	insns_len += x86_64_offset(insns + insns_len, 6, -16);
+	insns_len += x86_64_advance_loc(insns + insns_len, 3);
+	insns_len += dwarfw_inline_def_cfa_register(insns + insns_len, 6);
+	insns_len += x86_64_advance_loc(insns + insns_len, size - 5);
+	insns_len += x86_64_def_cfa(insns + insns_len, 7, 8);
+
+	return x86_64_fde(out, 32, -0x1000, size, insns, insns_len);
+}
+
+int main(int argc, char **argv) {
+	size_t fdes_len = 1000000;
+	if (argc > 1) {
+		fdes_len = strtoul(argv[1], NULL, 10);
+	}
+
+	uint32_t *sizes = malloc(fdes_len * sizeof(*sizes));
+	char insns[7 * DWARFW_INLINE_INSTRUCTION_MAX];
+	char generic[DWARFW_INLINE_FDE_MAX(sizeof(insns))];
+	char inlined[DWARFW_INLINE_FDE_MAX(sizeof(insns))];
+	FILE *insns_f = fmemopen(insns, sizeof(insns), "w");
+	if (sizes == NULL || insns_f == NULL) {
+		return 1;
+	}
+	setvbuf(insns_f, NULL, _IONBF, 0);
+	for (size_t i = 0; i < fdes_len; ++i) {
+		sizes[i] = 16 + rand() % 512;
+	}
+
+	for (size_t i = 0; i < fdes_len; i += fdes_len / 1000 + 1) {
+		size_t generic_len = encode_generic(sizes[i], generic,
+			sizeof(generic), insns_f, insns);
+		size_t inlined_len = encode_inline(sizes[i], inlined);
+		if (generic_len == 0 || generic_len != inlined_len ||
+				memcmp(generic, inlined, generic_len) != 0) {
+			fprintf(stderr, "Encoding mismatch for size %u\n", sizes[i]);
+			return 1;
+		}
+	}
+
+	size_t total = 0;
+	double start = now();
+	for (size_t i = 0; i < fdes_len; ++i) {
+		total += encode_generic(sizes[i], generic, sizeof(generic), insns_f,
+			insns);
+	}
+	double generic_time = now() - start;
+
+	start = now();
+	for (size_t i = 0; i < fdes_len; ++i) {
+		total -= encode_inline(sizes[i], inlined);
+	}
+	double inline_time = now() - start;
+
+	printf("%zu FDEs\n", fdes_len);
+	printf("generic writers: %.1f ns/FDE\n", generic_time * 1e9 / fdes_len);
+	printf("inline encoders: %.1f ns/FDE\n", inline_time * 1e9 / fdes_len);
+
+	fclose(insns_f);
+	free(sizes);
+	return total != 0;
+}
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarfw.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS 10000000
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *write_table(struct dwarfw_eh_frame_hdr_entry *entries,
+		size_t entries_len, bool index, size_t *len) {
+	char *buf;
+	FILE *f = open_memstream(&buf, len);
+	if (f == NULL) {
+		return NULL;
+	}
+
+	size_t n;
+	if (index) {
+		n = dwarfw_eh_frame_index_write(entries, entries_len, f);
+	} else {
+		n = dwarfw_eh_frame_hdr_write(0, entries, entries_len, f);
+	}
+	fclose(f);
+	if (n == 0) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+int main(int argc, char **argv) {
+	size_t fdes_len = 1000000;
+	if (argc > 1) {
+		fdes_len = strtoul(argv[1], NULL, 10);
+	}
+
+	// Functions of 16 to 528 bytes laid out back to back
+	struct dwarfw_eh_frame_hdr_entry *entries =
+		malloc(fdes_len * sizeof(*entries));
+	int32_t *queries = malloc(LOOKUPS * sizeof(*queries));
+	if (entries == NULL || queries == NULL) {
+		return 1;
+	}
+	int32_t location = 0;
+	for (size_t i = 0; i < fdes_len; ++i) {
+		entries[i].initial_location = location;
+		entries[i].fde = i * 32;
+		location += 16 + rand() % 512;
+	}
+	for (size_t i = 0; i < LOOKUPS; ++i) {
+		queries[i] = rand() % location;
+	}
+
+	size_t hdr_len, index_len;
+	char *hdr = write_table(entries, fdes_len, false, &hdr_len);
+	char *index = write_table(entries, fdes_len, true, &index_len);
+	if (hdr == NULL || index == NULL) {
+		return 1;
+	}
+
+	for (size_t i = 0; i < LOOKUPS; i += LOOKUPS / 1000) {
+		if (dwarfw_eh_frame_hdr_lookup(hdr, queries[i])->fde !=
+				dwarfw_eh_frame_index_lookup(index, queries[i])->fde) {
+			fprintf(stderr, "Lookup mismatch for %d\n", queries[i]);
+			return 1;
+		}
+	}
+
+	int64_t checksum = 0;
+	double start = now();
+	for (size_t i = 0; i < LOOKUPS; ++i) {
+		checksum += dwarfw_eh_frame_hdr_lookup(hdr, queries[i])->fde;
+	}
+	double hdr_time = now() - start;
+
+	start = now();
+	for (size_t i = 0; i < LOOKUPS; ++i) {
+		checksum -= dwarfw_eh_frame_index_lookup(index, queries[i])->fde;
+	}
+	double index_time = now() - start;
+
+	printf("%zu FDEs, %d lookups\n", fdes_len, LOOKUPS);
+	printf(".eh_frame_hdr binary search: %.1f ns/lookup\n",
+		hdr_time * 1e9 / LOOKUPS);
+	printf("Eytzinger index:             %.1f ns/lookup\n",
+		index_time * 1e9 / LOOKUPS);
+
+	free(hdr);
+	free(index);
+	free(entries);
+	free(queries);
+	return checksum != 0;
+}
@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// .eh_frame is at SECTION, the function at FUNCTION
+#define SECTION 0x1000
+#define FUNCTION 0x4000
+#define RANGE 0x28
+
+// push %rbp; mov %rsp,%rbp; ...; pop %rbp at 0x1f, its rows placed with
+// DW_CFA_set_loc instead of advances
+static const struct {
+	uint64_t location;
+	uint64_t cfa_register;
+	long long int cfa_offset;
+	long long int rbp; // from the CFA, 0 if rbp isn't saved
+} expected[] = {
+	{ 0x00, 7, 8, 0 },
+	{ 0x01, 7, 16, -16 },
+	{ 0x04, 6, 16, -16 },
+	{ 0x20, 7, 8, 0 },
+};
+
+#define EXPECTED_LEN (sizeof(expected) / sizeof(expected[0]))
+
+static long long int saved_offset(const struct dwarfw_cfi_row *row, int reg) {
+	if (row->regs[reg].type != DWARFW_RULE_OFFSET) {
+		return 0;
+	}
+	return row->regs[reg].offset;
+}
+
+static bool row_matches(const struct dwarfw_cfi_row *row, size_t i) {
+	return row->cfa.reg == expected[i].cfa_register &&
+		row->cfa.offset == expected[i].cfa_offset &&
+		saved_offset(row, 6) == expected[i].rbp;
+}
+
+// Writes the instructions of the rows after the first one. offset is the
+// position of the instructions in the FDE, fde_address the address of the
+// FDE.
+static bool write_instructions(struct dwarfw_cie *cie, size_t offset,
+		uint64_t fde_address, FILE *f) {
+	size_t n, written = 0;
+
+	for (size_t i = 1; i < EXPECTED_LEN; ++i) {
+		// Addresses follow the convention of initial locations
+		long long int addr = FUNCTION + expected[i].location;
+		if (cie->augmentation_data.pointer_encoding & DW_EH_PE_pcrel) {
+			addr -= fde_address;
+		}
+		// The address follows the opcode
+		if (!(n = dwarfw_cie_write_set_loc(cie, addr, offset + written + 1,
+				f))) {
+			return false;
+		}
+		written += n;
+
+		if (expected[i].cfa_register != expected[i - 1].cfa_register &&
+				expected[i].cfa_offset != expected[i - 1].cfa_offset) {
+			n = dwarfw_cie_write_def_cfa(cie, expected[i].cfa_register,
+				expected[i].cfa_offset, f);
+		} else if (expected[i].cfa_register != expected[i - 1].cfa_register) {
+			n = dwarfw_cie_write_def_cfa_register(cie,
+				expected[i].cfa_register, f);
+		} else {
+			n = dwarfw_cie_write_def_cfa_offset(cie, expected[i].cfa_offset,
+				f);
+		}
+		if (!n) {
+			return false;
+		}
+		written += n;
+
+		if (expected[i].rbp != 0) {
+			n = dwarfw_cie_write_offset(cie, 6, expected[i].rbp, f);
+		} else {
+			n = dwarfw_cie_write_restore(cie, 6, f);
+		}
+		if (!n) {
+			return false;
+		}
+		written += n;
+	}
+
+	return true;
+}
+
+// Compares the rows at every location of the function
+static bool check_rows(const char *name, struct dwarfw_fde *fde) {
+	struct dwarfw_cfi_table table;
+	if (!dwarfw_cfi_table_init(&table, fde)) {
+		fprintf(stderr, "%s: failed to evaluate CFI\n", name);
+		return false;
+	}
+
+	bool ok = true;
+	size_t j = 0;
+	for (uint64_t location = 0; location < RANGE; ++location) {
+		while (j + 1 < EXPECTED_LEN && expected[j + 1].location <= location) {
+			++j;
+		}
+
+		struct dwarfw_cfi_row row;
+		const struct dwarfw_cfi_row *table_row =
+			dwarfw_cfi_table_lookup(&table, location);
+		if (!dwarfw_cfi_eval(fde, location, &row) || !row_matches(&row, j) ||
+				table_row == NULL || !row_matches(table_row, j)) {
+			fprintf(stderr, "%s: row mismatch at 0x%lx\n", name,
+				(unsigned long)location);
+			ok = false;
+		}
+	}
+
+	dwarfw_cfi_table_finish(&table);
+	return ok;
+}
+
+static bool check(const char *name, uint8_t pointer_encoding) {
+	struct dwarfw_cie cie = {
+		.version = 1,
+		.augmentation = "zR",
+		.code_alignment = 1,
+		.data_alignment = -8,
+		.return_address_register = 16,
+		.augmentation_data = {
+			.pointer_encoding = pointer_encoding,
+		},
+		// DW_CFA_def_cfa rsp+8, DW_CFA_offset rip at cfa-8
+		.instructions_length = 5,
+		.instructions = "\x0c\x07\x08\x90\x01",
+	};
+
+	// The FDE follows the CIE
+	size_t cie_len = dwarfw_cie_size(&cie);
+	uint64_t fde_address = SECTION + cie_len;
+	struct dwarfw_fde fde = {
+		.cie = &cie,
+		.cie_pointer = cie_len,
+		.initial_location = FUNCTION,
+		.address_range = RANGE,
+	};
+	if (pointer_encoding & DW_EH_PE_pcrel) {
+		fde.initial_location -= fde_address;
+	}
+
+	char *instructions = NULL, *buf = NULL;
+	size_t instructions_len, len;
+	bool ok = false;
+
+	FILE *f = open_memstream(&instructions, &instructions_len);
+	if (f == NULL) {
+		goto out;
+	}
+	size_t offset = dwarfw_fde_instructions_offset(&fde);
+	bool written = offset > 0 &&
+		write_instructions(&cie, offset, fde_address, f);
+	fclose(f);
+	if (!written) {
+		fprintf(stderr, "%s: failed to write instructions\n", name);
+		goto out;
+	}
+	fde.instructions_length = instructions_len;
+	fde.instructions = instructions;
+
+	f = open_memstream(&buf, &len);
+	if (f == NULL) {
+		goto out;
+	}
+	written = dwarfw_cie_write(&cie, f) && dwarfw_fde_write(&fde, NULL, f);
+	fclose(f);
+	if (!written) {
+		fprintf(stderr, "%s: failed to write .eh_frame\n", name);
+		goto out;
+	}
+
+	// Rows of the FDE as written, then as read back
+	struct dwarfw_cie read_cie;
+	struct dwarfw_fde read_fde;
+	if (!dwarfw_cie_read(buf, len, &read_cie) ||
+			!dwarfw_fde_read(buf + cie_len, len - cie_len, &read_cie,
+			&read_fde)) {
+		fprintf(stderr, "%s: failed to read .eh_frame\n", name);
+		goto out;
+	}
+	ok = check_rows(name, &fde) && check_rows(name, &read_fde);
+
+out:
+	free(instructions);
+	free(buf);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	bool ok = check("pcrel", DW_EH_PE_pcrel | DW_EH_PE_sdata4);
+	ok = check("absolute", DW_EH_PE_absptr | DW_EH_PE_udata8) && ok;
+	if (!ok) {
+		return 1;
+	}
+	printf("set_loc rows match\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *encode_cie_instructions(struct dwarfw_cie *cie, size_t *len) {
+	char *buf;
+	FILE *f = open_memstream(&buf, len);
+	if (f == NULL) {
+		return NULL;
+	}
+
+	dwarfw_cie_write_def_cfa(cie, 7, 8, f);
+	dwarfw_cie_write_offset(cie, 16, -8, f);
+
+	fclose(f);
+
+	return buf;
+}
+
+static char *encode_fde_instructions(struct dwarfw_fde *fde, size_t *len) {
+	char *buf;
+	FILE *f = open_memstream(&buf, len);
+	if (f == NULL) {
+		return NULL;
+	}
+
+	dwarfw_cie_write_advance_loc(fde->cie, 1, f);
+	dwarfw_cie_write_def_cfa_offset(fde->cie, 16, f);
+	dwarfw_cie_write_offset(fde->cie, 6, -16, f);
+	dwarfw_cie_write_advance_loc(fde->cie, 3, f);
+	dwarfw_cie_write_def_cfa_register(fde->cie, 6, f);
+
+	fclose(f);
+
+	return buf;
+}
+
+// Reads the image back with libelf, as a debugger would
+static int check_image(const char *image, size_t len) {
+	Elf *elf = elf_memory((char *)image, len);
+	if (elf == NULL) {
+		fprintf(stderr, "elf_memory() failed: %s\n", elf_errmsg(-1));
+		return 1;
+	}
+
+	size_t shstrndx;
+	if (elf_getshdrstrndx(elf, &shstrndx)) {
+		fprintf(stderr, "elf_getshdrstrndx() failed: %s\n", elf_errmsg(-1));
+		return 1;
+	}
+
+	Elf_Scn *scn = NULL;
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		GElf_Shdr shdr;
+		if (!gelf_getshdr(scn, &shdr)) {
+			fprintf(stderr, "gelf_getshdr() failed\n");
+			return 1;
+		}
+
+		const char *name = elf_strptr(elf, shstrndx, shdr.sh_name);
+		printf("%-10s addr 0x%lx size %lu\n", name, shdr.sh_addr, shdr.sh_size);
+
+		if (shdr.sh_type == SHT_SYMTAB) {
+			Elf_Data *data = elf_getdata(scn, NULL);
+			GElf_Sym sym;
+			if (data == NULL || !gelf_getsym(data, 1, &sym)) {
+				fprintf(stderr, "gelf_getsym() failed\n");
+				return 1;
+			}
+			printf("symbol %s at 0x%lx\n",
+				elf_strptr(elf, shdr.sh_link, sym.st_name), sym.st_value);
+		}
+	}
+
+	elf_end(elf);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		fprintf(stderr, "ELF library initialization failed: %s\n", elf_errmsg(-1));
+		return 1;
+	}
+
+	// Pretend main is some JIT code
+	uint64_t code = (uintptr_t)main;
+
+	struct dwarfw_cie cie = {
+		.version = 1,
+		.augmentation = "zR",
+		.code_alignment = 1,
+		.data_alignment = -8,
+		.return_address_register = 16,
+		.augmentation_data = {
+			.pointer_encoding = DW_EH_PE_sdata4 | DW_EH_PE_pcrel,
+		},
+	};
+
+	size_t instr_len;
+	char *cie_instr = encode_cie_instructions(&cie, &instr_len);
+	if (cie_instr == NULL) {
+		return 1;
+	}
+	cie.instructions_length = instr_len;
+	cie.instructions = cie_instr;
+
+	struct dwarfw_fde fde = {
+		.cie = &cie,
+		.initial_location = code,
+		.address_range = 0x40,
+	};
+
+	char *fde_instr = encode_fde_instructions(&fde, &instr_len);
+	if (fde_instr == NULL) {
+		return 1;
+	}
+	fde.instructions_length = instr_len;
+	fde.instructions = fde_instr;
+
+	struct dwarfw_jit_entry *entry =
+		dwarfw_jit_entry_create("jit_function", code, 0x40, &fde, 1);
+	if (entry == NULL) {
+		fprintf(stderr, "dwarfw_jit_entry_create() failed\n");
+		return 1;
+	}
+
+	size_t len;
+	const char *image = dwarfw_jit_entry_image(entry, &len);
+	if (check_image(image, len)) {
+		return 1;
+	}
+
+	dwarfw_jit_register(entry);
+	dwarfw_jit_entry_destroy(entry);
+
+	free(cie_instr);
+	free(fde_instr);
+	return 0;
+}
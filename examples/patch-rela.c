@@ -107,129 +107,9 @@ static size_t write_eh_frame(GElf_Rela *rela, FILE *f) {
 	return written;
 }
 
-static Elf_Scn *find_section_by_name(Elf *elf, const char *section_name) {
-	size_t sections_num;
-	if (elf_getshdrnum(elf, &sections_num)) {
-		return NULL;
-	}
-
-	size_t shstrndx;
-	if (elf_getshdrstrndx(elf, &shstrndx)) {
-		return NULL;
-	}
-
-	for (size_t i = 0; i < sections_num; ++i) {
-		Elf_Scn *s = elf_getscn(elf, i);
-		if (s == NULL) {
-			return NULL;
-		}
-
-		GElf_Shdr sh;
-		if (!gelf_getshdr(s, &sh)) {
-			return NULL;
-		}
-
-		char *name = elf_strptr(elf, shstrndx, sh.sh_name);
-		if (name == NULL) {
-			return NULL;
-		}
-
-		if (strcmp(name, section_name) == 0) {
-			return s;
-		}
-	}
-
-	return NULL;
-}
-
-static Elf_Scn *create_section(Elf *elf, const char *name) {
-	Elf_Scn *scn = elf_newscn(elf);
-	if (scn == NULL) {
-		fprintf(stderr, "elf_newscn() failed: %s\n", elf_errmsg(-1));
-		return NULL;
-	}
-
-	GElf_Shdr shdr;
-	if (!gelf_getshdr(scn, &shdr)) {
-		fprintf(stderr, "gelf_getshdr() failed\n");
-		return NULL;
-	}
-
-	// Add section name to .shstrtab
-	Elf_Scn *shstrtab = find_section_by_name(elf, ".shstrtab");
-	if (shstrtab == NULL) {
-		fprintf(stderr, "can't find .shstrtab section\n");
-		return NULL;
-	}
-
-	GElf_Shdr shstrtab_shdr;
-	if (!gelf_getshdr(shstrtab, &shstrtab_shdr)) {
-		fprintf(stderr, "gelf_getshdr(shstrtab) failed\n");
-		return NULL;
-	}
-
-	Elf_Data *shstrtab_data = elf_newdata(shstrtab);
-	if (shstrtab_data == NULL) {
-		fprintf(stderr, "elf_newdata(shstrtab) failed\n");
-		return NULL;
-	}
-	shstrtab_data->d_buf = strdup(name);
-	shstrtab_data->d_size = strlen(name) + 1;
-	shstrtab_data->d_align = 1;
-
-	shdr.sh_name = shstrtab_shdr.sh_size;
-	shstrtab_shdr.sh_size += shstrtab_data->d_size;
-
-	if (!gelf_update_shdr(scn, &shdr)) {
-		fprintf(stderr, "gelf_update_shdr() failed\n");
-		return NULL;
-	}
-
-	if (!gelf_update_shdr(shstrtab, &shstrtab_shdr)) {
-		fprintf(stderr, "gelf_update_shdr(shstrtab) failed\n");
-		return NULL;
-	}
-
-	return scn;
-}
-
-static int find_section_symbol(Elf *elf, size_t index, GElf_Sym *sym) {
-	Elf_Scn *symtab = find_section_by_name(elf, ".symtab");
-	if (symtab == NULL) {
-		fprintf(stderr, "can't find .symtab section\n");
-		return -1;
-	}
-
-	Elf_Data *symtab_data = elf_getdata(symtab, NULL);
-	if (symtab_data == NULL) {
-		fprintf(stderr, "elf_getdata(symtab) failed\n");
-		return -1;
-	}
-
-	GElf_Shdr symtab_shdr;
-	if (!gelf_getshdr(symtab, &symtab_shdr)) {
-		fprintf(stderr, "gelf_getshdr(symtab) failed\n");
-		return -1;
-	}
-
-	int symbols_nr = symtab_shdr.sh_size / symtab_shdr.sh_entsize;
-	for (int i = 0; i < symbols_nr; ++i) {
-		if (!gelf_getsym(symtab_data, i, sym)) {
-			fprintf(stderr, "gelf_getsym() failed\n");
-			continue;
-		}
-
-		if (GELF_ST_TYPE(sym->st_info) == STT_SECTION && index == sym->st_shndx) {
-			return i;
-		}
-	}
-
-	return -1;
-}
-
-static Elf_Scn *create_rela_section(Elf *elf, const char *name, Elf_Scn *base,
-		GElf_Rela *rela) {
-	Elf_Scn *scn = create_section(elf, name);
+static Elf_Scn *create_rela_section(struct dwarfw_elf *ctx, const char *name,
+		Elf_Scn *base, GElf_Rela *rela) {
+	Elf_Scn *scn = dwarfw_elf_create_section(ctx, name);
 	if (scn == NULL) {
 		fprintf(stderr, "can't create rela section\n");
 		return NULL;
@@ -245,7 +125,7 @@ static Elf_Scn *create_rela_section(Elf *elf, const char *name, Elf_Scn *base,
 	data->d_size = sizeof(GElf_Rela);
 	data->d_align = 1;
 
-	Elf_Scn *symtab = find_section_by_name(elf, ".symtab");
+	Elf_Scn *symtab = dwarfw_elf_find_section(ctx, ".symtab");
 	if (symtab == NULL) {
 		fprintf(stderr, "can't find .symtab section\n");
 		return NULL;
@@ -301,7 +181,13 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	Elf_Scn *text = find_section_by_name(elf, ".text");
+	struct dwarfw_elf *ctx = dwarfw_elf_create(elf);
+	if (ctx == NULL) {
+		fprintf(stderr, "dwarfw_elf_create() failed\n");
+		return 1;
+	}
+
+	Elf_Scn *text = dwarfw_elf_find_section(ctx, ".text");
 	if (text == NULL) {
 		fprintf(stderr, "ELF object is missing a .text section\n");
 		return 1;
@@ -327,7 +213,7 @@ int main(int argc, char **argv) {
 	fclose(f);
 
 	// Create the .eh_frame section
-	Elf_Scn *scn = create_section(elf, ".eh_frame");
+	Elf_Scn *scn = dwarfw_elf_create_section(ctx, ".eh_frame");
 	if (scn == NULL) {
 		return 1;
 	}
@@ -357,7 +243,8 @@ int main(int argc, char **argv) {
 
 	// Create the .eh_frame.rela section
 	GElf_Sym text_sym;
-	int text_sym_idx = find_section_symbol(elf, elf_ndxscn(text), &text_sym);
+	int text_sym_idx =
+		dwarfw_elf_find_section_symbol(ctx, elf_ndxscn(text), &text_sym);
 	if (text_sym_idx < 0) {
 		fprintf(stderr, "can't find .text section in symbol table\n");
 		return 1;
@@ -365,7 +252,7 @@ int main(int argc, char **argv) {
 	// r_offset and r_addend have already been populated by dwarfw_fde_write
 	initial_position_rela.r_info =
 		GELF_R_INFO(text_sym_idx, ELF32_R_TYPE(initial_position_rela.r_info));
-	Elf_Scn *rela = create_rela_section(elf, ".rela.eh_frame", scn,
+	Elf_Scn *rela = create_rela_section(ctx, ".rela.eh_frame", scn,
 		&initial_position_rela);
 	if (rela == NULL) {
 		return 1;
@@ -379,6 +266,7 @@ int main(int argc, char **argv) {
 	}
 
 	free(buf);
+	dwarfw_elf_destroy(ctx);
 	elf_end(elf);
 	close(fd);
 	return 0;
@@ -106,41 +106,6 @@ static size_t write_eh_frame(long unsigned int text_offset, FILE *f) {
 	return written;
 }
 
-static Elf_Scn *find_section_by_name(Elf *e, const char *section_name) {
-	size_t sections_num;
-	if (elf_getshdrnum(e, &sections_num)) {
-		return NULL;
-	}
-
-	size_t shstrndx;
-	if (elf_getshdrstrndx(e, &shstrndx)) {
-		return NULL;
-	}
-
-	for (size_t i = 0; i < sections_num; ++i) {
-		Elf_Scn *s = elf_getscn(e, i);
-		if (s == NULL) {
-			return NULL;
-		}
-
-		GElf_Shdr sh;
-		if (!gelf_getshdr(s, &sh)) {
-			return NULL;
-		}
-
-		char *name = elf_strptr(e, shstrndx, sh.sh_name);
-		if (name == NULL) {
-			return NULL;
-		}
-
-		if (strcmp(name, section_name) == 0) {
-			return s;
-		}
-	}
-
-	return NULL;
-}
-
 int main(int argc, char **argv) {
 	if (argc != 2) {
 		fprintf(stderr, "Missing ELF file argument\n");
@@ -172,7 +137,13 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	Elf_Scn *text = find_section_by_name(e, ".text");
+	struct dwarfw_elf *ctx = dwarfw_elf_create(e);
+	if (ctx == NULL) {
+		fprintf(stderr, "dwarfw_elf_create() failed\n");
+		return 1;
+	}
+
+	Elf_Scn *text = dwarfw_elf_find_section(ctx, ".text");
 	if (text == NULL) {
 		fprintf(stderr, "ELF object is missing a .text section\n");
 		return 1;
@@ -226,7 +197,7 @@ int main(int argc, char **argv) {
 	shdr.sh_flags = SHF_ALLOC;
 
 	// Add section name to .shstrtab
-	Elf_Scn *shstrtab = find_section_by_name(e, ".shstrtab");
+	Elf_Scn *shstrtab = dwarfw_elf_find_section(ctx, ".shstrtab");
 	if (shstrtab == NULL) {
 		fprintf(stderr, "can't find .shstrtab section\n");
 		return 1;
@@ -268,6 +239,7 @@ int main(int argc, char **argv) {
 	}
 
 	free(buf);
+	dwarfw_elf_destroy(ctx);
 	elf_end(e);
 	close(fd);
 	return 0;
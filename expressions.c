@@ -1,22 +1,208 @@
 #include <dwarf.h>
 #include <dwarfw.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
 #include "leb128.h"
 #include "write.h"
 
+#define LIT_MAX 31
+#define REG_MAX 31
+
+static size_t write_op_u8(uint8_t op, uint8_t operand, FILE *f) {
+	size_t n, written = 0;
+
+	if (!(n = write_u8(op, f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = write_u8(operand, f))) {
+		return 0;
+	}
+	written += n;
+
+	return written;
+}
+
+static size_t write_op_uleb128(uint8_t op, uint64_t operand, FILE *f) {
+	size_t n, written = 0;
+
+	if (!(n = write_u8(op, f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = leb128_write_u64(operand, f, 0))) {
+		return 0;
+	}
+	written += n;
+
+	return written;
+}
+
+static size_t write_op_sleb128(uint8_t op, int64_t operand, FILE *f) {
+	size_t n, written = 0;
+
+	if (!(n = write_u8(op, f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = leb128_write_s64(operand, f, 0))) {
+		return 0;
+	}
+	written += n;
+
+	return written;
+}
+
+size_t dwarfw_op_write(uint8_t op, FILE *f) {
+	return write_u8(op, f);
+}
+
 size_t dwarfw_op_write_deref(FILE *f) {
 	return write_u8(DW_OP_deref, f);
 }
 
+size_t dwarfw_op_write_deref_size(uint8_t size, FILE *f) {
+	return write_op_u8(DW_OP_deref_size, size, f);
+}
+
+size_t dwarfw_op_write_pick(uint8_t index, FILE *f) {
+	return write_op_u8(DW_OP_pick, index, f);
+}
+
+size_t dwarfw_op_write_lit(uint64_t value, FILE *f) {
+	size_t n, written = 0;
+
+	if (value <= LIT_MAX) {
+		return write_u8(DW_OP_lit0 + value, f);
+	} else if (value <= UINT8_MAX) {
+		return write_op_u8(DW_OP_const1u, value, f);
+	}
+
+	// Fixed-size forms beat the LEB128 one for large values
+	if (value <= UINT16_MAX) {
+		if (!(n = write_u8(DW_OP_const2u, f))) {
+			return 0;
+		}
+		written += n;
+		if (!(n = write_u16(value, f))) {
+			return 0;
+		}
+		written += n;
+	} else if (value <= UINT32_MAX &&
+			leb128_length_u64(value) >= sizeof(uint32_t)) {
+		if (!(n = write_u8(DW_OP_const4u, f))) {
+			return 0;
+		}
+		written += n;
+		if (!(n = write_u32(value, f))) {
+			return 0;
+		}
+		written += n;
+	} else if (leb128_length_u64(value) >= sizeof(uint64_t)) {
+		if (!(n = write_u8(DW_OP_const8u, f))) {
+			return 0;
+		}
+		written += n;
+		if (!(n = fwrite(&value, 1, sizeof(value), f))) {
+			return 0;
+		}
+		written += n;
+	} else {
+		return write_op_uleb128(DW_OP_constu, value, f);
+	}
+
+	return written;
+}
+
+size_t dwarfw_op_write_const(long long int value, FILE *f) {
+	size_t n, written = 0;
+
+	if (value >= 0) {
+		return dwarfw_op_write_lit(value, f);
+	}
+
+	if (value >= INT8_MIN) {
+		return write_op_u8(DW_OP_const1s, (int8_t)value, f);
+	} else if (value >= INT16_MIN) {
+		if (!(n = write_u8(DW_OP_const2s, f))) {
+			return 0;
+		}
+		written += n;
+		if (!(n = write_u16((int16_t)value, f))) {
+			return 0;
+		}
+		written += n;
+	} else if (value >= INT32_MIN &&
+			leb128_length_s64(value) >= sizeof(int32_t)) {
+		if (!(n = write_u8(DW_OP_const4s, f))) {
+			return 0;
+		}
+		written += n;
+		if (!(n = write_u32((int32_t)value, f))) {
+			return 0;
+		}
+		written += n;
+	} else if (leb128_length_s64(value) >= sizeof(int64_t)) {
+		if (!(n = write_u8(DW_OP_const8s, f))) {
+			return 0;
+		}
+		written += n;
+		int64_t value_s64 = value;
+		if (!(n = fwrite(&value_s64, 1, sizeof(value_s64), f))) {
+			return 0;
+		}
+		written += n;
+	} else {
+		return write_op_sleb128(DW_OP_consts, value, f);
+	}
+
+	return written;
+}
+
+size_t dwarfw_op_write_add(long long int value, FILE *f) {
+	size_t n, written = 0;
+
+	if (value == 0) {
+		// Nothing to add, but writers can't return 0 on success
+		return write_u8(DW_OP_nop, f);
+	} else if (value > 0) {
+		return write_op_uleb128(DW_OP_plus_uconst, value, f);
+	}
+
+	// "litN minus" is shorter than "const1s plus" for small negative values
+	if (!(n = dwarfw_op_write_lit(-(unsigned long long)value, f))) {
+		return 0;
+	}
+	written += n;
+	if (!(n = write_u8(DW_OP_minus, f))) {
+		return 0;
+	}
+	written += n;
+
+	return written;
+}
+
+size_t dwarfw_op_write_reg(uint64_t reg, FILE *f) {
+	if (reg <= REG_MAX) {
+		return write_u8(DW_OP_reg0 + reg, f);
+	}
+	return write_op_uleb128(DW_OP_regx, reg, f);
+}
+
 size_t dwarfw_op_write_bregx(uint64_t reg, long long int offset, FILE *f) {
 	size_t n, written = 0;
 
-	if (reg < 32) {
+	if (reg <= REG_MAX) {
 		if (!(n = write_u8(DW_OP_breg0 + reg, f))) {
 			return 0;
 		}
 		written += n;
 	} else {
-		if (!(n = leb128_write_u64(reg, f, 0))) {
+		if (!(n = write_op_uleb128(DW_OP_bregx, reg, f))) {
 			return 0;
 		}
 		written += n;
@@ -29,3 +215,69 @@ size_t dwarfw_op_write_bregx(uint64_t reg, long long int offset, FILE *f) {
 
 	return written;
 }
+
+size_t dwarfw_op_write_branch(uint8_t op, int16_t offset, FILE *f) {
+	size_t n, written = 0;
+
+	if (op != DW_OP_skip && op != DW_OP_bra) {
+		return 0;
+	}
+
+	if (!(n = write_u8(op, f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = write_u16(offset, f))) {
+		return 0;
+	}
+	written += n;
+
+	return written;
+}
+
+
+struct dwarfw_expr_pool {
+	struct hash_table exprs;
+};
+
+struct dwarfw_expr_pool *dwarfw_expr_pool_create(void) {
+	return calloc(1, sizeof(struct dwarfw_expr_pool));
+}
+
+void dwarfw_expr_pool_destroy(struct dwarfw_expr_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < pool->exprs.cap; ++i) {
+		free((void *)pool->exprs.entries[i].key);
+	}
+	hash_table_finish(&pool->exprs);
+	free(pool);
+}
+
+const char *dwarfw_expr_pool_intern(struct dwarfw_expr_pool *pool,
+		const char *expr, size_t expr_len) {
+	struct hash_entry *entry = hash_table_find(&pool->exprs, expr, expr_len);
+	if (entry != NULL) {
+		return entry->key;
+	}
+
+	// Keep at least one byte so that empty expressions have a key too
+	char *copy = malloc(expr_len > 0 ? expr_len : 1);
+	if (copy == NULL) {
+		return NULL;
+	}
+	memcpy(copy, expr, expr_len);
+
+	entry = hash_table_insert(&pool->exprs, copy, expr_len);
+	if (entry == NULL) {
+		free(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+size_t dwarfw_expr_pool_length(struct dwarfw_expr_pool *pool) {
+	return pool->exprs.len;
+}
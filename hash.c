@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325
+#define FNV_PRIME 0x100000001b3
+
+uint64_t hash_bytes(const void *data, size_t len) {
+	// FNV-1a
+	const uint8_t *bytes = data;
+	uint64_t hash = FNV_OFFSET_BASIS;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+void hash_table_finish(struct hash_table *table) {
+	free(table->entries);
+	memset(table, 0, sizeof(*table));
+}
+
+// Returns the slot holding key, or the empty slot where it would go
+static struct hash_entry *find_slot(const struct hash_table *table,
+		uint64_t hash, const void *key, size_t key_len) {
+	size_t mask = table->cap - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct hash_entry *entry = &table->entries[i];
+		if (entry->key == NULL) {
+			return entry;
+		}
+		if (entry->hash == hash && entry->key_len == key_len &&
+				memcmp(entry->key, key, key_len) == 0) {
+			return entry;
+		}
+	}
+}
+
+struct hash_entry *hash_table_find(const struct hash_table *table,
+		const void *key, size_t key_len) {
+	if (table->len == 0) {
+		return NULL;
+	}
+	struct hash_entry *entry =
+		find_slot(table, hash_bytes(key, key_len), key, key_len);
+	return entry->key != NULL ? entry : NULL;
+}
+
+static bool grow(struct hash_table *table, size_t cap) {
+	struct hash_table grown = {
+		.entries = calloc(cap, sizeof(struct hash_entry)),
+		.len = table->len,
+		.cap = cap,
+	};
+	if (grown.entries == NULL) {
+		return false;
+	}
+
+	for (size_t i = 0; i < table->cap; ++i) {
+		struct hash_entry *entry = &table->entries[i];
+		if (entry->key != NULL) {
+			*find_slot(&grown, entry->hash, entry->key, entry->key_len) = *entry;
+		}
+	}
+
+	free(table->entries);
+	*table = grown;
+	return true;
+}
+
+struct hash_entry *hash_table_insert(struct hash_table *table,
+		const void *key, size_t key_len) {
+	// Keep the load factor under 3/4
+	if (4 * (table->len + 1) > 3 * table->cap &&
+			!grow(table, table->cap == 0 ? 16 : 2 * table->cap)) {
+		return NULL;
+	}
+
+	uint64_t hash = hash_bytes(key, key_len);
+	struct hash_entry *entry = find_slot(table, hash, key, key_len);
+	if (entry->key == NULL) {
+		*entry = (struct hash_entry){
+			.hash = hash,
+			.key = key,
+			.key_len = key_len,
+		};
+		++table->len;
+	}
+	return entry;
+}
+
+bool hash_table_reserve(struct hash_table *table, size_t len) {
+	size_t cap = table->cap == 0 ? 16 : table->cap;
+	while (4 * len > 3 * cap) {
+		cap *= 2;
+	}
+	return cap == table->cap || grow(table, cap);
+}
@@ -0,0 +1,298 @@
+#ifndef DWARFW_INLINE_H
+#define DWARFW_INLINE_H
+
+#include <assert.h>
+#include <dwarf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Header-only encoders writing to memory, producing the same bytes as the
+// FILE-based writers. The CIE parameters (pointer encoding, code and data
+// alignment) are regular arguments: when they are compile-time constants, the
+// encoding switches, alignment checks and divisions are folded away.
+// DWARFW_INLINE_ENCODER defines encoders bound to constant parameters.
+//
+// Buffers aren't bounds-checked: an instruction takes at most
+// DWARFW_INLINE_INSTRUCTION_MAX bytes and an FDE at most
+// DWARFW_INLINE_FDE_MAX(instructions_length) bytes.
+
+#define DWARFW_INLINE static inline __attribute__((always_inline))
+
+// Opcode and two LEB128 operands
+#define DWARFW_INLINE_INSTRUCTION_MAX (1 + 2 * 10)
+// Length, CIE pointer, 8-byte location and range, augmentation length and
+// padding
+#define DWARFW_INLINE_FDE_MAX(instructions_length) \
+	(4 + 4 + 8 + 8 + 1 + (instructions_length) + 4)
+
+#define DWARFW_INLINE_OPCODE_LOW_MASK 0x3F
+
+DWARFW_INLINE size_t dwarfw_inline_uleb128(char *buf, uint64_t value) {
+	size_t count = 0;
+	do {
+		uint8_t b = value & 0x7f;
+		value >>= 7;
+		if (value != 0) {
+			b |= 0x80;
+		}
+		buf[count++] = b;
+	} while (value != 0);
+	return count;
+}
+
+DWARFW_INLINE size_t dwarfw_inline_sleb128(char *buf, int64_t value) {
+	size_t count = 0;
+	bool more;
+	do {
+		uint8_t b = value & 0x7f;
+		value >>= 7;
+		more = !((value == 0 && (b & 0x40) == 0) ||
+			(value == -1 && (b & 0x40) != 0));
+		if (more) {
+			b |= 0x80;
+		}
+		buf[count++] = b;
+	} while (more);
+	return count;
+}
+
+// See pointer_write, returns 0 for unsupported encodings
+DWARFW_INLINE size_t dwarfw_inline_pointer(char *buf, long long int pointer,
+		uint8_t enc, size_t offset) {
+	switch (enc & 0x70) {
+	case 0:
+		break;
+	case DW_EH_PE_pcrel:
+	case DW_EH_PE_textrel:
+	case DW_EH_PE_datarel:
+	case DW_EH_PE_funcrel:
+		pointer -= offset;
+		break;
+	default:
+		return 0;
+	}
+
+	switch (enc & 0x0F) {
+	case DW_EH_PE_absptr:;
+		size_t pointer_arch = pointer;
+		memcpy(buf, &pointer_arch, sizeof(pointer_arch));
+		return sizeof(pointer_arch);
+	case DW_EH_PE_uleb128:
+		return dwarfw_inline_uleb128(buf, pointer);
+	case DW_EH_PE_udata2:
+	case DW_EH_PE_sdata2:;
+		uint16_t pointer_16 = pointer;
+		memcpy(buf, &pointer_16, sizeof(pointer_16));
+		return sizeof(pointer_16);
+	case DW_EH_PE_udata4:
+	case DW_EH_PE_sdata4:;
+		uint32_t pointer_32 = pointer;
+		memcpy(buf, &pointer_32, sizeof(pointer_32));
+		return sizeof(pointer_32);
+	case DW_EH_PE_udata8:
+	case DW_EH_PE_sdata8:;
+		uint64_t pointer_64 = pointer;
+		memcpy(buf, &pointer_64, sizeof(pointer_64));
+		return sizeof(pointer_64);
+	case DW_EH_PE_sleb128:
+		return dwarfw_inline_sleb128(buf, pointer);
+	default:
+		return 0;
+	}
+}
+
+DWARFW_INLINE size_t dwarfw_inline_advance_loc(char *buf, uint32_t delta,
+		uint64_t code_alignment) {
+	assert(delta % code_alignment == 0);
+	delta /= code_alignment;
+
+	if (delta <= DWARFW_INLINE_OPCODE_LOW_MASK) {
+		buf[0] = DW_CFA_advance_loc | delta;
+		return 1;
+	} else if (delta <= 0xFF) {
+		buf[0] = DW_CFA_advance_loc1;
+		buf[1] = delta;
+		return 2;
+	} else if (delta <= 0xFFFF) {
+		uint16_t delta_u16 = delta;
+		buf[0] = DW_CFA_advance_loc2;
+		memcpy(buf + 1, &delta_u16, sizeof(delta_u16));
+		return 1 + sizeof(delta_u16);
+	} else {
+		buf[0] = DW_CFA_advance_loc4;
+		memcpy(buf + 1, &delta, sizeof(delta));
+		return 1 + sizeof(delta);
+	}
+}
+
+DWARFW_INLINE size_t dwarfw_inline_offset(char *buf, uint64_t reg,
+		long long int offset, int64_t data_alignment) {
+	assert(offset % data_alignment == 0);
+	offset /= data_alignment;
+
+	size_t n = 0;
+	if (reg <= DWARFW_INLINE_OPCODE_LOW_MASK && offset >= 0) {
+		buf[n++] = DW_CFA_offset | reg;
+		return n + dwarfw_inline_uleb128(buf + n, offset);
+	} else if (offset >= 0) {
+		buf[n++] = DW_CFA_offset_extended;
+		n += dwarfw_inline_uleb128(buf + n, reg);
+		return n + dwarfw_inline_uleb128(buf + n, offset);
+	} else {
+		buf[n++] = DW_CFA_offset_extended_sf;
+		n += dwarfw_inline_uleb128(buf + n, reg);
+		return n + dwarfw_inline_sleb128(buf + n, offset);
+	}
+}
+
+DWARFW_INLINE size_t dwarfw_inline_restore(char *buf, uint64_t reg) {
+	if (reg <= DWARFW_INLINE_OPCODE_LOW_MASK) {
+		buf[0] = DW_CFA_restore | reg;
+		return 1;
+	}
+	buf[0] = DW_CFA_restore_extended;
+	return 1 + dwarfw_inline_uleb128(buf + 1, reg);
+}
+
+DWARFW_INLINE size_t dwarfw_inline_remember_state(char *buf) {
+	buf[0] = DW_CFA_remember_state;
+	return 1;
+}
+
+DWARFW_INLINE size_t dwarfw_inline_restore_state(char *buf) {
+	buf[0] = DW_CFA_restore_state;
+	return 1;
+}
+
+DWARFW_INLINE size_t dwarfw_inline_undefined(char *buf, uint64_t reg) {
+	buf[0] = DW_CFA_undefined;
+	return 1 + dwarfw_inline_uleb128(buf + 1, reg);
+}
+
+DWARFW_INLINE size_t dwarfw_inline_same_value(char *buf, uint64_t reg) {
+	buf[0] = DW_CFA_same_value;
+	return 1 + dwarfw_inline_uleb128(buf + 1, reg);
+}
+
+DWARFW_INLINE size_t dwarfw_inline_register(char *buf, uint64_t reg,
+		uint64_t ref) {
+	size_t n = 0;
+	buf[n++] = DW_CFA_register;
+	n += dwarfw_inline_uleb128(buf + n, reg);
+	return n + dwarfw_inline_uleb128(buf + n, ref);
+}
+
+DWARFW_INLINE size_t dwarfw_inline_val_offset(char *buf, uint64_t reg,
+		long long int offset, int64_t data_alignment) {
+	assert(offset % data_alignment == 0);
+	offset /= data_alignment;
+
+	size_t n = 0;
+	if (offset >= 0) {
+		buf[n++] = DW_CFA_val_offset;
+		n += dwarfw_inline_uleb128(buf + n, reg);
+		return n + dwarfw_inline_uleb128(buf + n, offset);
+	}
+	buf[n++] = DW_CFA_val_offset_sf;
+	n += dwarfw_inline_uleb128(buf + n, reg);
+	return n + dwarfw_inline_sleb128(buf + n, offset);
+}
+
+DWARFW_INLINE size_t dwarfw_inline_def_cfa(char *buf, uint64_t reg,
+		long long int offset, int64_t data_alignment) {
+	size_t n = 0;
+	if (offset >= 0) {
+		buf[n++] = DW_CFA_def_cfa;
+		n += dwarfw_inline_uleb128(buf + n, reg);
+		return n + dwarfw_inline_uleb128(buf + n, offset);
+	}
+
+	assert(offset % data_alignment == 0);
+	buf[n++] = DW_CFA_def_cfa_sf;
+	n += dwarfw_inline_uleb128(buf + n, reg);
+	return n + dwarfw_inline_sleb128(buf + n, offset / data_alignment);
+}
+
+DWARFW_INLINE size_t dwarfw_inline_def_cfa_register(char *buf, uint64_t reg) {
+	buf[0] = DW_CFA_def_cfa_register;
+	return 1 + dwarfw_inline_uleb128(buf + 1, reg);
+}
+
+DWARFW_INLINE size_t dwarfw_inline_def_cfa_offset(char *buf,
+		long long int offset, int64_t data_alignment) {
+	if (offset >= 0) {
+		buf[0] = DW_CFA_def_cfa_offset;
+		return 1 + dwarfw_inline_uleb128(buf + 1, offset);
+	}
+
+	assert(offset % data_alignment == 0);
+	buf[0] = DW_CFA_def_cfa_offset_sf;
+	return 1 + dwarfw_inline_sleb128(buf + 1, offset / data_alignment);
+}
+
+// Same as dwarfw_fde_write for a 32-bit .eh_frame FDE without relocation:
+// cie_pointer is relative to the start of the section and initial_location
+// to the start of the FDE. augmentation is true if the CIE's augmentation
+// starts with "z".
+DWARFW_INLINE size_t dwarfw_inline_fde(char *buf, uint64_t cie_pointer,
+		long long int initial_location, uint64_t address_range,
+		const char *instructions, size_t instructions_length, uint8_t ptr_enc,
+		bool augmentation) {
+	// The header is written after the length, which depends on it
+	size_t n = 2 * sizeof(uint32_t), len;
+	if (!(len = dwarfw_inline_pointer(buf + n, initial_location, ptr_enc, n))) {
+		return 0;
+	}
+	n += len;
+	if (!(len = dwarfw_inline_pointer(buf + n, address_range, ptr_enc & 0x0F,
+			0))) {
+		return 0;
+	}
+	n += len;
+	if (augmentation) {
+		buf[n++] = 0;
+	}
+	memcpy(buf + n, instructions, instructions_length);
+	n += instructions_length;
+
+	// Always at least one DW_CFA_nop, like dwarfw_cie_pad
+	size_t padding_length = sizeof(uint32_t) - n % sizeof(uint32_t);
+	memset(buf + n, DW_CFA_nop, padding_length);
+	n += padding_length;
+
+	uint32_t length = n - sizeof(uint32_t);
+	uint32_t cie_pointer_u32 = cie_pointer + sizeof(uint32_t);
+	memcpy(buf, &length, sizeof(length));
+	memcpy(buf + sizeof(length), &cie_pointer_u32, sizeof(cie_pointer_u32));
+	return n;
+}
+
+// Defines <name>_advance_loc, <name>_offset, <name>_def_cfa,
+// <name>_def_cfa_offset and <name>_fde encoders for a "zR" CIE with the given
+// constant parameters
+#define DWARFW_INLINE_ENCODER(name, ptr_enc, code_alignment, data_alignment) \
+	DWARFW_INLINE size_t name##_advance_loc(char *buf, uint32_t delta) { \
+		return dwarfw_inline_advance_loc(buf, delta, (code_alignment)); \
+	} \
+	DWARFW_INLINE size_t name##_offset(char *buf, uint64_t reg, \
+			long long int offset) { \
+		return dwarfw_inline_offset(buf, reg, offset, (data_alignment)); \
+	} \
+	DWARFW_INLINE size_t name##_def_cfa(char *buf, uint64_t reg, \
+			long long int offset) { \
+		return dwarfw_inline_def_cfa(buf, reg, offset, (data_alignment)); \
+	} \
+	DWARFW_INLINE size_t name##_def_cfa_offset(char *buf, \
+			long long int offset) { \
+		return dwarfw_inline_def_cfa_offset(buf, offset, (data_alignment)); \
+	} \
+	DWARFW_INLINE size_t name##_fde(char *buf, uint64_t cie_pointer, \
+			long long int initial_location, uint64_t address_range, \
+			const char *instructions, size_t instructions_length) { \
+		return dwarfw_inline_fde(buf, cie_pointer, initial_location, \
+			address_range, instructions, instructions_length, (ptr_enc), true); \
+	}
+
+#endif
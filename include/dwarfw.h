@@ -2,6 +2,7 @@
 #define DWARFW_H
 
 #include <gelf.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -12,10 +13,22 @@ struct dwarfw_cie {
 	int64_t data_alignment;
 	uint64_t return_address_register;
 
+	// Write the .debug_frame flavor of this CIE and its FDEs: version 4,
+	// absolute CIE pointers and 8-byte absolute addresses. The pointer
+	// encoding is ignored, an "R" augmentation says udata8.
+	bool debug_frame;
+	// Use the 64-bit DWARF format for this CIE and its FDEs: extended
+	// lengths, 8-byte CIE pointers and 8-byte alignment
+	bool dwarf64;
+
 	// only if augmentation contains "z"
 	struct {
 		uint8_t pointer_encoding; // only if augmentation contains "R"
-		// TODO: other augmentation data formats
+		// only if augmentation contains "P", a relative personality is
+		// relative to the start of the CIE
+		uint8_t personality_encoding;
+		long long int personality;
+		uint8_t lsda_encoding; // only if augmentation contains "L"
 	} augmentation_data;
 
 	size_t instructions_length;
@@ -23,20 +36,504 @@ struct dwarfw_cie {
 };
 
 size_t dwarfw_cie_write(struct dwarfw_cie *cie, FILE *f);
+// Same as dwarfw_cie_write, rela receives the personality relocation
+size_t dwarfw_cie_write_rela(struct dwarfw_cie *cie, GElf_Rela *rela, FILE *f);
+// Same as dwarfw_cie_write, padded like the FDEs of dwarfw_fde_write_rel.
+// Personalities aren't supported.
+size_t dwarfw_cie_write_rel(struct dwarfw_cie *cie, FILE *f);
+// Number of bytes dwarfw_cie_write writes, without writing
+size_t dwarfw_cie_size(struct dwarfw_cie *cie);
 
 struct dwarfw_fde {
 	struct dwarfw_cie *cie;
 
-	uint32_t cie_pointer; // relative to the start of the FDE section
+	// relative to the start of the FDE section, or the offset of the CIE in the
+	// section for .debug_frame
+	uint64_t cie_pointer;
 	long long int initial_location;
-	uint32_t address_range;
-	// TODO: augmentation data
+	uint64_t address_range;
+	// only if the CIE's augmentation contains "L": without an LSDA, a null
+	// pointer is written. lsda is relative to the start of the FDE like
+	// initial_location, or the relocation addend.
+	bool has_lsda;
+	long long int lsda;
 
 	size_t instructions_length;
 	const char *instructions;
 };
 
+// Relocations are only supported without LSDA, see dwarfw_fde_write_lsda
 size_t dwarfw_fde_write(struct dwarfw_fde *fde, GElf_Rela *rela, FILE* f);
+// Same as dwarfw_fde_write, but the addend is stored in place instead. If the
+// CIE uses an 8-byte pointer encoding, the record is padded to 8 bytes so
+// that the location can be relocated with RELR.
+size_t dwarfw_fde_write_rel(struct dwarfw_fde *fde, GElf_Rel *rel, FILE *f);
+// Same as dwarfw_fde_write, lsda_rela receives the LSDA relocation, of type
+// R_X86_64_NONE without LSDA
+size_t dwarfw_fde_write_lsda(struct dwarfw_fde *fde, GElf_Rela *rela,
+	GElf_Rela *lsda_rela, FILE *f);
+// Number of bytes dwarfw_fde_write writes, without writing. Relocations
+// don't change it, unless a LEB128 pointer encoding is used.
+size_t dwarfw_fde_size(struct dwarfw_fde *fde);
+// Position of the instructions in the record dwarfw_fde_write writes
+size_t dwarfw_fde_instructions_offset(struct dwarfw_fde *fde);
+
+// Writes all CIEs referenced by fdes, then the FDEs, and fills each FDE's
+// cie_pointer. Identical CIEs are written once, so FDEs can point to
+// per-personality copies of a CIE. If hotness is not NULL, FDEs are laid out
+// by decreasing hotness (e.g. perf sample counts) so that hot FDEs are packed
+// at the start of the section and cold ones (zero hotness) keep their order
+// at the end. If relas is NULL, initial locations, personalities and LSDAs
+// using a relative pointer encoding are relative to the start of the section.
+// fde_offsets and relas, if not NULL, are indexed like fdes and r_offset is
+// relative to the start of the section.
+size_t dwarfw_eh_frame_write(struct dwarfw_fde *fdes, size_t fdes_len,
+	const uint64_t *hotness, size_t *fde_offsets, GElf_Rela *relas, FILE *f);
+// Same as dwarfw_eh_frame_write with REL relocations, records are padded as
+// by dwarfw_fde_write_rel
+size_t dwarfw_eh_frame_write_rel(struct dwarfw_fde *fdes, size_t fdes_len,
+	const uint64_t *hotness, size_t *fde_offsets, GElf_Rel *rels, FILE *f);
+// Number of bytes dwarfw_eh_frame_write writes, so that the output can be
+// sized upfront (e.g. for dwarfw_mmap_open). The layout doesn't change it,
+// unless a LEB128 pointer encoding is used.
+size_t dwarfw_eh_frame_size(struct dwarfw_fde *fdes, size_t fdes_len);
+
+// Relocations of an FDE: its initial location, its LSDA and the personality
+// of its CIE, shared by all FDEs of the CIE. Relocations which don't apply
+// have the R_X86_64_NONE type.
+struct dwarfw_fde_relas {
+	GElf_Rela location;
+	GElf_Rela lsda;
+	GElf_Rela personality;
+};
+
+// Same as dwarfw_eh_frame_write, with relocations for CIEs with a
+// personality and FDEs with an LSDA. A null LSDA is written as an absolute 0,
+// without a relocation.
+size_t dwarfw_eh_frame_write_eh(struct dwarfw_fde *fdes, size_t fdes_len,
+	const uint64_t *hotness, size_t *fde_offsets,
+	struct dwarfw_fde_relas *relas, FILE *f);
+
+// Structure-of-arrays input, without per-FDE pointers: FDE i covers
+// ranges[i] bytes from base + starts[i], uses the CIE at cie_indices[i] and
+// its instructions are the bytes of instructions from instruction_offsets[i]
+// to instruction_offsets[i + 1]
+struct dwarfw_fde_columns {
+	size_t fdes_len;
+	long long int base;
+	const uint32_t *starts;
+	const uint32_t *ranges;
+	const uint32_t *cie_indices;
+	const uint32_t *instruction_offsets; // fdes_len + 1 elements
+	const char *instructions;
+};
+
+// Same as dwarfw_eh_frame_write for columnar input, with the same output as
+// for the equivalent FDEs. base follows the convention of initial locations.
+size_t dwarfw_eh_frame_write_columns(struct dwarfw_cie *cies, size_t cies_len,
+	const struct dwarfw_fde_columns *columns, size_t *fde_offsets,
+	GElf_Rela *relas, FILE *f);
+
+// Encodes the offsets of relative relocations (e.g. R_X86_64_RELATIVE, with
+// the addend stored in place) as SHT_RELR entries: runs of nearby
+// relocations take a single bitmap word. Offsets must be sorted and 8-byte
+// aligned: FDEs written by dwarfw_eh_frame_write_rel with an 8-byte pointer
+// encoding are, if the section is.
+size_t dwarfw_relr_write(const uint64_t *offsets, size_t offsets_len,
+	FILE *f);
+
+// .eh_frame_hdr binary search table entry, both fields are relative to the
+// start of .eh_frame_hdr (DW_EH_PE_datarel | DW_EH_PE_sdata4)
+struct dwarfw_eh_frame_hdr_entry {
+	int32_t initial_location;
+	int32_t fde;
+};
+
+void dwarfw_eh_frame_hdr_sort(struct dwarfw_eh_frame_hdr_entry *entries,
+	size_t entries_len);
+// eh_frame is the address of .eh_frame relative to .eh_frame_hdr. entries are
+// sorted in place.
+size_t dwarfw_eh_frame_hdr_write(long long int eh_frame,
+	struct dwarfw_eh_frame_hdr_entry *entries, size_t entries_len, FILE *f);
+size_t dwarfw_eh_frame_hdr_size(size_t entries_len);
+const struct dwarfw_eh_frame_hdr_entry *dwarfw_eh_frame_hdr_lookup(
+	const void *hdr, int32_t location);
+
+// Set of .eh_frame_hdr entries for workloads which keep adding and removing
+// FDEs: updates are amortized O(log n) and a table is only sorted when
+// written. Locations and FDE offsets (e.g. fde_offsets of
+// dwarfw_eh_frame_write) are relative to the start of .eh_frame. Adding an
+// existing location replaces its FDE.
+struct dwarfw_eh_frame_hdr_set;
+
+struct dwarfw_eh_frame_hdr_set *dwarfw_eh_frame_hdr_set_create(void);
+void dwarfw_eh_frame_hdr_set_destroy(struct dwarfw_eh_frame_hdr_set *set);
+bool dwarfw_eh_frame_hdr_set_add(struct dwarfw_eh_frame_hdr_set *set,
+	int64_t initial_location, size_t fde_offset);
+bool dwarfw_eh_frame_hdr_set_remove(struct dwarfw_eh_frame_hdr_set *set,
+	int64_t initial_location);
+// Writes .eh_frame_hdr like dwarfw_eh_frame_hdr_write
+size_t dwarfw_eh_frame_hdr_set_write(struct dwarfw_eh_frame_hdr_set *set,
+	long long int eh_frame, FILE *f);
+
+// Auxiliary FDE index: the same entries as .eh_frame_hdr, relative to the
+// start of the index, laid out for cache-friendly branch-free lookups
+size_t dwarfw_eh_frame_index_write(struct dwarfw_eh_frame_hdr_entry *entries,
+	size_t entries_len, FILE *f);
+size_t dwarfw_eh_frame_index_length(const void *index);
+const struct dwarfw_eh_frame_hdr_entry *dwarfw_eh_frame_index_lookup(
+	const void *index, int32_t location);
+
+// Unwind row restricted to what compact unwind formats can express: the CFA
+// is a register plus an offset, the frame pointer is either saved at an
+// offset from the CFA or not saved (offset 0), and the return address is
+// saved at an offset from the CFA
+struct dwarfw_unwind_row {
+	uint32_t offset; // relative to the start of the function
+	uint64_t cfa_register;
+	long long int cfa_offset;
+	long long int fp_offset;
+	long long int ra_offset; // 0 for CFA - 8, where the call pushes it
+};
+
+struct dwarfw_unwind_function {
+	uint64_t location;
+	uint32_t range;
+
+	size_t rows_len;
+	const struct dwarfw_unwind_row *rows;
+};
+
+// Writes the CFI instructions of rows for an x86_64 CIE whose initial
+// instructions set the CFA to rsp + 8 and the return address at CFA - 8.
+// A frame pointer or return address offset of 0 restores the CIE's rule.
+bool dwarfw_unwind_rows_write(struct dwarfw_cie *cie,
+	const struct dwarfw_unwind_row *rows, size_t rows_len, FILE *f);
+// Computes the rows of an x86_64 function without unwind information from
+// its machine code, by following the stack pointer and frame pointer through
+// pushes, pops, rsp adjustments, frame setup and epilogues. Code after an
+// epilogue gets the rows from before it. Returns the number of rows, or 0 if
+// the code can't be decoded, the CFA is lost or rows_cap is too small
+// (code_len + 1 is always enough). Thread-safe.
+size_t dwarfw_unwind_rows_analyze(const char *code, size_t code_len,
+	struct dwarfw_unwind_row *rows, size_t rows_cap);
+
+// ORC-style unwind table (x86_64): an array of instruction pointers relative
+// to a base address, sorted, and an array of entries of the same length
+enum dwarfw_orc_reg {
+	DWARFW_ORC_REG_UNDEFINED = 0,
+	DWARFW_ORC_REG_SP,
+	DWARFW_ORC_REG_FP,
+};
+
+enum dwarfw_orc_type {
+	DWARFW_ORC_TYPE_UNDEFINED = 0, // no unwind information, stop unwinding
+	DWARFW_ORC_TYPE_CALL,
+};
+
+struct dwarfw_orc_entry {
+	int16_t cfa_offset;
+	int16_t fp_offset; // 0 if the frame pointer isn't saved
+	uint8_t cfa_register; // enum dwarfw_orc_reg
+	uint8_t type; // enum dwarfw_orc_type
+};
+
+struct dwarfw_orc_table {
+	uint64_t base;
+	size_t length;
+	const uint32_t *ip;
+	const struct dwarfw_orc_entry *entries;
+};
+
+struct dwarfw_orc_regs {
+	uint64_t ip;
+	uint64_t sp;
+	uint64_t fp;
+};
+
+typedef bool (*dwarfw_read_func)(uint64_t address, uint64_t *value,
+	void *data);
+
+// functions must be sorted by location. Rows that can't be expressed are
+// written as DWARFW_ORC_TYPE_UNDEFINED entries. Returns the number of entries.
+size_t dwarfw_orc_write(const struct dwarfw_unwind_function *functions,
+	size_t functions_len, uint64_t base, FILE *ip_f, FILE *entries_f);
+const struct dwarfw_orc_entry *dwarfw_orc_lookup(
+	const struct dwarfw_orc_table *table, uint64_t ip);
+// Unwinds one frame. innermost must be false when regs->ip is a return
+// address.
+bool dwarfw_orc_unwind(const struct dwarfw_orc_table *table,
+	struct dwarfw_orc_regs *regs, bool innermost, dwarfw_read_func read,
+	void *data);
+
+// Writes an SFrame (version 2) section for x86_64, with an FDE per function
+// and FREs in their smallest encoding. address is the address of the section,
+// functions must be sorted by location. Functions with rows that can't be
+// expressed, or too far from the section, are left out. Returns the number of
+// bytes written.
+size_t dwarfw_sframe_write(const struct dwarfw_unwind_function *functions,
+	size_t functions_len, uint64_t address, FILE *f);
+
+// FDEs assembled from gas-style CFI directives (.cfi_startproc,
+// .cfi_def_cfa_offset, .cfi_offset...), to be written with
+// dwarfw_eh_frame_write. The text has no instructions to assemble, so
+// addresses come from objdump output lines: a function label
+// ("0000000000401000 <main>:") or an instruction with its bytes
+// ("401000:\t55\tpush %rbp"). As with gas, directives following an
+// instruction take effect at its end. Other lines and directives are ignored,
+// registers are x86_64 names or DWARF numbers.
+// All FDEs use cie. On error, error_line is the 1-based line which failed.
+struct dwarfw_asm {
+	size_t fdes_len;
+	struct dwarfw_fde *fdes;
+	char *instructions; // of all FDEs
+
+	size_t error_line;
+};
+
+bool dwarfw_asm_init(struct dwarfw_asm *out, struct dwarfw_cie *cie,
+	const char *text, size_t text_len);
+void dwarfw_asm_finish(struct dwarfw_asm *out);
+
+// Readers for records produced by dwarfw_cie_write and dwarfw_fde_write.
+// Pointers in the returned structs point into buf. dwarfw_record_read returns
+// the length of the record at buf and its CIE pointer (0 for CIEs), using the
+// same convention as struct dwarfw_fde. All return 0 on error or on a zero
+// terminator.
+size_t dwarfw_record_read(const char *buf, size_t len, uint64_t *cie_pointer);
+size_t dwarfw_cie_read(const char *buf, size_t len, struct dwarfw_cie *cie);
+size_t dwarfw_fde_read(const char *buf, size_t len, struct dwarfw_cie *cie,
+	struct dwarfw_fde *fde);
+
+// Decoded Call Frame Instruction. Primary opcodes (DW_CFA_advance_loc,
+// DW_CFA_offset and DW_CFA_restore) have their low bits cleared. Factored
+// operands are multiplied by the CIE alignment factors. DW_CFA_set_loc
+// addresses using a relative encoding are relative to the start of the
+// instruction.
+struct dwarfw_instruction {
+	uint8_t opcode;
+	uint64_t reg;
+	// Offset, location delta, address, second register or arguments size
+	long long int operand;
+	const char *expr;
+	size_t expr_len;
+};
+
+size_t dwarfw_cie_read_instruction(struct dwarfw_cie *cie, const char *buf,
+	size_t len, struct dwarfw_instruction *insn);
+
+// Call Frame Information evaluation
+#define DWARFW_REGISTERS_LEN 32
+
+enum dwarfw_rule_type {
+	DWARFW_RULE_UNDEFINED = 0,
+	DWARFW_RULE_SAME_VALUE,
+	DWARFW_RULE_OFFSET, // saved at CFA + offset
+	DWARFW_RULE_VAL_OFFSET, // value is CFA + offset
+	DWARFW_RULE_REGISTER, // saved in reg, or CFA is reg + offset
+	DWARFW_RULE_EXPRESSION,
+	DWARFW_RULE_VAL_EXPRESSION,
+};
+
+struct dwarfw_rule {
+	uint8_t type; // enum dwarfw_rule_type
+	uint64_t reg;
+	long long int offset;
+	const char *expr;
+	size_t expr_len;
+};
+
+struct dwarfw_cfi_row {
+	uint64_t location; // relative to the start of the function
+	struct dwarfw_rule cfa;
+	// Rules for registers >= DWARFW_REGISTERS_LEN are ignored
+	struct dwarfw_rule regs[DWARFW_REGISTERS_LEN];
+};
+
+// Computes the row in effect at location, relative to the start of the FDE's
+// function, by running the CIE initial instructions then the FDE's
+bool dwarfw_cfi_eval(struct dwarfw_fde *fde, uint64_t location,
+	struct dwarfw_cfi_row *row);
+
+// All rows of an FDE, for repeated queries in O(log rows)
+struct dwarfw_cfi_table {
+	size_t rows_len;
+	struct dwarfw_cfi_row *rows;
+};
+
+bool dwarfw_cfi_table_init(struct dwarfw_cfi_table *table,
+	struct dwarfw_fde *fde);
+void dwarfw_cfi_table_finish(struct dwarfw_cfi_table *table);
+const struct dwarfw_cfi_row *dwarfw_cfi_table_lookup(
+	const struct dwarfw_cfi_table *table, uint64_t location);
+
+// An encoded .eh_frame section and its relocations, with r_offset relative
+// to the start of the section. address is used for pc-relative locations
+// which aren't relocated.
+struct dwarfw_eh_frame_input {
+	const char *buf;
+	size_t len;
+	uint64_t address;
+
+	const GElf_Rela *relas;
+	size_t relas_len;
+};
+
+// Merges .eh_frame sections into one placed at address: identical CIEs are
+// written once, unreferenced ones are dropped and FDEs covering the same code
+// range as a previous one are dropped. Relocations of all inputs must refer
+// to the same symbol table.
+// On success, *relas is allocated and receives the relocations of the merged
+// section, and *len its size, which is 0 if no FDE is left.
+bool dwarfw_eh_frame_merge(const struct dwarfw_eh_frame_input *inputs,
+	size_t inputs_len, uint64_t address, GElf_Rela **relas,
+	size_t *relas_len, size_t *len, FILE *f);
+
+struct dwarfw_range {
+	uint64_t start, end;
+};
+
+// Code which is still live: FDEs with a relocated location are kept if the
+// bit of the relocation's symbol is set, other FDEs are kept if they overlap
+// one of the sorted, non-overlapping ranges. A NULL bitmap or ranges array
+// keeps all the corresponding FDEs.
+struct dwarfw_eh_frame_live {
+	const uint8_t *symbols;
+	size_t symbols_len; // in bits
+	const struct dwarfw_range *ranges;
+	size_t ranges_len;
+};
+
+// Rewrites an .eh_frame section at the same address, without the FDEs of
+// dead code and the CIEs which aren't referenced anymore. Like
+// dwarfw_eh_frame_merge, identical CIEs are written once and FDEs covering the
+// same code range as a previous one are dropped. The results are returned as
+// by dwarfw_eh_frame_merge.
+bool dwarfw_eh_frame_gc(const struct dwarfw_eh_frame_input *input,
+	const struct dwarfw_eh_frame_live *live, GElf_Rela **relas,
+	size_t *relas_len, size_t *len, FILE *f);
+
+// Opens a stream compressing everything written to it into f, after an
+// Elf64_Chdr header, as the contents of an SHF_COMPRESSED section (e.g.
+// .debug_frame). type is ELFCOMPRESS_ZLIB or ELFCOMPRESS_ZSTD, NULL is
+// returned if it isn't supported by this build. f must be seekable: the
+// header's uncompressed size is filled in by fclose.
+FILE *dwarfw_compress_open(uint32_t type, uint64_t addralign, FILE *f);
+
+// Asynchronous output: the stream fills buffers which are written to fd from
+// offset through io_uring, or a pwrite thread pool if it isn't available, so
+// that encoding overlaps with I/O. The stream is seekable. If stats is not
+// NULL, it's filled by fclose.
+struct dwarfw_async_stats {
+	bool io_uring;
+	uint64_t bytes;
+	uint64_t writes; // buffers submitted
+	uint64_t waits; // times encoding waited for a free buffer
+	size_t max_queue_depth; // buffers in flight
+	double mean_queue_depth; // buffers in flight after a submission
+	double seconds; // from open to close
+};
+
+FILE *dwarfw_async_open(int fd, uint64_t offset,
+	struct dwarfw_async_stats *stats);
+
+// Output mapped in memory: size bytes from offset in fd are allocated with
+// fallocate and mapped, and the unbuffered stream copies writes straight into
+// the mapping. Writing past size fails. If data is not NULL, it receives the
+// mapping, for encoders writing to memory (e.g. dwarfw-inline.h). fclose
+// unmaps it.
+FILE *dwarfw_mmap_open(int fd, uint64_t offset, size_t size, char **data);
+
+// GDB JIT interface: in-memory ELF images holding a symbol, the .text address
+// range and .eh_frame for a blob of JIT code. FDE initial locations are
+// absolute addresses. Images are allocated on the heap: creating one fails if
+// a 4-byte relative pointer can't reach the code from it, absolute 8-byte
+// pointer encodings always work.
+struct dwarfw_jit_entry;
+
+struct dwarfw_jit_entry *dwarfw_jit_entry_create(const char *name,
+	uint64_t code, uint64_t code_size, struct dwarfw_fde *fdes,
+	size_t fdes_len);
+void dwarfw_jit_entry_destroy(struct dwarfw_jit_entry *entry);
+const char *dwarfw_jit_entry_image(struct dwarfw_jit_entry *entry,
+	size_t *len);
+// Notifies an attached debugger through __jit_debug_register_code
+void dwarfw_jit_register(struct dwarfw_jit_entry *entry);
+void dwarfw_jit_unregister(struct dwarfw_jit_entry *entry);
+
+// Lazily encoded .eh_frame, for generated code with lots of functions which
+// are rarely unwound through: only function descriptors are kept, and the
+// CIE and FDE of a function are encoded on the first lookup of one of its
+// addresses, then cached until the dwarfw_lazy is destroyed. Locations and
+// personalities are absolute addresses, and are encoded as such. Rows aren't
+// copied and must outlive the dwarfw_lazy. Functions must not overlap.
+struct dwarfw_lazy_function {
+	uint64_t location;
+	uint32_t range;
+	uint32_t cie; // index in the CIEs of the dwarfw_lazy
+	size_t rows_len;
+	const struct dwarfw_unwind_row *rows;
+};
+
+struct dwarfw_lazy;
+
+struct dwarfw_lazy *dwarfw_lazy_create(const struct dwarfw_cie *cies,
+	size_t cies_len);
+void dwarfw_lazy_destroy(struct dwarfw_lazy *lazy);
+bool dwarfw_lazy_add(struct dwarfw_lazy *lazy,
+	const struct dwarfw_lazy_function *functions, size_t functions_len);
+// Reserves size bytes for the fragments created by dwarfw_lazy_find_fde, and
+// as much scratch space for their instructions. Can only be called once.
+bool dwarfw_lazy_reserve(struct dwarfw_lazy *lazy, size_t size);
+// Returns the FDE covering pc, NULL if there is none. If eh_frame is not
+// NULL, it receives the start of a zero-terminated .eh_frame holding the FDE
+// and its CIE (e.g. for __register_frame). This waits for the lock and
+// allocates the FDE on its first lookup: it isn't async-signal-safe and must
+// not be called while malloc's locks may be held.
+const void *dwarfw_lazy_lookup(struct dwarfw_lazy *lazy, uint64_t pc,
+	const void **eh_frame);
+
+// Hook for an unwinder's dynamic FDE lookup callback, data is the dwarfw_lazy
+typedef const void *(*dwarfw_find_fde_func)(uint64_t pc, void *data);
+
+// Like dwarfw_lazy_lookup, but never waits or allocates, so that it can be
+// called from signal handlers: returns NULL if the lock is held, and FDEs
+// looked up for the first time are created in the storage reserved by
+// dwarfw_lazy_reserve, NULL if there is none or it is full.
+const void *dwarfw_lazy_find_fde(uint64_t pc, void *data);
+
+// perf jitdump JIT_CODE_UNWINDING_INFO records, to be written before the
+// JIT_CODE_LOAD record of the code they describe. FDE initial locations are
+// relative to the start of the code. The scratch buffers are reused across
+// calls, initialize them to zero.
+struct dwarfw_jitdump_scratch {
+	char *buf;
+	size_t buf_cap;
+
+	struct dwarfw_fde *fdes;
+	size_t *fde_offsets;
+	struct dwarfw_eh_frame_hdr_entry *entries;
+	size_t fdes_cap;
+};
+
+size_t dwarfw_jitdump_unwinding_info_write(
+	struct dwarfw_jitdump_scratch *scratch, uint64_t code_size,
+	struct dwarfw_fde *fdes, size_t fdes_len, uint64_t timestamp, FILE *f);
+void dwarfw_jitdump_scratch_finish(struct dwarfw_jitdump_scratch *scratch);
+
+// Index of an ELF object's sections by name and of section symbols by
+// section index, built in a single pass. Sections created through
+// dwarfw_elf_create_section are indexed too; their names are owned by the
+// context, so destroy it after elf_update().
+struct dwarfw_elf;
+
+struct dwarfw_elf *dwarfw_elf_create(Elf *elf);
+void dwarfw_elf_destroy(struct dwarfw_elf *ctx);
+Elf_Scn *dwarfw_elf_find_section(struct dwarfw_elf *ctx, const char *name);
+// Returns the index of the STT_SECTION symbol for the section, or -1
+int dwarfw_elf_find_section_symbol(struct dwarfw_elf *ctx, size_t index,
+	GElf_Sym *sym);
+Elf_Scn *dwarfw_elf_create_section(struct dwarfw_elf *ctx, const char *name);
 
 // Call Frame Instructions
 size_t dwarfw_cie_write_advance_loc(struct dwarfw_cie *cie, uint32_t delta,
@@ -45,6 +542,8 @@ size_t dwarfw_cie_write_offset(struct dwarfw_cie *cie, uint64_t reg,
 	long long int offset, FILE *f);
 size_t dwarfw_cie_write_restore(struct dwarfw_cie *cie, uint64_t reg, FILE *f);
 size_t dwarfw_cie_write_nop(struct dwarfw_cie *cie, FILE *f);
+// addr follows the convention of initial locations, offset is the position
+// of the address in the FDE (see dwarfw_fde_instructions_offset)
 size_t dwarfw_cie_write_set_loc(struct dwarfw_cie *cie, long long int addr,
 	size_t offset, FILE *f);
 size_t dwarfw_cie_write_undefined(struct dwarfw_cie *cie, uint64_t reg,
@@ -71,7 +570,27 @@ size_t dwarfw_cie_write_val_offset(struct dwarfw_cie *cie, uint64_t reg,
 size_t dwarfw_cie_pad(struct dwarfw_cie *cie, size_t length, FILE *f);
 
 // Call Frame Expressions
+// Writes an operation without operands (e.g. DW_OP_plus, DW_OP_call_frame_cfa)
+size_t dwarfw_op_write(uint8_t op, FILE *f);
 size_t dwarfw_op_write_deref(FILE *f);
+size_t dwarfw_op_write_deref_size(uint8_t size, FILE *f);
+size_t dwarfw_op_write_pick(uint8_t index, FILE *f);
+// The following pick the shortest encoding for their operands
+size_t dwarfw_op_write_lit(uint64_t value, FILE *f);
+size_t dwarfw_op_write_const(long long int value, FILE *f);
+size_t dwarfw_op_write_add(long long int value, FILE *f);
+size_t dwarfw_op_write_reg(uint64_t reg, FILE *f);
 size_t dwarfw_op_write_bregx(uint64_t reg, long long int offset, FILE *f);
+// op is DW_OP_skip or DW_OP_bra, offset is relative to the next operation
+size_t dwarfw_op_write_branch(uint8_t op, int16_t offset, FILE *f);
+
+// Interns expression blobs: identical expressions share a single copy
+struct dwarfw_expr_pool;
+
+struct dwarfw_expr_pool *dwarfw_expr_pool_create(void);
+void dwarfw_expr_pool_destroy(struct dwarfw_expr_pool *pool);
+const char *dwarfw_expr_pool_intern(struct dwarfw_expr_pool *pool,
+	const char *expr, size_t expr_len);
+size_t dwarfw_expr_pool_length(struct dwarfw_expr_pool *pool);
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Open addressing hash table keyed by byte strings. Keys aren't copied and
+// must outlive the table.
+struct hash_entry {
+	uint64_t hash;
+	const void *key;
+	size_t key_len;
+	void *value;
+};
+
+struct hash_table {
+	struct hash_entry *entries;
+	size_t len, cap;
+};
+
+uint64_t hash_bytes(const void *data, size_t len);
+void hash_table_finish(struct hash_table *table);
+struct hash_entry *hash_table_find(const struct hash_table *table,
+	const void *key, size_t key_len);
+// Returns the entry for key, inserting one with a NULL value if there is
+// none. Returns NULL on allocation failure.
+struct hash_entry *hash_table_insert(struct hash_table *table,
+	const void *key, size_t key_len);
+// Makes room for len entries, so that inserting them doesn't allocate
+bool hash_table_reserve(struct hash_table *table, size_t len);
+
+#endif
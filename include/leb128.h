@@ -7,5 +7,9 @@
 
 size_t leb128_write_u64(uint64_t value, FILE *f, size_t pad_to);
 size_t leb128_write_s64(int64_t value, FILE *f, size_t pad_to);
+size_t leb128_length_u64(uint64_t value);
+size_t leb128_length_s64(int64_t value);
+size_t leb128_read_u64(const char *buf, size_t len, uint64_t *value);
+size_t leb128_read_s64(const char *buf, size_t len, int64_t *value);
 
 #endif
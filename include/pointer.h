@@ -1,11 +1,19 @@
 #ifndef POINTER_H
 #define POINTER_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
 size_t pointer_write(long long int pointer, uint8_t enc, size_t offset,
 	FILE *f);
+// Same as pointer_write, without writing
+size_t pointer_length(long long int pointer, uint8_t enc, size_t offset);
+size_t pointer_read(const char *buf, size_t len, uint8_t enc, size_t offset,
+	long long int *pointer);
+// Size of fixed-size encodings, 0 otherwise
+size_t pointer_size(uint8_t enc);
+bool pointer_is_relative(uint8_t enc);
 uint8_t pointer_rela_type(uint8_t enc);
 
 #endif
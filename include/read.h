@@ -0,0 +1,12 @@
+#ifndef READ_H
+#define READ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t read_u8(const char *buf, size_t len, uint8_t *value);
+size_t read_u16(const char *buf, size_t len, uint16_t *value);
+size_t read_u32(const char *buf, size_t len, uint32_t *value);
+size_t read_u64(const char *buf, size_t len, uint64_t *value);
+
+#endif
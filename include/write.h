@@ -7,5 +7,6 @@
 size_t write_u8(uint8_t b, FILE *f);
 size_t write_u16(uint16_t b, FILE *f);
 size_t write_u32(uint32_t b, FILE *f);
+size_t write_u64(uint64_t b, FILE *f);
 
 #endif
@@ -0,0 +1,338 @@
+#define _POSIX_C_SOURCE 200809L
+#include <elf.h>
+#include <dwarfw.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GDB JIT compilation interface, see
+// https://sourceware.org/gdb/current/onlinedocs/gdb.html/JIT-Interface.html
+// The symbols are weak so that a JIT which already defines them wins.
+enum jit_actions {
+	JIT_NOACTION = 0,
+	JIT_REGISTER_FN,
+	JIT_UNREGISTER_FN,
+};
+
+struct jit_code_entry {
+	struct jit_code_entry *next_entry;
+	struct jit_code_entry *prev_entry;
+	const char *symfile_addr;
+	uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+	uint32_t version;
+	uint32_t action_flag;
+	struct jit_code_entry *relevant_entry;
+	struct jit_code_entry *first_entry;
+};
+
+void __jit_debug_register_code(void);
+
+__attribute__((weak, noinline)) void __jit_debug_register_code(void) {
+	// GDB puts a breakpoint here, make sure the call isn't optimized out
+	__asm__ volatile("" ::: "memory");
+}
+
+__attribute__((weak)) struct jit_descriptor __jit_debug_descriptor = {
+	.version = 1,
+};
+
+static pthread_mutex_t jit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+enum {
+	SECTION_NULL = 0,
+	SECTION_TEXT,
+	SECTION_EH_FRAME,
+	SECTION_SYMTAB,
+	SECTION_STRTAB,
+	SECTION_SHSTRTAB,
+	SECTIONS_LEN,
+};
+
+#define SHSTRTAB "\0.text\0.eh_frame\0.symtab\0.strtab\0.shstrtab"
+#define SHSTRTAB_TEXT 1
+#define SHSTRTAB_EH_FRAME (SHSTRTAB_TEXT + sizeof(".text"))
+#define SHSTRTAB_SYMTAB (SHSTRTAB_EH_FRAME + sizeof(".eh_frame"))
+#define SHSTRTAB_STRTAB (SHSTRTAB_SYMTAB + sizeof(".symtab"))
+#define SHSTRTAB_SHSTRTAB (SHSTRTAB_STRTAB + sizeof(".strtab"))
+
+#define EH_FRAME_ALIGN 8
+
+// Fixed part of the image, followed by .eh_frame and .strtab
+struct jit_image_header {
+	Elf64_Ehdr ehdr;
+	Elf64_Shdr shdrs[SECTIONS_LEN];
+	char shstrtab[sizeof(SHSTRTAB)];
+	Elf64_Sym syms[2];
+} __attribute__((aligned(EH_FRAME_ALIGN)));
+
+static const struct jit_image_header image_template = {
+	.ehdr = {
+		.e_ident = {
+			ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+			ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_NONE,
+		},
+		.e_type = ET_REL,
+		.e_machine = EM_X86_64,
+		.e_version = EV_CURRENT,
+		.e_shoff = offsetof(struct jit_image_header, shdrs),
+		.e_ehsize = sizeof(Elf64_Ehdr),
+		.e_shentsize = sizeof(Elf64_Shdr),
+		.e_shnum = SECTIONS_LEN,
+		.e_shstrndx = SECTION_SHSTRTAB,
+	},
+	.shdrs = {
+		[SECTION_TEXT] = {
+			.sh_name = SHSTRTAB_TEXT,
+			.sh_type = SHT_NOBITS,
+			.sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+			.sh_addralign = 1,
+		},
+		[SECTION_EH_FRAME] = {
+			.sh_name = SHSTRTAB_EH_FRAME,
+			.sh_type = SHT_PROGBITS,
+			.sh_flags = SHF_ALLOC,
+			.sh_offset = sizeof(struct jit_image_header),
+			.sh_addralign = EH_FRAME_ALIGN,
+		},
+		[SECTION_SYMTAB] = {
+			.sh_name = SHSTRTAB_SYMTAB,
+			.sh_type = SHT_SYMTAB,
+			.sh_offset = offsetof(struct jit_image_header, syms),
+			.sh_size = 2 * sizeof(Elf64_Sym),
+			.sh_link = SECTION_STRTAB,
+			.sh_info = 1, // Index of the first global symbol
+			.sh_addralign = 8,
+			.sh_entsize = sizeof(Elf64_Sym),
+		},
+		[SECTION_STRTAB] = {
+			.sh_name = SHSTRTAB_STRTAB,
+			.sh_type = SHT_STRTAB,
+			.sh_addralign = 1,
+		},
+		[SECTION_SHSTRTAB] = {
+			.sh_name = SHSTRTAB_SHSTRTAB,
+			.sh_type = SHT_STRTAB,
+			.sh_offset = offsetof(struct jit_image_header, shstrtab),
+			.sh_size = sizeof(SHSTRTAB),
+			.sh_addralign = 1,
+		},
+	},
+	.shstrtab = SHSTRTAB,
+	.syms = {
+		[1] = {
+			.st_name = 1,
+			.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC),
+			.st_shndx = SECTION_TEXT,
+		},
+	},
+};
+
+struct dwarfw_jit_entry {
+	struct jit_code_entry code_entry;
+	bool registered;
+
+	size_t image_len;
+	_Alignas(EH_FRAME_ALIGN) char image[];
+};
+
+// Resolves a relocation produced by dwarfw_fde_write against an absolute
+// symbol value of zero: the addend holds the absolute location. The image is
+// on the heap, which can be too far away from the code for 32-bit relative
+// pointers: fails if the value doesn't fit.
+static bool rela_apply(char *section, uint64_t section_addr,
+		const GElf_Rela *rela) {
+	char *place = section + rela->r_offset;
+	uint64_t pc = section_addr + rela->r_offset;
+	int64_t value = rela->r_addend;
+	int32_t value_s32;
+	uint32_t value_u32;
+	uint16_t value_u16;
+
+	switch (GELF_R_TYPE(rela->r_info)) {
+	case R_X86_64_PC16:
+		value -= pc;
+		if (value < INT16_MIN || value > INT16_MAX) {
+			return false;
+		}
+		value_u16 = value;
+		memcpy(place, &value_u16, sizeof(value_u16));
+		return true;
+	case R_X86_64_PC32:
+		value -= pc;
+		if (value < INT32_MIN || value > INT32_MAX) {
+			return false;
+		}
+		value_s32 = value;
+		memcpy(place, &value_s32, sizeof(value_s32));
+		return true;
+	case R_X86_64_PC64:
+		value -= pc;
+		memcpy(place, &value, sizeof(value));
+		return true;
+	case R_X86_64_16:
+		if ((uint64_t)value > UINT16_MAX) {
+			return false;
+		}
+		value_u16 = value;
+		memcpy(place, &value_u16, sizeof(value_u16));
+		return true;
+	case R_X86_64_32:
+		if ((uint64_t)value > UINT32_MAX) {
+			return false;
+		}
+		value_u32 = value;
+		memcpy(place, &value_u32, sizeof(value_u32));
+		return true;
+	case R_X86_64_32S:
+		if (value < INT32_MIN || value > INT32_MAX) {
+			return false;
+		}
+		value_u32 = value;
+		memcpy(place, &value_u32, sizeof(value_u32));
+		return true;
+	case R_X86_64_64:
+		memcpy(place, &value, sizeof(value));
+		return true;
+	default:
+		return false;
+	}
+}
+
+struct dwarfw_jit_entry *dwarfw_jit_entry_create(const char *name,
+		uint64_t code, uint64_t code_size, struct dwarfw_fde *fdes,
+		size_t fdes_len) {
+	// Encode .eh_frame with relocations: its final address is only known
+	// once the image is allocated
+	GElf_Rela *relas = malloc(fdes_len * sizeof(GElf_Rela));
+	if (relas == NULL) {
+		return NULL;
+	}
+	char *eh_frame;
+	size_t eh_frame_len;
+	FILE *f = open_memstream(&eh_frame, &eh_frame_len);
+	if (f == NULL) {
+		free(relas);
+		return NULL;
+	}
+	size_t n = dwarfw_eh_frame_write(fdes, fdes_len, NULL, NULL, relas, f);
+	uint32_t terminator = 0;
+	if (n) {
+		n = fwrite(&terminator, 1, sizeof(terminator), f);
+	}
+	fclose(f);
+	if (!n) {
+		goto error_eh_frame;
+	}
+
+	size_t name_len = strlen(name);
+	size_t strtab_len = name_len + 2;
+	size_t eh_frame_offset = sizeof(struct jit_image_header);
+	size_t strtab_offset = eh_frame_offset + eh_frame_len;
+	size_t image_len = strtab_offset + strtab_len;
+
+	struct dwarfw_jit_entry *entry =
+		calloc(1, sizeof(struct dwarfw_jit_entry) + image_len);
+	if (entry == NULL) {
+		goto error_eh_frame;
+	}
+	entry->image_len = image_len;
+
+	// Only addresses, sizes and bytes change between images
+	struct jit_image_header *header = (struct jit_image_header *)entry->image;
+	memcpy(header, &image_template, sizeof(image_template));
+
+	uint64_t eh_frame_addr = (uintptr_t)entry->image + eh_frame_offset;
+	header->shdrs[SECTION_TEXT].sh_addr = code;
+	header->shdrs[SECTION_TEXT].sh_size = code_size;
+	header->shdrs[SECTION_EH_FRAME].sh_addr = eh_frame_addr;
+	header->shdrs[SECTION_EH_FRAME].sh_size = eh_frame_len;
+	header->shdrs[SECTION_STRTAB].sh_offset = strtab_offset;
+	header->shdrs[SECTION_STRTAB].sh_size = strtab_len;
+	header->syms[1].st_value = code;
+	header->syms[1].st_size = code_size;
+
+	char *image_eh_frame = entry->image + eh_frame_offset;
+	memcpy(image_eh_frame, eh_frame, eh_frame_len);
+	for (size_t i = 0; i < fdes_len; ++i) {
+		if (!rela_apply(image_eh_frame, eh_frame_addr, &relas[i])) {
+			free(entry);
+			goto error_eh_frame;
+		}
+	}
+
+	memcpy(entry->image + strtab_offset + 1, name, name_len);
+
+	entry->code_entry.symfile_addr = entry->image;
+	entry->code_entry.symfile_size = image_len;
+
+	free(eh_frame);
+	free(relas);
+	return entry;
+
+error_eh_frame:
+	free(eh_frame);
+	free(relas);
+	return NULL;
+}
+
+const char *dwarfw_jit_entry_image(struct dwarfw_jit_entry *entry,
+		size_t *len) {
+	*len = entry->image_len;
+	return entry->image;
+}
+
+void dwarfw_jit_register(struct dwarfw_jit_entry *entry) {
+	if (entry->registered) {
+		return;
+	}
+
+	pthread_mutex_lock(&jit_mutex);
+	struct jit_code_entry *code_entry = &entry->code_entry;
+	code_entry->prev_entry = NULL;
+	code_entry->next_entry = __jit_debug_descriptor.first_entry;
+	if (code_entry->next_entry != NULL) {
+		code_entry->next_entry->prev_entry = code_entry;
+	}
+	__jit_debug_descriptor.first_entry = code_entry;
+	__jit_debug_descriptor.relevant_entry = code_entry;
+	__jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+	__jit_debug_register_code();
+	pthread_mutex_unlock(&jit_mutex);
+
+	entry->registered = true;
+}
+
+void dwarfw_jit_unregister(struct dwarfw_jit_entry *entry) {
+	if (!entry->registered) {
+		return;
+	}
+
+	pthread_mutex_lock(&jit_mutex);
+	struct jit_code_entry *code_entry = &entry->code_entry;
+	if (code_entry->prev_entry != NULL) {
+		code_entry->prev_entry->next_entry = code_entry->next_entry;
+	} else {
+		__jit_debug_descriptor.first_entry = code_entry->next_entry;
+	}
+	if (code_entry->next_entry != NULL) {
+		code_entry->next_entry->prev_entry = code_entry->prev_entry;
+	}
+	__jit_debug_descriptor.relevant_entry = code_entry;
+	__jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+	__jit_debug_register_code();
+	pthread_mutex_unlock(&jit_mutex);
+
+	entry->registered = false;
+}
+
+void dwarfw_jit_entry_destroy(struct dwarfw_jit_entry *entry) {
+	if (entry == NULL) {
+		return;
+	}
+	dwarfw_jit_unregister(entry);
+	free(entry);
+}
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarfw.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// See tools/perf/Documentation/jitdump-specification.txt in Linux
+#define JIT_CODE_UNWINDING_INFO 4
+
+#define EH_FRAME_ALIGN 8
+#define RECORD_ALIGN 8
+
+#define ENCODE_ATTEMPTS 3
+
+struct jr_prefix {
+	uint32_t id;
+	uint32_t total_size;
+	uint64_t timestamp;
+};
+
+struct jr_code_unwinding_info {
+	struct jr_prefix p;
+	uint64_t unwinding_size;
+	uint64_t eh_frame_hdr_size;
+	uint64_t mapped_size;
+};
+
+static size_t align(size_t size, size_t alignment) {
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+static bool scratch_reserve(struct dwarfw_jitdump_scratch *scratch,
+		size_t fdes_len) {
+	if (fdes_len <= scratch->fdes_cap) {
+		return true;
+	}
+
+	struct dwarfw_fde *fdes =
+		realloc(scratch->fdes, fdes_len * sizeof(*fdes));
+	if (fdes == NULL) {
+		return false;
+	}
+	scratch->fdes = fdes;
+	size_t *fde_offsets =
+		realloc(scratch->fde_offsets, fdes_len * sizeof(*fde_offsets));
+	if (fde_offsets == NULL) {
+		return false;
+	}
+	scratch->fde_offsets = fde_offsets;
+	struct dwarfw_eh_frame_hdr_entry *entries =
+		realloc(scratch->entries, fdes_len * sizeof(*entries));
+	if (entries == NULL) {
+		return false;
+	}
+	scratch->entries = entries;
+
+	scratch->fdes_cap = fdes_len;
+	return true;
+}
+
+// Writes .eh_frame, its terminator and .eh_frame_hdr for code at address 0,
+// with .eh_frame placed right after the code as perf expects
+static size_t unwinding_data_write(struct dwarfw_jitdump_scratch *scratch,
+		uint64_t code_size, size_t fdes_len, size_t *eh_frame_hdr_len,
+		FILE *f) {
+	size_t n, written = 0;
+
+	uint64_t eh_frame_addr = align(code_size, EH_FRAME_ALIGN);
+	for (size_t i = 0; i < fdes_len; ++i) {
+		scratch->fdes[i].initial_location -= eh_frame_addr;
+	}
+
+	if (!(n = dwarfw_eh_frame_write(scratch->fdes, fdes_len, NULL,
+			scratch->fde_offsets, NULL, f))) {
+		return 0;
+	}
+	written += n;
+
+	uint32_t terminator = 0;
+	if (!(n = fwrite(&terminator, 1, sizeof(terminator), f))) {
+		return 0;
+	}
+	written += n;
+
+	// Everything in .eh_frame_hdr is relative to its start, which follows
+	// .eh_frame
+	long long int hdr_offset = written;
+	for (size_t i = 0; i < fdes_len; ++i) {
+		scratch->entries[i].initial_location =
+			scratch->fdes[i].initial_location - hdr_offset;
+		scratch->entries[i].fde = scratch->fde_offsets[i] - hdr_offset;
+	}
+
+	if (!(n = dwarfw_eh_frame_hdr_write(-hdr_offset, scratch->entries,
+			fdes_len, f))) {
+		return 0;
+	}
+	written += n;
+	*eh_frame_hdr_len = n;
+
+	return written;
+}
+
+static bool scratch_buf_reserve(struct dwarfw_jitdump_scratch *scratch,
+		size_t cap) {
+	if (cap <= scratch->buf_cap) {
+		return true;
+	}
+	char *buf = realloc(scratch->buf, cap);
+	if (buf == NULL) {
+		return false;
+	}
+	scratch->buf = buf;
+	scratch->buf_cap = cap;
+	return true;
+}
+
+// Encodes the unwinding data in the scratch buffer. Its size is known
+// upfront, except with LEB128 pointer encodings where the buffer is grown a
+// few times if it turns out too small.
+static size_t unwinding_data_encode(struct dwarfw_jitdump_scratch *scratch,
+		uint64_t code_size, struct dwarfw_fde *fdes, size_t fdes_len,
+		size_t *eh_frame_hdr_len) {
+	size_t eh_frame_len = dwarfw_eh_frame_size(fdes, fdes_len);
+	if (eh_frame_len == 0) {
+		return 0;
+	}
+	// The terminator, and fmemopen needs room for a trailing null byte
+	size_t cap = eh_frame_len + sizeof(uint32_t) +
+		dwarfw_eh_frame_hdr_size(fdes_len) + 1;
+
+	for (int i = 0; i < ENCODE_ATTEMPTS; ++i, cap *= 2) {
+		if (!scratch_buf_reserve(scratch, cap)) {
+			return 0;
+		}
+		memcpy(scratch->fdes, fdes, fdes_len * sizeof(*fdes));
+
+		FILE *f = fmemopen(scratch->buf, scratch->buf_cap, "w");
+		if (f == NULL) {
+			return 0;
+		}
+		// Errors must show up in the writers, not when closing
+		setvbuf(f, NULL, _IONBF, 0);
+		errno = 0;
+		size_t n = unwinding_data_write(scratch, code_size, fdes_len,
+			eh_frame_hdr_len, f);
+		bool full = ferror(f) && errno == ENOSPC;
+		fclose(f);
+		if (n > 0) {
+			return n;
+		} else if (!full) {
+			return 0;
+		}
+	}
+	return 0;
+}
+
+size_t dwarfw_jitdump_unwinding_info_write(
+		struct dwarfw_jitdump_scratch *scratch, uint64_t code_size,
+		struct dwarfw_fde *fdes, size_t fdes_len, uint64_t timestamp,
+		FILE *f) {
+	size_t n, written = 0;
+
+	if (!scratch_reserve(scratch, fdes_len)) {
+		return 0;
+	}
+
+	size_t eh_frame_hdr_len = 0;
+	size_t unwinding_len = unwinding_data_encode(scratch, code_size, fdes,
+		fdes_len, &eh_frame_hdr_len);
+	if (unwinding_len == 0) {
+		return 0;
+	}
+	for (size_t i = 0; i < fdes_len; ++i) {
+		fdes[i].cie_pointer = scratch->fdes[i].cie_pointer;
+	}
+
+	size_t content_len = sizeof(struct jr_code_unwinding_info) + unwinding_len;
+	size_t total_len = align(content_len, RECORD_ALIGN);
+	if (total_len > UINT32_MAX) {
+		return 0;
+	}
+
+	struct jr_code_unwinding_info record = {
+		.p = {
+			.id = JIT_CODE_UNWINDING_INFO,
+			.total_size = total_len,
+			.timestamp = timestamp,
+		},
+		.unwinding_size = unwinding_len,
+		.eh_frame_hdr_size = eh_frame_hdr_len,
+		.mapped_size = unwinding_len,
+	};
+	if (!(n = fwrite(&record, 1, sizeof(record), f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = fwrite(scratch->buf, 1, unwinding_len, f))) {
+		return 0;
+	}
+	written += n;
+
+	static const char padding[RECORD_ALIGN] = {0};
+	if (total_len > content_len) {
+		if (!(n = fwrite(padding, 1, total_len - content_len, f))) {
+			return 0;
+		}
+		written += n;
+	}
+
+	return written;
+}
+
+void dwarfw_jitdump_scratch_finish(struct dwarfw_jitdump_scratch *scratch) {
+	free(scratch->buf);
+	free(scratch->fdes);
+	free(scratch->fde_offsets);
+	free(scratch->entries);
+	memset(scratch, 0, sizeof(*scratch));
+}
@@ -0,0 +1,394 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "pointer.h"
+#include "write.h"
+
+// Encoded .eh_frame of a single function: its CIE, its FDE and a terminator
+struct lazy_fragment {
+	struct lazy_fragment *next;
+	uint64_t location; // key in the fragments table
+	size_t fde_offset;
+	char data[];
+};
+
+struct dwarfw_lazy {
+	pthread_mutex_t mutex;
+
+	struct dwarfw_cie *cies;
+	size_t cies_len;
+
+	// Sorted by location
+	struct dwarfw_lazy_function *functions;
+	size_t functions_len, functions_cap;
+
+	// Fragments which have been looked up, by function location. There is room
+	// for one per function.
+	struct hash_table fragments;
+	struct lazy_fragment *fragments_list;
+
+	// Reserved storage for the fragments created by dwarfw_lazy_find_fde, and
+	// scratch space for their instructions. The streams are unbuffered, so that
+	// writing to them doesn't allocate.
+	char *reserved, *reserved_insns;
+	size_t reserved_len;
+	FILE *reserved_f, *reserved_insns_f;
+};
+
+struct dwarfw_lazy *dwarfw_lazy_create(const struct dwarfw_cie *cies,
+		size_t cies_len) {
+	struct dwarfw_lazy *lazy = calloc(1, sizeof(struct dwarfw_lazy));
+	if (lazy == NULL) {
+		return NULL;
+	}
+	lazy->cies = malloc(cies_len * sizeof(struct dwarfw_cie));
+	if (lazy->cies == NULL) {
+		free(lazy);
+		return NULL;
+	}
+	memcpy(lazy->cies, cies, cies_len * sizeof(struct dwarfw_cie));
+	lazy->cies_len = cies_len;
+	pthread_mutex_init(&lazy->mutex, NULL);
+	return lazy;
+}
+
+static void reserved_finish(struct dwarfw_lazy *lazy) {
+	if (lazy->reserved_f != NULL) {
+		fclose(lazy->reserved_f);
+	}
+	if (lazy->reserved_insns_f != NULL) {
+		fclose(lazy->reserved_insns_f);
+	}
+	free(lazy->reserved);
+	free(lazy->reserved_insns);
+	lazy->reserved = lazy->reserved_insns = NULL;
+	lazy->reserved_f = lazy->reserved_insns_f = NULL;
+}
+
+void dwarfw_lazy_destroy(struct dwarfw_lazy *lazy) {
+	if (lazy == NULL) {
+		return;
+	}
+	reserved_finish(lazy);
+	struct lazy_fragment *fragment = lazy->fragments_list;
+	while (fragment != NULL) {
+		struct lazy_fragment *next = fragment->next;
+		free(fragment);
+		fragment = next;
+	}
+	hash_table_finish(&lazy->fragments);
+	pthread_mutex_destroy(&lazy->mutex);
+	free(lazy->functions);
+	free(lazy->cies);
+	free(lazy);
+}
+
+static int function_cmp(const void *a, const void *b) {
+	const struct dwarfw_lazy_function *fa = a, *fb = b;
+	return (fa->location > fb->location) - (fa->location < fb->location);
+}
+
+bool dwarfw_lazy_add(struct dwarfw_lazy *lazy,
+		const struct dwarfw_lazy_function *functions, size_t functions_len) {
+	for (size_t i = 0; i < functions_len; ++i) {
+		if (functions[i].cie >= lazy->cies_len) {
+			return false;
+		}
+	}
+
+	pthread_mutex_lock(&lazy->mutex);
+
+	// Lookups must not allocate entries in the fragments table
+	if (!hash_table_reserve(&lazy->fragments,
+			lazy->functions_len + functions_len)) {
+		pthread_mutex_unlock(&lazy->mutex);
+		return false;
+	}
+
+	if (lazy->functions_cap - lazy->functions_len < functions_len) {
+		size_t cap = lazy->functions_cap == 0 ? 64 : 2 * lazy->functions_cap;
+		while (cap - lazy->functions_len < functions_len) {
+			cap *= 2;
+		}
+		struct dwarfw_lazy_function *new_functions = realloc(lazy->functions,
+			cap * sizeof(struct dwarfw_lazy_function));
+		if (new_functions == NULL) {
+			pthread_mutex_unlock(&lazy->mutex);
+			return false;
+		}
+		lazy->functions = new_functions;
+		lazy->functions_cap = cap;
+	}
+
+	// Functions added in order don't need to be sorted again
+	bool sorted = true;
+	uint64_t last = lazy->functions_len > 0 ?
+		lazy->functions[lazy->functions_len - 1].location : 0;
+	for (size_t i = 0; i < functions_len; ++i) {
+		if (functions[i].location < last) {
+			sorted = false;
+		}
+		last = functions[i].location;
+	}
+	memcpy(&lazy->functions[lazy->functions_len], functions,
+		functions_len * sizeof(struct dwarfw_lazy_function));
+	lazy->functions_len += functions_len;
+
+	// Sort here rather than in lookups, qsort can allocate
+	if (!sorted) {
+		qsort(lazy->functions, lazy->functions_len,
+			sizeof(struct dwarfw_lazy_function), function_cmp);
+	}
+
+	pthread_mutex_unlock(&lazy->mutex);
+	return true;
+}
+
+bool dwarfw_lazy_reserve(struct dwarfw_lazy *lazy, size_t size) {
+	bool ok = false;
+	pthread_mutex_lock(&lazy->mutex);
+
+	if (lazy->reserved != NULL || size == 0) {
+		goto out;
+	}
+	lazy->reserved = malloc(size);
+	lazy->reserved_insns = malloc(size);
+	if (lazy->reserved == NULL || lazy->reserved_insns == NULL) {
+		goto error;
+	}
+	lazy->reserved_f = fmemopen(lazy->reserved, size, "w");
+	lazy->reserved_insns_f = fmemopen(lazy->reserved_insns, size, "w");
+	if (lazy->reserved_f == NULL || lazy->reserved_insns_f == NULL) {
+		goto error;
+	}
+	if (setvbuf(lazy->reserved_f, NULL, _IONBF, 0) != 0 ||
+			setvbuf(lazy->reserved_insns_f, NULL, _IONBF, 0) != 0) {
+		goto error;
+	}
+	lazy->reserved_len = 0;
+	ok = true;
+	goto out;
+
+error:
+	reserved_finish(lazy);
+out:
+	pthread_mutex_unlock(&lazy->mutex);
+	return ok;
+}
+
+static const struct dwarfw_lazy_function *find_function(
+		struct dwarfw_lazy *lazy, uint64_t pc) {
+	// Find the first function starting after pc
+	size_t lo = 0, hi = lazy->functions_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (lazy->functions[mid].location <= pc) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return NULL;
+	}
+	const struct dwarfw_lazy_function *function = &lazy->functions[lo - 1];
+	if (pc - function->location >= function->range) {
+		return NULL;
+	}
+	return function;
+}
+
+static size_t fragment_write(struct dwarfw_cie *cie, struct dwarfw_fde *fde,
+		uint64_t location, size_t *fde_offset, FILE *f) {
+	size_t n, written = 0;
+
+	// Fragments are allocated on the heap, which can be too far away from
+	// the code for relative pointers: use absolute ones
+	struct dwarfw_cie local_cie = *cie;
+	local_cie.augmentation_data.pointer_encoding =
+		DW_EH_PE_absptr | DW_EH_PE_udata8;
+	if (pointer_is_relative(cie->augmentation_data.personality_encoding)) {
+		local_cie.augmentation_data.personality_encoding =
+			DW_EH_PE_absptr | DW_EH_PE_udata8;
+	}
+	if (!(n = dwarfw_cie_write(&local_cie, f))) {
+		return 0;
+	}
+	written += n;
+
+	fde->cie = &local_cie;
+	fde->cie_pointer = written;
+	fde->initial_location = location;
+	*fde_offset = written;
+	if (!(n = dwarfw_fde_write(fde, NULL, f))) {
+		return 0;
+	}
+	written += n;
+
+	if (!(n = write_u32(0, f))) {
+		return 0;
+	}
+	written += n;
+
+	return written;
+}
+
+static struct lazy_fragment *fragment_create(struct dwarfw_lazy *lazy,
+		const struct dwarfw_lazy_function *function) {
+	struct dwarfw_cie *cie = &lazy->cies[function->cie];
+
+	char *insns;
+	size_t insns_len;
+	FILE *insns_f = open_memstream(&insns, &insns_len);
+	if (insns_f == NULL) {
+		return NULL;
+	}
+	bool ok = dwarfw_unwind_rows_write(cie, function->rows, function->rows_len,
+		insns_f);
+	fclose(insns_f);
+	if (!ok) {
+		free(insns);
+		return NULL;
+	}
+
+	struct dwarfw_fde fde = {
+		.address_range = function->range,
+		.instructions_length = insns_len,
+		.instructions = insns,
+	};
+
+	struct lazy_fragment *fragment = NULL;
+	char *buf;
+	size_t buf_len, fde_offset;
+	FILE *f = open_memstream(&buf, &buf_len);
+	if (f == NULL) {
+		free(insns);
+		return NULL;
+	}
+	size_t len = fragment_write(cie, &fde, function->location, &fde_offset, f);
+	fclose(f);
+	free(insns);
+
+	if (len > 0) {
+		fragment = malloc(sizeof(struct lazy_fragment) + len);
+	}
+	if (fragment != NULL) {
+		fragment->location = function->location;
+		fragment->fde_offset = fde_offset;
+		memcpy(fragment->data, buf, len);
+	}
+	free(buf);
+	return fragment;
+}
+
+// Creates a fragment in the reserved storage, without allocating. Returns NULL
+// if there is no reserved storage or the fragment doesn't fit.
+static struct lazy_fragment *fragment_create_reserved(struct dwarfw_lazy *lazy,
+		const struct dwarfw_lazy_function *function) {
+	if (lazy->reserved == NULL) {
+		return NULL;
+	}
+	struct dwarfw_cie *cie = &lazy->cies[function->cie];
+
+	FILE *insns_f = lazy->reserved_insns_f;
+	rewind(insns_f);
+	if (!dwarfw_unwind_rows_write(cie, function->rows, function->rows_len,
+			insns_f) || ferror(insns_f)) {
+		return NULL;
+	}
+
+	struct dwarfw_fde fde = {
+		.address_range = function->range,
+		.instructions_length = ftell(insns_f),
+		.instructions = lazy->reserved_insns,
+	};
+
+	// Fragments are laid out one after the other, each after its header
+	size_t align = _Alignof(struct lazy_fragment);
+	size_t start = (lazy->reserved_len + align - 1) & ~(align - 1);
+	FILE *f = lazy->reserved_f;
+	if (fseek(f, start + sizeof(struct lazy_fragment), SEEK_SET) != 0) {
+		return NULL;
+	}
+	size_t fde_offset;
+	size_t len = fragment_write(cie, &fde, function->location, &fde_offset, f);
+	if (len == 0 || ferror(f)) {
+		clearerr(f);
+		return NULL;
+	}
+
+	struct lazy_fragment *fragment =
+		(struct lazy_fragment *)(lazy->reserved + start);
+	fragment->next = NULL;
+	fragment->location = function->location;
+	fragment->fde_offset = fde_offset;
+	lazy->reserved_len = start + sizeof(struct lazy_fragment) + len;
+	return fragment;
+}
+
+// Must be called with the lock held. Fragments which haven't been looked up
+// yet are created in the reserved storage if reserved is true.
+static const void *lookup(struct dwarfw_lazy *lazy, uint64_t pc,
+		bool reserved, const void **eh_frame) {
+	const struct dwarfw_lazy_function *function = find_function(lazy, pc);
+	if (function == NULL) {
+		return NULL;
+	}
+
+	struct hash_entry *entry = hash_table_find(&lazy->fragments,
+		&function->location, sizeof(function->location));
+	struct lazy_fragment *fragment = entry != NULL ? entry->value : NULL;
+	if (fragment == NULL) {
+		if (reserved) {
+			fragment = fragment_create_reserved(lazy, function);
+		} else {
+			fragment = fragment_create(lazy, function);
+		}
+		if (fragment == NULL) {
+			return NULL;
+		}
+		// The key lives in the fragment, functions can move
+		entry = hash_table_insert(&lazy->fragments, &fragment->location,
+			sizeof(fragment->location));
+		if (entry == NULL) {
+			if (!reserved) {
+				free(fragment);
+			}
+			return NULL;
+		}
+		entry->value = fragment;
+		if (!reserved) {
+			fragment->next = lazy->fragments_list;
+			lazy->fragments_list = fragment;
+		}
+	}
+
+	if (eh_frame != NULL) {
+		*eh_frame = fragment->data;
+	}
+	return fragment->data + fragment->fde_offset;
+}
+
+const void *dwarfw_lazy_lookup(struct dwarfw_lazy *lazy, uint64_t pc,
+		const void **eh_frame) {
+	pthread_mutex_lock(&lazy->mutex);
+	const void *fde = lookup(lazy, pc, false, eh_frame);
+	pthread_mutex_unlock(&lazy->mutex);
+	return fde;
+}
+
+const void *dwarfw_lazy_find_fde(uint64_t pc, void *data) {
+	struct dwarfw_lazy *lazy = data;
+	// Don't wait for the lock, its holder may be the code this interrupted
+	if (pthread_mutex_trylock(&lazy->mutex) != 0) {
+		return NULL;
+	}
+	const void *fde = lookup(lazy, pc, true, NULL);
+	pthread_mutex_unlock(&lazy->mutex);
+	return fde;
+}
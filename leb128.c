@@ -68,3 +68,60 @@ size_t leb128_write_s64(int64_t value, FILE *f, size_t pad_to) {
 
 	return count;
 }
+
+size_t leb128_length_u64(uint64_t value) {
+	size_t count = 1;
+	while (value >>= 7) {
+		++count;
+	}
+	return count;
+}
+
+size_t leb128_length_s64(int64_t value) {
+	size_t count = 1;
+	// Stop once the remaining bits are all copies of the sign bit
+	while (value < -64 || value > 63) {
+		// NOTE: this assumes that this signed shift is an arithmetic right shift
+		value >>= 7;
+		++count;
+	}
+	return count;
+}
+
+size_t leb128_read_u64(const char *buf, size_t len, uint64_t *value) {
+	uint64_t result = 0;
+	unsigned int shift = 0;
+	for (size_t i = 0; i < len; ++i) {
+		uint8_t b = buf[i];
+		if (shift < 64) {
+			result |= (uint64_t)(b & 0x7f) << shift;
+		}
+		shift += 7;
+		if ((b & 0x80) == 0) {
+			*value = result;
+			return i + 1;
+		}
+	}
+	return 0; // Truncated
+}
+
+size_t leb128_read_s64(const char *buf, size_t len, int64_t *value) {
+	uint64_t result = 0;
+	unsigned int shift = 0;
+	for (size_t i = 0; i < len; ++i) {
+		uint8_t b = buf[i];
+		if (shift < 64) {
+			result |= (uint64_t)(b & 0x7f) << shift;
+		}
+		shift += 7;
+		if ((b & 0x80) == 0) {
+			// Sign-extend
+			if (shift < 64 && (b & 0x40) != 0) {
+				result |= ~(uint64_t)0 << shift;
+			}
+			*value = result;
+			return i + 1;
+		}
+	}
+	return 0; // Truncated
+}
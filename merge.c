@@ -0,0 +1,543 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "pointer.h"
+#include "read.h"
+
+#define ARENA_CHUNK_SIZE 65536
+
+// Dedup keys must outlive the hash tables, they are allocated from chunks
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t len, cap;
+	char data[];
+};
+
+static void *arena_alloc(struct arena_chunk **arena, size_t size) {
+	struct arena_chunk *chunk = *arena;
+	if (chunk == NULL || chunk->cap - chunk->len < size) {
+		size_t cap = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		chunk = malloc(sizeof(struct arena_chunk) + cap);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->next = *arena;
+		chunk->len = 0;
+		chunk->cap = cap;
+		*arena = chunk;
+	}
+	void *ptr = chunk->data + chunk->len;
+	chunk->len += size;
+	return ptr;
+}
+
+static void arena_finish(struct arena_chunk **arena) {
+	struct arena_chunk *chunk = *arena;
+	while (chunk != NULL) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	*arena = NULL;
+}
+
+struct rela_key {
+	uint64_t r_offset; // relative to the start of the record
+	uint64_t r_info;
+	int64_t r_addend;
+};
+
+struct fde_key {
+	bool relocated;
+	uint64_t location; // absolute, or the relocation's symbol and type
+	int64_t addend;
+	uint64_t address_range;
+};
+
+// CIE of the current input, only written once an FDE references it
+struct input_cie {
+	size_t input_offset;
+	size_t len;
+	const GElf_Rela *relas;
+	size_t relas_len;
+
+	struct dwarfw_cie desc;
+	// Unrelocated relative personality, re-encoded for its new place
+	bool reencode;
+	long long int personality; // absolute
+
+	const char *key;
+	size_t key_len;
+
+	bool written;
+	size_t output_offset;
+};
+
+struct merge {
+	const struct dwarfw_eh_frame_input *input;
+	uint64_t address;
+	const struct dwarfw_eh_frame_live *live;
+	FILE *f;
+	size_t written;
+
+	struct arena_chunk *arena;
+	struct hash_table cies, fdes;
+
+	// CIEs of the current input, in input order
+	struct input_cie *input_cies;
+	size_t input_cies_len, input_cies_cap;
+
+	GElf_Rela *relas;
+	size_t relas_len, relas_cap;
+
+	// Relocations of the current input sorted by offset, and the first one
+	// which hasn't been consumed yet
+	GElf_Rela *input_relas;
+	size_t input_relas_next;
+};
+
+struct record {
+	size_t offset, len;
+	size_t length_length, cie_pointer_length;
+	uint64_t cie_pointer; // relative to the start of the record
+
+	// Relocations in this record
+	const GElf_Rela *relas;
+	size_t relas_len;
+};
+
+static int rela_cmp(const void *a, const void *b) {
+	const GElf_Rela *ra = a, *rb = b;
+	return (ra->r_offset > rb->r_offset) - (ra->r_offset < rb->r_offset);
+}
+
+static bool relas_push(struct merge *m, const GElf_Rela *rela,
+		size_t record_input_offset) {
+	if (m->relas_len == m->relas_cap) {
+		size_t cap = m->relas_cap == 0 ? 64 : 2 * m->relas_cap;
+		GElf_Rela *relas = realloc(m->relas, cap * sizeof(GElf_Rela));
+		if (relas == NULL) {
+			return false;
+		}
+		m->relas = relas;
+		m->relas_cap = cap;
+	}
+
+	GElf_Rela *out = &m->relas[m->relas_len++];
+	*out = *rela;
+	out->r_offset = m->written + (rela->r_offset - record_input_offset);
+	return true;
+}
+
+static bool output_write(struct merge *m, const void *buf, size_t len) {
+	if (len > 0 && fwrite(buf, 1, len, m->f) != len) {
+		return false;
+	}
+	m->written += len;
+	return true;
+}
+
+static bool cie_has_personality(struct dwarfw_cie *cie) {
+	return cie->augmentation[0] == 'z' &&
+		strchr(cie->augmentation, 'P') != NULL &&
+		cie->augmentation_data.personality_encoding != DW_EH_PE_omit;
+}
+
+// Key of a CIE with an absolute personality: the CIE written with it
+static const char *cie_personality_key(struct merge *m,
+		struct dwarfw_cie *cie, long long int personality, size_t *key_len) {
+	struct dwarfw_cie canonical = *cie;
+	canonical.augmentation_data.personality_encoding = DW_EH_PE_udata8;
+	canonical.augmentation_data.personality = personality;
+
+	char *buf;
+	FILE *f = open_memstream(&buf, key_len);
+	if (f == NULL) {
+		return NULL;
+	}
+	size_t n = dwarfw_cie_write(&canonical, f);
+	fclose(f);
+
+	char *key = NULL;
+	if (n > 0 && (key = arena_alloc(&m->arena, *key_len)) != NULL) {
+		memcpy(key, buf, *key_len);
+	}
+	free(buf);
+	return key;
+}
+
+static bool merge_cie(struct merge *m, struct record *rec) {
+	const char *buf = m->input->buf + rec->offset;
+
+	struct dwarfw_cie desc;
+	if (!dwarfw_cie_read(buf, rec->len, &desc)) {
+		return false;
+	}
+	bool reencode = rec->relas_len == 0 && cie_has_personality(&desc) &&
+		pointer_is_relative(desc.augmentation_data.personality_encoding);
+	long long int personality = desc.augmentation_data.personality +
+		m->input->address + rec->offset;
+
+	// The key is the record itself plus its relocations (e.g. personality)
+	size_t key_len = rec->len + rec->relas_len * sizeof(struct rela_key);
+	const char *key = buf;
+	if (reencode) {
+		if (!(key = cie_personality_key(m, &desc, personality, &key_len))) {
+			return false;
+		}
+	} else if (rec->relas_len > 0) {
+		char *key_buf = arena_alloc(&m->arena, key_len);
+		if (key_buf == NULL) {
+			return false;
+		}
+		memcpy(key_buf, buf, rec->len);
+		struct rela_key *rela_keys = (struct rela_key *)(key_buf + rec->len);
+		for (size_t i = 0; i < rec->relas_len; ++i) {
+			struct rela_key rk = {
+				.r_offset = rec->relas[i].r_offset - rec->offset,
+				.r_info = rec->relas[i].r_info,
+				.r_addend = rec->relas[i].r_addend,
+			};
+			memcpy(&rela_keys[i], &rk, sizeof(rk));
+		}
+		key = key_buf;
+	}
+
+	if (m->input_cies_len == m->input_cies_cap) {
+		size_t cap = m->input_cies_cap == 0 ? 8 : 2 * m->input_cies_cap;
+		struct input_cie *cies =
+			realloc(m->input_cies, cap * sizeof(struct input_cie));
+		if (cies == NULL) {
+			return false;
+		}
+		m->input_cies = cies;
+		m->input_cies_cap = cap;
+	}
+	m->input_cies[m->input_cies_len++] = (struct input_cie){
+		.input_offset = rec->offset,
+		.len = rec->len,
+		.relas = rec->relas,
+		.relas_len = rec->relas_len,
+		.desc = desc,
+		.reencode = reencode,
+		.personality = personality,
+		.key = key,
+		.key_len = key_len,
+	};
+
+	return true;
+}
+
+static bool write_cie(struct merge *m, struct input_cie *cie) {
+	struct hash_entry *entry =
+		hash_table_insert(&m->cies, cie->key, cie->key_len);
+	if (entry == NULL) {
+		return false;
+	}
+	if (entry->value == NULL) {
+		// Store offset + 1 so that it can't be confused with a new entry
+		entry->value = (void *)(uintptr_t)(m->written + 1);
+		if (cie->reencode) {
+			struct dwarfw_cie local = cie->desc;
+			local.augmentation_data.personality =
+				cie->personality - (m->address + m->written);
+			size_t n = dwarfw_cie_write(&local, m->f);
+			if (n == 0) {
+				return false;
+			}
+			m->written += n;
+		} else {
+			for (size_t i = 0; i < cie->relas_len; ++i) {
+				if (!relas_push(m, &cie->relas[i], cie->input_offset)) {
+					return false;
+				}
+			}
+			if (!output_write(m, m->input->buf + cie->input_offset,
+					cie->len)) {
+				return false;
+			}
+		}
+	}
+
+	cie->written = true;
+	cie->output_offset = (uintptr_t)entry->value - 1;
+	return true;
+}
+
+static struct input_cie *find_input_cie(struct merge *m,
+		size_t input_offset) {
+	size_t lo = 0, hi = m->input_cies_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (m->input_cies[mid].input_offset < input_offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == m->input_cies_len ||
+			m->input_cies[lo].input_offset != input_offset) {
+		return NULL;
+	}
+	return &m->input_cies[lo];
+}
+
+static bool is_live(const struct dwarfw_eh_frame_live *live,
+		const GElf_Rela *location_rela, uint64_t location,
+		uint64_t address_range) {
+	if (location_rela != NULL) {
+		if (live->symbols == NULL) {
+			return true;
+		}
+		uint64_t sym = GELF_R_SYM(location_rela->r_info);
+		return sym < live->symbols_len &&
+			(live->symbols[sym / 8] & (1 << (sym % 8)));
+	}
+
+	if (live->ranges == NULL) {
+		return true;
+	}
+
+	// Find the first range ending after the location
+	size_t lo = 0, hi = live->ranges_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (live->ranges[mid].end <= location) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo < live->ranges_len &&
+		live->ranges[lo].start < location + address_range;
+}
+
+static bool merge_fde(struct merge *m, struct record *rec) {
+	const char *buf = m->input->buf + rec->offset;
+	if (rec->cie_pointer > rec->offset) {
+		return false;
+	}
+	size_t cie_input_offset = rec->offset - rec->cie_pointer;
+	struct input_cie *cie = find_input_cie(m, cie_input_offset);
+	if (cie == NULL) {
+		return false;
+	}
+
+	struct dwarfw_fde fde;
+	if (!dwarfw_fde_read(buf, rec->len, &cie->desc, &fde)) {
+		return false;
+	}
+	uint8_t ptr_enc = cie->desc.augmentation_data.pointer_encoding;
+
+	size_t location_offset = rec->length_length + rec->cie_pointer_length;
+	const GElf_Rela *location_rela = NULL;
+	for (size_t i = 0; i < rec->relas_len; ++i) {
+		if (rec->relas[i].r_offset == rec->offset + location_offset) {
+			location_rela = &rec->relas[i];
+		}
+	}
+
+	// Absolute location, unless it's relocated
+	uint64_t location = fde.initial_location;
+	if (location_rela == NULL && pointer_is_relative(ptr_enc)) {
+		location += m->input->address + rec->offset;
+	}
+
+	if (m->live != NULL && !is_live(m->live, location_rela, location,
+			fde.address_range)) {
+		return true;
+	}
+
+	struct fde_key *key = arena_alloc(&m->arena, sizeof(struct fde_key));
+	if (key == NULL) {
+		return false;
+	}
+	memset(key, 0, sizeof(*key));
+	key->relocated = location_rela != NULL;
+	key->location = location_rela != NULL ? location_rela->r_info : location;
+	key->addend = location_rela != NULL ? location_rela->r_addend : 0;
+	key->address_range = fde.address_range;
+
+	struct hash_entry *entry = hash_table_insert(&m->fdes, key, sizeof(*key));
+	if (entry == NULL) {
+		return false;
+	}
+	if (entry->value != NULL) {
+		return true; // Duplicate FDE, drop it
+	}
+	entry->value = key;
+
+	if (!cie->written && !write_cie(m, cie)) {
+		return false;
+	}
+
+	// Unrelocated relative LSDAs are re-encoded along with the whole FDE
+	uint8_t lsda_enc = cie->desc.augmentation_data.lsda_encoding;
+	if (rec->relas_len == 0 && fde.has_lsda && pointer_is_relative(lsda_enc)) {
+		long long int delta =
+			m->input->address + rec->offset - (m->address + m->written);
+		fde.cie_pointer = m->written - cie->output_offset;
+		fde.lsda += delta;
+		if (pointer_is_relative(ptr_enc)) {
+			fde.initial_location += delta;
+		}
+		size_t n = dwarfw_fde_write(&fde, NULL, m->f);
+		if (n == 0) {
+			return false;
+		}
+		m->written += n;
+		return true;
+	}
+
+	for (size_t i = 0; i < rec->relas_len; ++i) {
+		if (!relas_push(m, &rec->relas[i], rec->offset)) {
+			return false;
+		}
+	}
+
+	size_t fde_offset = m->written;
+
+	// Length, unchanged
+	if (!output_write(m, buf, rec->length_length)) {
+		return false;
+	}
+
+	// The CIE pointer is relative to the place it's written
+	uint64_t cie_pointer = fde_offset + rec->length_length - cie->output_offset;
+	if (rec->cie_pointer_length == sizeof(uint32_t)) {
+		uint32_t cie_pointer_u32 = cie_pointer;
+		if (!output_write(m, &cie_pointer_u32, sizeof(cie_pointer_u32))) {
+			return false;
+		}
+	} else {
+		if (!output_write(m, &cie_pointer, sizeof(cie_pointer))) {
+			return false;
+		}
+	}
+
+	// Re-encode pc-relative locations for their new place
+	size_t rest = location_offset;
+	if (location_rela == NULL && pointer_is_relative(ptr_enc)) {
+		long long int unused;
+		size_t field_len = pointer_read(buf + location_offset,
+			rec->len - location_offset, ptr_enc, 0, &unused);
+		size_t n = pointer_write(location - (m->address + fde_offset), ptr_enc,
+			location_offset, m->f);
+		if (n != field_len) {
+			return false; // Variable-length encoding changed size
+		}
+		m->written += n;
+		rest += n;
+	}
+
+	return output_write(m, buf + rest, rec->len - rest);
+}
+
+static bool merge_input(struct merge *m) {
+	const struct dwarfw_eh_frame_input *input = m->input;
+
+	m->input_cies_len = 0;
+	m->input_relas_next = 0;
+	free(m->input_relas);
+	m->input_relas = NULL;
+	if (input->relas_len > 0) {
+		m->input_relas = malloc(input->relas_len * sizeof(GElf_Rela));
+		if (m->input_relas == NULL) {
+			return false;
+		}
+		memcpy(m->input_relas, input->relas,
+			input->relas_len * sizeof(GElf_Rela));
+		qsort(m->input_relas, input->relas_len, sizeof(GElf_Rela), rela_cmp);
+	}
+
+	size_t offset = 0;
+	while (input->len - offset >= sizeof(uint32_t)) {
+		struct record rec = { .offset = offset };
+
+		uint32_t length_u32;
+		read_u32(input->buf + offset, input->len - offset, &length_u32);
+		if (length_u32 == 0) {
+			break; // Terminator
+		}
+		bool extended = length_u32 == 0xFFFFFFFF;
+		rec.length_length = extended ? 3 * sizeof(uint32_t) : sizeof(uint32_t);
+		rec.cie_pointer_length = extended ? sizeof(uint64_t) : sizeof(uint32_t);
+
+		rec.len = dwarfw_record_read(input->buf + offset, input->len - offset,
+			&rec.cie_pointer);
+		if (rec.len == 0) {
+			return false;
+		}
+
+		// Relocations are sorted, so this is linear for the whole input
+		const GElf_Rela *relas = m->input_relas;
+		while (m->input_relas_next < input->relas_len &&
+				relas[m->input_relas_next].r_offset < offset) {
+			++m->input_relas_next;
+		}
+		rec.relas = &relas[m->input_relas_next];
+		while (m->input_relas_next < input->relas_len &&
+				relas[m->input_relas_next].r_offset < offset + rec.len) {
+			++m->input_relas_next;
+			++rec.relas_len;
+		}
+
+		bool ok = rec.cie_pointer == 0 ? merge_cie(m, &rec) : merge_fde(m, &rec);
+		if (!ok) {
+			return false;
+		}
+
+		offset += rec.len;
+	}
+
+	return true;
+}
+
+static bool merge(const struct dwarfw_eh_frame_input *inputs,
+		size_t inputs_len, uint64_t address,
+		const struct dwarfw_eh_frame_live *live, GElf_Rela **relas,
+		size_t *relas_len, size_t *len, FILE *f) {
+	struct merge m = {
+		.address = address,
+		.live = live,
+		.f = f,
+	};
+
+	bool ok = true;
+	for (size_t i = 0; i < inputs_len && ok; ++i) {
+		m.input = &inputs[i];
+		ok = merge_input(&m);
+	}
+
+	hash_table_finish(&m.cies);
+	hash_table_finish(&m.fdes);
+	arena_finish(&m.arena);
+	free(m.input_cies);
+	free(m.input_relas);
+
+	if (!ok) {
+		free(m.relas);
+		return false;
+	}
+
+	*relas = m.relas;
+	*relas_len = m.relas_len;
+	*len = m.written;
+	return true;
+}
+
+bool dwarfw_eh_frame_merge(const struct dwarfw_eh_frame_input *inputs,
+		size_t inputs_len, uint64_t address, GElf_Rela **relas,
+		size_t *relas_len, size_t *len, FILE *f) {
+	return merge(inputs, inputs_len, address, NULL, relas, relas_len, len, f);
+}
+
+bool dwarfw_eh_frame_gc(const struct dwarfw_eh_frame_input *input,
+		const struct dwarfw_eh_frame_live *live, GElf_Rela **relas,
+		size_t *relas_len, size_t *len, FILE *f) {
+	return merge(input, 1, input->address, live, relas, relas_len, len, f);
+}
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <dwarfw.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct mapping {
+	char *base; // page-aligned
+	size_t base_len;
+	char *data;
+	size_t len, pos;
+};
+
+static ssize_t mapping_write(void *data, const char *buf, size_t len) {
+	struct mapping *m = data;
+	if (len > m->len - m->pos) {
+		return -1; // The output was sized too small
+	}
+	memcpy(m->data + m->pos, buf, len);
+	m->pos += len;
+	return len;
+}
+
+static int mapping_seek(void *data, off64_t *offset, int whence) {
+	struct mapping *m = data;
+
+	off64_t pos;
+	switch (whence) {
+	case SEEK_SET:
+		pos = *offset;
+		break;
+	case SEEK_CUR:
+		pos = m->pos + *offset;
+		break;
+	case SEEK_END:
+		pos = m->len + *offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < 0 || (size_t)pos > m->len) {
+		return -1;
+	}
+
+	m->pos = pos;
+	*offset = pos;
+	return 0;
+}
+
+static int mapping_close(void *data) {
+	struct mapping *m = data;
+	int ret = munmap(m->base, m->base_len);
+	free(m);
+	return ret;
+}
+
+FILE *dwarfw_mmap_open(int fd, uint64_t offset, size_t size, char **data) {
+	if (size == 0) {
+		return NULL;
+	}
+	if (posix_fallocate(fd, offset, size) != 0) {
+		return NULL;
+	}
+
+	struct mapping *m = calloc(1, sizeof(struct mapping));
+	if (m == NULL) {
+		return NULL;
+	}
+
+	// Mappings start at a page boundary
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	uint64_t base_offset = offset & ~(page_size - 1);
+	m->base_len = size + (offset - base_offset);
+	m->base = mmap(NULL, m->base_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		base_offset);
+	if (m->base == MAP_FAILED) {
+		free(m);
+		return NULL;
+	}
+	m->data = m->base + (offset - base_offset);
+	m->len = size;
+
+	cookie_io_functions_t funcs = {
+		.write = mapping_write,
+		.seek = mapping_seek,
+		.close = mapping_close,
+	};
+	FILE *f = fopencookie(m, "w", funcs);
+	if (f == NULL) {
+		munmap(m->base, m->base_len);
+		free(m);
+		return NULL;
+	}
+	// Writes go straight to the mapping
+	setvbuf(f, NULL, _IONBF, 0);
+
+	if (data != NULL) {
+		*data = m->data;
+	}
+	return f;
+}
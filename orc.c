@@ -0,0 +1,174 @@
+#include <dwarfw.h>
+#include <string.h>
+
+// DWARF register numbers for x86_64
+#define REG_FP 6
+#define REG_SP 7
+
+// The return address is pushed by the call instruction
+#define RA_OFFSET -8
+
+static bool fits_s16(long long int value) {
+	return value >= INT16_MIN && value <= INT16_MAX;
+}
+
+static void row_to_entry(const struct dwarfw_unwind_row *row,
+		struct dwarfw_orc_entry *entry) {
+	memset(entry, 0, sizeof(*entry));
+
+	uint8_t cfa_register;
+	switch (row->cfa_register) {
+	case REG_SP:
+		cfa_register = DWARFW_ORC_REG_SP;
+		break;
+	case REG_FP:
+		cfa_register = DWARFW_ORC_REG_FP;
+		break;
+	default:
+		return;
+	}
+
+	if (row->ra_offset != 0 && row->ra_offset != RA_OFFSET) {
+		return;
+	}
+	if (!fits_s16(row->cfa_offset) || !fits_s16(row->fp_offset)) {
+		return;
+	}
+
+	entry->cfa_register = cfa_register;
+	entry->cfa_offset = row->cfa_offset;
+	entry->fp_offset = row->fp_offset;
+	entry->type = DWARFW_ORC_TYPE_CALL;
+}
+
+static size_t entry_write(uint64_t ip, uint64_t base,
+		const struct dwarfw_orc_entry *entry, FILE *ip_f, FILE *entries_f) {
+	if (ip < base || ip - base > UINT32_MAX) {
+		return 0;
+	}
+	uint32_t ip_u32 = ip - base;
+
+	if (!fwrite(&ip_u32, sizeof(ip_u32), 1, ip_f)) {
+		return 0;
+	}
+	if (!fwrite(entry, sizeof(*entry), 1, entries_f)) {
+		return 0;
+	}
+	return 1;
+}
+
+size_t dwarfw_orc_write(const struct dwarfw_unwind_function *functions,
+		size_t functions_len, uint64_t base, FILE *ip_f, FILE *entries_f) {
+	size_t written = 0;
+
+	const struct dwarfw_orc_entry undefined = {0};
+	for (size_t i = 0; i < functions_len; ++i) {
+		const struct dwarfw_unwind_function *func = &functions[i];
+		if (i > 0 && func->location < functions[i - 1].location) {
+			return 0;
+		}
+
+		// The previous function's last entry mustn't cover the start of this
+		// one
+		bool has_prev = func->rows_len == 0 || func->rows[0].offset > 0;
+		if (has_prev) {
+			if (!entry_write(func->location, base, &undefined, ip_f,
+					entries_f)) {
+				return 0;
+			}
+			++written;
+		}
+
+		// Identical consecutive rows only need one entry
+		struct dwarfw_orc_entry prev = undefined;
+		for (size_t j = 0; j < func->rows_len; ++j) {
+			const struct dwarfw_unwind_row *row = &func->rows[j];
+			if (row->offset >= func->range) {
+				break;
+			}
+
+			struct dwarfw_orc_entry entry;
+			row_to_entry(row, &entry);
+			if (has_prev && memcmp(&entry, &prev, sizeof(entry)) == 0) {
+				continue;
+			}
+			prev = entry;
+			has_prev = true;
+
+			if (!entry_write(func->location + row->offset, base, &entry, ip_f,
+					entries_f)) {
+				return 0;
+			}
+			++written;
+		}
+
+		// Terminate the function unless the next one starts right after it
+		uint64_t end = func->location + func->range;
+		if (i + 1 == functions_len || functions[i + 1].location > end) {
+			if (!entry_write(end, base, &undefined, ip_f, entries_f)) {
+				return 0;
+			}
+			++written;
+		}
+	}
+
+	return written;
+}
+
+const struct dwarfw_orc_entry *dwarfw_orc_lookup(
+		const struct dwarfw_orc_table *table, uint64_t ip) {
+	if (ip < table->base || ip - table->base > UINT32_MAX) {
+		return NULL;
+	}
+	uint32_t ip_u32 = ip - table->base;
+
+	// Find the last entry whose ip is <= ip
+	size_t lo = 0, hi = table->length;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (table->ip[mid] <= ip_u32) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo > 0 ? &table->entries[lo - 1] : NULL;
+}
+
+bool dwarfw_orc_unwind(const struct dwarfw_orc_table *table,
+		struct dwarfw_orc_regs *regs, bool innermost, dwarfw_read_func read,
+		void *data) {
+	// A return address may point right after the end of the caller
+	uint64_t ip = innermost ? regs->ip : regs->ip - 1;
+	const struct dwarfw_orc_entry *entry = dwarfw_orc_lookup(table, ip);
+	if (entry == NULL || entry->type != DWARFW_ORC_TYPE_CALL) {
+		return false;
+	}
+
+	uint64_t cfa;
+	switch (entry->cfa_register) {
+	case DWARFW_ORC_REG_SP:
+		cfa = regs->sp + entry->cfa_offset;
+		break;
+	case DWARFW_ORC_REG_FP:
+		cfa = regs->fp + entry->cfa_offset;
+		break;
+	default:
+		return false;
+	}
+
+	uint64_t ra;
+	if (!read(cfa + RA_OFFSET, &ra, data)) {
+		return false;
+	}
+	if (entry->fp_offset != 0) {
+		if (!read(cfa + entry->fp_offset, &regs->fp, data)) {
+			return false;
+		}
+	}
+
+	regs->ip = ra;
+	regs->sp = cfa;
+	return true;
+}
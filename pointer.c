@@ -3,11 +3,13 @@
 #include <stdbool.h>
 #include "leb128.h"
 #include "pointer.h"
+#include "read.h"
 
 // See https://refspecs.linuxfoundation.org/LSB_5.0.0/LSB-Core-generic/LSB-Core-generic/dwarfext.html#DWARFEHENCODING
 size_t pointer_write(long long int pointer, uint8_t enc, size_t offset,
 		FILE *f) {
-	switch (enc & 0xF0) {
+	// DW_EH_PE_indirect doesn't change how the pointer is encoded
+	switch (enc & 0x70) {
 	case 0:
 		break; // No encoding
 	case DW_EH_PE_pcrel:
@@ -53,9 +55,128 @@ size_t pointer_write(long long int pointer, uint8_t enc, size_t offset,
 	}
 }
 
+size_t pointer_length(long long int pointer, uint8_t enc, size_t offset) {
+	switch (enc & 0x70) {
+	case 0:
+		break;
+	case DW_EH_PE_pcrel:
+	case DW_EH_PE_textrel:
+	case DW_EH_PE_datarel:
+	case DW_EH_PE_funcrel:
+		pointer -= offset;
+		break;
+	default:
+		return 0;
+	}
+
+	switch (enc & 0x0F) {
+	case DW_EH_PE_uleb128:
+		return leb128_length_u64(pointer);
+	case DW_EH_PE_sleb128:
+		return leb128_length_s64(pointer);
+	default:
+		return pointer_size(enc);
+	}
+}
+
+size_t pointer_read(const char *buf, size_t len, uint8_t enc, size_t offset,
+		long long int *pointer) {
+	// Aligned pointers depend on the position in the section, which isn't
+	// known here
+	if ((enc & 0x70) == DW_EH_PE_aligned) {
+		return 0;
+	}
+
+	size_t n;
+	switch (enc & 0x0F) {
+	case DW_EH_PE_absptr:;
+		uint64_t pointer_arch;
+		n = read_u64(buf, len, &pointer_arch);
+		*pointer = pointer_arch;
+		break;
+	case DW_EH_PE_uleb128:;
+		uint64_t pointer_uleb;
+		n = leb128_read_u64(buf, len, &pointer_uleb);
+		*pointer = pointer_uleb;
+		break;
+	case DW_EH_PE_udata2:;
+		uint16_t pointer_u16;
+		n = read_u16(buf, len, &pointer_u16);
+		*pointer = pointer_u16;
+		break;
+	case DW_EH_PE_udata4:;
+		uint32_t pointer_u32;
+		n = read_u32(buf, len, &pointer_u32);
+		*pointer = pointer_u32;
+		break;
+	case DW_EH_PE_udata8:;
+		uint64_t pointer_u64;
+		n = read_u64(buf, len, &pointer_u64);
+		*pointer = pointer_u64;
+		break;
+	case DW_EH_PE_sleb128:;
+		int64_t pointer_sleb;
+		n = leb128_read_s64(buf, len, &pointer_sleb);
+		*pointer = pointer_sleb;
+		break;
+	case DW_EH_PE_sdata2:;
+		uint16_t pointer_s16;
+		n = read_u16(buf, len, &pointer_s16);
+		*pointer = (int16_t)pointer_s16;
+		break;
+	case DW_EH_PE_sdata4:;
+		uint32_t pointer_s32;
+		n = read_u32(buf, len, &pointer_s32);
+		*pointer = (int32_t)pointer_s32;
+		break;
+	case DW_EH_PE_sdata8:;
+		uint64_t pointer_s64;
+		n = read_u64(buf, len, &pointer_s64);
+		*pointer = (int64_t)pointer_s64;
+		break;
+	default:
+		return 0; // Unknown encoding
+	}
+
+	if (pointer_is_relative(enc)) {
+		*pointer += offset;
+	}
+	return n;
+}
+
+size_t pointer_size(uint8_t enc) {
+	switch (enc & 0x0F) {
+	case DW_EH_PE_absptr:
+		return sizeof(size_t);
+	case DW_EH_PE_udata2:
+	case DW_EH_PE_sdata2:
+		return sizeof(uint16_t);
+	case DW_EH_PE_udata4:
+	case DW_EH_PE_sdata4:
+		return sizeof(uint32_t);
+	case DW_EH_PE_udata8:
+	case DW_EH_PE_sdata8:
+		return sizeof(uint64_t);
+	default:
+		return 0; // Variable-length or unknown encoding
+	}
+}
+
+bool pointer_is_relative(uint8_t enc) {
+	switch (enc & 0x70) {
+	case DW_EH_PE_pcrel:
+	case DW_EH_PE_textrel:
+	case DW_EH_PE_datarel:
+	case DW_EH_PE_funcrel:
+		return true;
+	default:
+		return false;
+	}
+}
+
 uint8_t pointer_rela_type(uint8_t enc) {
 	bool rel = false;
-	switch (enc & 0xF0) {
+	switch (enc & 0x70) {
 	case 0:
 		break; // No encoding
 	case DW_EH_PE_pcrel:
@@ -72,6 +193,8 @@ uint8_t pointer_rela_type(uint8_t enc) {
 
 	// TODO: support more of these
 	switch (enc & 0x0F) {
+	case DW_EH_PE_absptr:
+		return rel ? R_X86_64_PC64 : R_X86_64_64;
 	case DW_EH_PE_udata2:
 		return rel ? R_X86_64_NONE : R_X86_64_16;
 	case DW_EH_PE_udata4:
@@ -0,0 +1,27 @@
+#include <string.h>
+#include "read.h"
+
+static size_t read_bytes(const char *buf, size_t len, void *value,
+		size_t size) {
+	if (len < size) {
+		return 0;
+	}
+	memcpy(value, buf, size);
+	return size;
+}
+
+size_t read_u8(const char *buf, size_t len, uint8_t *value) {
+	return read_bytes(buf, len, value, sizeof(*value));
+}
+
+size_t read_u16(const char *buf, size_t len, uint16_t *value) {
+	return read_bytes(buf, len, value, sizeof(*value));
+}
+
+size_t read_u32(const char *buf, size_t len, uint32_t *value) {
+	return read_bytes(buf, len, value, sizeof(*value));
+}
+
+size_t read_u64(const char *buf, size_t len, uint64_t *value) {
+	return read_bytes(buf, len, value, sizeof(*value));
+}
@@ -0,0 +1,428 @@
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <string.h>
+#include "leb128.h"
+#include "pointer.h"
+#include "read.h"
+
+#define OPCODE_HIGH_MASK 0xC0
+#define OPCODE_LOW_MASK 0x3F
+
+// Reads the length and CIE pointer (CIE id for CIEs) of a record. Returns
+// the number of bytes read, sets *end to the offset of the end of the record
+// and *length_length to the size of the length field.
+static size_t cfi_header_read(const char *buf, size_t len, size_t *end,
+		size_t *length_length, uint64_t *cie_pointer) {
+	size_t n, read = 0;
+
+	uint32_t length_u32;
+	if (!(n = read_u32(buf, len, &length_u32))) {
+		return 0;
+	}
+	read += n;
+
+	uint64_t length = length_u32;
+	bool extended = length_u32 == 0xFFFFFFFF;
+	if (extended) {
+		if (!(n = read_u64(buf + read, len - read, &length))) {
+			return 0;
+		}
+		read += n;
+	}
+	if (length == 0 || length > len - read) {
+		return 0; // Terminator or truncated record
+	}
+	*end = read + length;
+	*length_length = read;
+
+	if (extended) {
+		n = read_u64(buf + read, *end - read, cie_pointer);
+	} else {
+		uint32_t cie_pointer_u32;
+		n = read_u32(buf + read, *end - read, &cie_pointer_u32);
+		*cie_pointer = cie_pointer_u32;
+	}
+	if (!n) {
+		return 0;
+	}
+	read += n;
+
+	return read;
+}
+
+size_t dwarfw_record_read(const char *buf, size_t len, uint64_t *cie_pointer) {
+	size_t end, length_length;
+	if (!cfi_header_read(buf, len, &end, &length_length, cie_pointer)) {
+		return 0;
+	}
+
+	// The pointer is encoded relative to the place it's written, make it
+	// relative to the start of the record
+	if (*cie_pointer != 0) {
+		*cie_pointer -= length_length;
+	}
+	return end;
+}
+
+size_t dwarfw_cie_read(const char *buf, size_t len, struct dwarfw_cie *cie) {
+	size_t n, read = 0;
+
+	size_t end, length_length;
+	uint64_t cie_id;
+	if (!(n = cfi_header_read(buf, len, &end, &length_length, &cie_id))) {
+		return 0;
+	}
+	read += n;
+	if (cie_id != 0) {
+		return 0; // Not a CIE
+	}
+
+	memset(cie, 0, sizeof(*cie));
+	cie->dwarf64 = length_length > sizeof(uint32_t);
+
+	if (!(n = read_u8(buf + read, end - read, &cie->version))) {
+		return 0;
+	}
+	read += n;
+
+	const char *augmentation = buf + read;
+	const char *augmentation_end = memchr(augmentation, '\0', end - read);
+	if (augmentation_end == NULL) {
+		return 0;
+	}
+	cie->augmentation = augmentation;
+	read += augmentation_end - augmentation + 1;
+
+	if (!(n = leb128_read_u64(buf + read, end - read, &cie->code_alignment))) {
+		return 0;
+	}
+	read += n;
+	if (!(n = leb128_read_s64(buf + read, end - read, &cie->data_alignment))) {
+		return 0;
+	}
+	read += n;
+	if (cie->version == 1) {
+		uint8_t return_address_register;
+		n = read_u8(buf + read, end - read, &return_address_register);
+		cie->return_address_register = return_address_register;
+	} else {
+		n = leb128_read_u64(buf + read, end - read,
+			&cie->return_address_register);
+	}
+	if (!n) {
+		return 0;
+	}
+	read += n;
+
+	if (cie->augmentation[0] == 'z') {
+		uint64_t augmentation_len;
+		if (!(n = leb128_read_u64(buf + read, end - read, &augmentation_len))) {
+			return 0;
+		}
+		read += n;
+		if (augmentation_len > end - read) {
+			return 0;
+		}
+		size_t augmentation_data_end = read + augmentation_len;
+
+		for (const char *c = cie->augmentation + 1; *c != '\0'; ++c) {
+			if (*c == 'R') {
+				n = read_u8(buf + read, augmentation_data_end - read,
+					&cie->augmentation_data.pointer_encoding);
+				if (!n) {
+					return 0;
+				}
+				read += n;
+			} else if (*c == 'P') {
+				uint8_t *personality_enc =
+					&cie->augmentation_data.personality_encoding;
+				if (!(n = read_u8(buf + read, augmentation_data_end - read,
+						personality_enc))) {
+					return 0;
+				}
+				read += n;
+				if (*personality_enc == DW_EH_PE_omit) {
+					continue;
+				}
+				if (!(n = pointer_read(buf + read, augmentation_data_end - read,
+						*personality_enc, read,
+						&cie->augmentation_data.personality))) {
+					return 0;
+				}
+				read += n;
+			} else if (*c == 'L') {
+				n = read_u8(buf + read, augmentation_data_end - read,
+					&cie->augmentation_data.lsda_encoding);
+				if (!n) {
+					return 0;
+				}
+				read += n;
+			} else if (*c != 'S') {
+				// The length lets us skip augmentations we don't know about
+				break;
+			}
+		}
+
+		read = augmentation_data_end;
+	}
+
+	cie->instructions_length = end - read;
+	cie->instructions = buf + read;
+
+	return end;
+}
+
+size_t dwarfw_fde_read(const char *buf, size_t len, struct dwarfw_cie *cie,
+		struct dwarfw_fde *fde) {
+	size_t n, read = 0;
+
+	size_t end, length_length;
+	uint64_t cie_pointer;
+	if (!(n = cfi_header_read(buf, len, &end, &length_length, &cie_pointer))) {
+		return 0;
+	}
+	read += n;
+	if (cie_pointer == 0) {
+		return 0; // Not an FDE
+	}
+
+	memset(fde, 0, sizeof(*fde));
+	fde->cie = cie;
+	fde->cie_pointer = cie_pointer - length_length;
+
+	uint8_t ptr_enc = cie->augmentation_data.pointer_encoding;
+	if (!(n = pointer_read(buf + read, end - read, ptr_enc, read,
+			&fde->initial_location))) {
+		return 0;
+	}
+	read += n;
+
+	// The address range has the size of the initial location
+	long long int address_range;
+	if (!(n = pointer_read(buf + read, end - read, ptr_enc & 0x0F, 0,
+			&address_range))) {
+		return 0;
+	}
+	fde->address_range = address_range;
+	read += n;
+
+	if (cie->augmentation[0] == 'z') {
+		uint64_t augmentation_len;
+		if (!(n = leb128_read_u64(buf + read, end - read, &augmentation_len))) {
+			return 0;
+		}
+		read += n;
+		if (augmentation_len > end - read) {
+			return 0;
+		}
+
+		uint8_t lsda_enc = cie->augmentation_data.lsda_encoding;
+		if (strchr(cie->augmentation, 'L') != NULL &&
+				lsda_enc != DW_EH_PE_omit && augmentation_len > 0) {
+			// A null LSDA isn't relative to anything
+			if (!pointer_read(buf + read, augmentation_len, lsda_enc & 0x0F, 0,
+					&fde->lsda)) {
+				return 0;
+			}
+			fde->has_lsda = fde->lsda != 0;
+			if (fde->has_lsda && pointer_is_relative(lsda_enc)) {
+				fde->lsda += read;
+			}
+		}
+		read += augmentation_len;
+	}
+
+	fde->instructions_length = end - read;
+	fde->instructions = buf + read;
+
+	return end;
+}
+
+static size_t read_block(const char *buf, size_t len, const char **block,
+		size_t *block_len) {
+	size_t n;
+
+	uint64_t block_len_u64;
+	if (!(n = leb128_read_u64(buf, len, &block_len_u64))) {
+		return 0;
+	}
+	if (block_len_u64 > len - n) {
+		return 0;
+	}
+
+	*block = buf + n;
+	*block_len = block_len_u64;
+	return n + block_len_u64;
+}
+
+size_t dwarfw_cie_read_instruction(struct dwarfw_cie *cie, const char *buf,
+		size_t len, struct dwarfw_instruction *insn) {
+	size_t n, read = 0;
+
+	memset(insn, 0, sizeof(*insn));
+
+	uint8_t op;
+	if (!(n = read_u8(buf, len, &op))) {
+		return 0;
+	}
+	read += n;
+
+	// Primary opcodes carry their first operand in the low bits
+	uint8_t low = op & OPCODE_LOW_MASK;
+	if ((op & OPCODE_HIGH_MASK) != 0) {
+		op &= OPCODE_HIGH_MASK;
+	}
+	insn->opcode = op;
+
+	uint64_t u;
+	int64_t s;
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	switch (op) {
+	case DW_CFA_advance_loc:
+		insn->operand = low * cie->code_alignment;
+		break;
+	case DW_CFA_offset:
+		insn->reg = low;
+		if (!(n = leb128_read_u64(buf + read, len - read, &u))) {
+			return 0;
+		}
+		read += n;
+		insn->operand = (long long int)u * cie->data_alignment;
+		break;
+	case DW_CFA_restore:
+		insn->reg = low;
+		break;
+	case DW_CFA_nop:
+	case DW_CFA_remember_state:
+	case DW_CFA_restore_state:
+		break;
+	case DW_CFA_set_loc:
+		// Relative to the start of the instruction
+		if (!(n = pointer_read(buf + read, len - read,
+				cie->augmentation_data.pointer_encoding, read,
+				&insn->operand))) {
+			return 0;
+		}
+		read += n;
+		break;
+	case DW_CFA_advance_loc1:
+		if (!(n = read_u8(buf + read, len - read, &u8))) {
+			return 0;
+		}
+		read += n;
+		insn->operand = u8 * cie->code_alignment;
+		break;
+	case DW_CFA_advance_loc2:
+		if (!(n = read_u16(buf + read, len - read, &u16))) {
+			return 0;
+		}
+		read += n;
+		insn->operand = u16 * cie->code_alignment;
+		break;
+	case DW_CFA_advance_loc4:
+		if (!(n = read_u32(buf + read, len - read, &u32))) {
+			return 0;
+		}
+		read += n;
+		insn->operand = u32 * cie->code_alignment;
+		break;
+	case DW_CFA_offset_extended:
+	case DW_CFA_val_offset:
+	case DW_CFA_offset_extended_sf:
+	case DW_CFA_val_offset_sf:
+	case DW_CFA_GNU_negative_offset_extended:
+		if (!(n = leb128_read_u64(buf + read, len - read, &insn->reg))) {
+			return 0;
+		}
+		read += n;
+		if (op == DW_CFA_offset_extended_sf || op == DW_CFA_val_offset_sf) {
+			n = leb128_read_s64(buf + read, len - read, &s);
+		} else {
+			n = leb128_read_u64(buf + read, len - read, &u);
+			s = u;
+		}
+		if (!n) {
+			return 0;
+		}
+		read += n;
+		if (op == DW_CFA_GNU_negative_offset_extended) {
+			s = -s;
+		}
+		insn->operand = s * cie->data_alignment;
+		break;
+	case DW_CFA_restore_extended:
+	case DW_CFA_undefined:
+	case DW_CFA_same_value:
+	case DW_CFA_def_cfa_register:
+		if (!(n = leb128_read_u64(buf + read, len - read, &insn->reg))) {
+			return 0;
+		}
+		read += n;
+		break;
+	case DW_CFA_register:
+		if (!(n = leb128_read_u64(buf + read, len - read, &insn->reg))) {
+			return 0;
+		}
+		read += n;
+		if (!(n = leb128_read_u64(buf + read, len - read, &u))) {
+			return 0;
+		}
+		read += n;
+		insn->operand = u;
+		break;
+	case DW_CFA_def_cfa:
+	case DW_CFA_def_cfa_sf:
+		if (!(n = leb128_read_u64(buf + read, len - read, &insn->reg))) {
+			return 0;
+		}
+		read += n;
+		// Fallthrough
+	case DW_CFA_def_cfa_offset:
+	case DW_CFA_def_cfa_offset_sf:
+		if (op == DW_CFA_def_cfa_sf || op == DW_CFA_def_cfa_offset_sf) {
+			if (!(n = leb128_read_s64(buf + read, len - read, &s))) {
+				return 0;
+			}
+			insn->operand = s * cie->data_alignment;
+		} else {
+			if (!(n = leb128_read_u64(buf + read, len - read, &u))) {
+				return 0;
+			}
+			insn->operand = u;
+		}
+		read += n;
+		break;
+	case DW_CFA_def_cfa_expression:
+		if (!(n = read_block(buf + read, len - read, &insn->expr,
+				&insn->expr_len))) {
+			return 0;
+		}
+		read += n;
+		break;
+	case DW_CFA_expression:
+	case DW_CFA_val_expression:
+		if (!(n = leb128_read_u64(buf + read, len - read, &insn->reg))) {
+			return 0;
+		}
+		read += n;
+		if (!(n = read_block(buf + read, len - read, &insn->expr,
+				&insn->expr_len))) {
+			return 0;
+		}
+		read += n;
+		break;
+	case DW_CFA_GNU_args_size:
+		if (!(n = leb128_read_u64(buf + read, len - read, &u))) {
+			return 0;
+		}
+		read += n;
+		insn->operand = u;
+		break;
+	default:
+		return 0; // Unknown instruction
+	}
+
+	return read;
+}
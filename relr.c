@@ -0,0 +1,52 @@
+#include <dwarfw.h>
+#include "write.h"
+
+#define RELR_WORD_SIZE sizeof(uint64_t)
+// The low bit of a bitmap word tells it apart from an address
+#define RELR_BITMAP_BITS (8 * RELR_WORD_SIZE - 1)
+
+size_t dwarfw_relr_write(const uint64_t *offsets, size_t offsets_len,
+		FILE *f) {
+	size_t n, written = 0;
+
+	for (size_t i = 0; i < offsets_len; ++i) {
+		if (offsets[i] % RELR_WORD_SIZE != 0 ||
+				(i > 0 && offsets[i] <= offsets[i - 1])) {
+			return 0;
+		}
+	}
+
+	size_t i = 0;
+	while (i < offsets_len) {
+		// An address entry relocates one word, then bitmaps relocate the
+		// following words
+		uint64_t base = offsets[i++];
+		if (!(n = write_u64(base, f))) {
+			return 0;
+		}
+		written += n;
+		base += RELR_WORD_SIZE;
+
+		while (true) {
+			uint64_t bitmap = 0;
+			for (; i < offsets_len; ++i) {
+				uint64_t delta = offsets[i] - base;
+				if (delta >= RELR_BITMAP_BITS * RELR_WORD_SIZE) {
+					break;
+				}
+				bitmap |= (uint64_t)1 << (delta / RELR_WORD_SIZE);
+			}
+			if (bitmap == 0) {
+				break;
+			}
+
+			if (!(n = write_u64((bitmap << 1) | 1, f))) {
+				return 0;
+			}
+			written += n;
+			base += RELR_BITMAP_BITS * RELR_WORD_SIZE;
+		}
+	}
+
+	return written;
+}
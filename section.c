@@ -0,0 +1,495 @@
+#include <dwarfw.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "pointer.h"
+
+struct fde_order {
+	uint64_t hotness;
+	size_t index;
+};
+
+static int fde_order_cmp(const void *a, const void *b) {
+	const struct fde_order *oa = a, *ob = b;
+	// Hottest first, ties keep the caller's order
+	if (oa->hotness != ob->hotness) {
+		return oa->hotness < ob->hotness ? 1 : -1;
+	}
+	return (oa->index > ob->index) - (oa->index < ob->index);
+}
+
+static size_t *fde_order(const uint64_t *hotness, size_t fdes_len) {
+	size_t *order = malloc(fdes_len * sizeof(size_t));
+	if (order == NULL) {
+		return NULL;
+	}
+
+	if (hotness == NULL) {
+		for (size_t i = 0; i < fdes_len; ++i) {
+			order[i] = i;
+		}
+		return order;
+	}
+
+	struct fde_order *sorted = malloc(fdes_len * sizeof(struct fde_order));
+	if (sorted == NULL) {
+		free(order);
+		return NULL;
+	}
+	for (size_t i = 0; i < fdes_len; ++i) {
+		sorted[i].hotness = hotness[i];
+		sorted[i].index = i;
+	}
+	qsort(sorted, fdes_len, sizeof(struct fde_order), fde_order_cmp);
+	for (size_t i = 0; i < fdes_len; ++i) {
+		order[i] = sorted[i].index;
+	}
+	free(sorted);
+
+	return order;
+}
+
+// A CIE pointer or content hash, and a personality symbol
+struct cie_key {
+	uint64_t value;
+	uint64_t personality_sym;
+};
+
+struct cie_offset {
+	struct dwarfw_cie *cie;
+	uint32_t personality_sym;
+	size_t offset;
+	GElf_Rela personality_rela;
+
+	struct cie_key content_key;
+	struct cie_offset *next; // with the same content hash
+};
+
+static bool cie_equal(struct dwarfw_cie *a, struct dwarfw_cie *b) {
+	if (a == b) {
+		return true;
+	}
+	return a->version == b->version &&
+		strcmp(a->augmentation, b->augmentation) == 0 &&
+		a->code_alignment == b->code_alignment &&
+		a->data_alignment == b->data_alignment &&
+		a->return_address_register == b->return_address_register &&
+		a->debug_frame == b->debug_frame &&
+		a->dwarf64 == b->dwarf64 &&
+		a->augmentation_data.pointer_encoding ==
+			b->augmentation_data.pointer_encoding &&
+		a->augmentation_data.personality_encoding ==
+			b->augmentation_data.personality_encoding &&
+		a->augmentation_data.personality ==
+			b->augmentation_data.personality &&
+		a->augmentation_data.lsda_encoding ==
+			b->augmentation_data.lsda_encoding &&
+		a->instructions_length == b->instructions_length &&
+		memcmp(a->instructions, b->instructions, a->instructions_length) == 0;
+}
+
+// Hashes the fields compared by cie_equal
+static uint64_t cie_hash(struct dwarfw_cie *cie) {
+	uint64_t fields[] = {
+		cie->version,
+		hash_bytes(cie->augmentation, strlen(cie->augmentation)),
+		cie->code_alignment,
+		cie->data_alignment,
+		cie->return_address_register,
+		cie->debug_frame | cie->dwarf64 << 1,
+		cie->augmentation_data.pointer_encoding |
+			cie->augmentation_data.personality_encoding << 8 |
+			cie->augmentation_data.lsda_encoding << 16,
+		cie->augmentation_data.personality,
+		hash_bytes(cie->instructions, cie->instructions_length),
+	};
+	return hash_bytes(fields, sizeof(fields));
+}
+
+// CIEs written so far, for FDEs to point to. CIEs are keyed by their contents,
+// so that FDEs sharing a personality share a CIE, and by their personality
+// symbol when relocated.
+struct cie_table {
+	struct cie_offset *cies;
+	size_t len, cap;
+	struct cie_offset *last; // found by the last lookup
+
+	// Entries by content hash, chained on collisions
+	struct hash_table by_content;
+	// Entries by CIE pointer, so that contents are only compared once per
+	// pointer
+	struct hash_table by_pointer;
+	struct cie_key *pointer_keys;
+	size_t pointer_keys_len;
+};
+
+// cap is the maximum number of different CIE pointers
+static bool cie_table_init(struct cie_table *table, size_t cap) {
+	memset(table, 0, sizeof(*table));
+	table->cap = cap;
+	table->cies = malloc(cap * sizeof(struct cie_offset));
+	table->pointer_keys = malloc(cap * sizeof(struct cie_key));
+	return cap == 0 || (table->cies != NULL && table->pointer_keys != NULL);
+}
+
+static void cie_table_finish(struct cie_table *table) {
+	hash_table_finish(&table->by_content);
+	hash_table_finish(&table->by_pointer);
+	free(table->pointer_keys);
+	free(table->cies);
+}
+
+static bool cie_table_insert_pointer(struct cie_table *table,
+		struct dwarfw_cie *cie, uint32_t personality_sym,
+		struct cie_offset *entry) {
+	if (table->pointer_keys_len == table->cap) {
+		return false;
+	}
+	struct cie_key *key = &table->pointer_keys[table->pointer_keys_len];
+	key->value = (uintptr_t)cie;
+	key->personality_sym = personality_sym;
+	struct hash_entry *hash_entry =
+		hash_table_insert(&table->by_pointer, key, sizeof(*key));
+	if (hash_entry == NULL) {
+		return false;
+	}
+	++table->pointer_keys_len;
+	hash_entry->value = entry;
+	return true;
+}
+
+static struct cie_offset *cie_table_find(struct cie_table *table,
+		struct dwarfw_cie *cie, uint32_t personality_sym) {
+	// FDEs using the same CIE are often next to each other
+	struct cie_offset *last = table->last;
+	if (last != NULL && last->cie == cie &&
+			last->personality_sym == personality_sym) {
+		return last;
+	}
+
+	struct cie_key key = {
+		.value = (uintptr_t)cie,
+		.personality_sym = personality_sym,
+	};
+	struct hash_entry *hash_entry =
+		hash_table_find(&table->by_pointer, &key, sizeof(key));
+	if (hash_entry != NULL) {
+		table->last = hash_entry->value;
+		return table->last;
+	}
+
+	// An equal CIE may have been written from another pointer
+	key.value = cie_hash(cie);
+	hash_entry = hash_table_find(&table->by_content, &key, sizeof(key));
+	struct cie_offset *entry = hash_entry != NULL ? hash_entry->value : NULL;
+	while (entry != NULL && !cie_equal(entry->cie, cie)) {
+		entry = entry->next;
+	}
+	if (entry != NULL) {
+		// Failing to remember the pointer only makes the next lookup slower
+		cie_table_insert_pointer(table, cie, personality_sym, entry);
+		table->last = entry;
+	}
+	return entry;
+}
+
+static struct cie_offset *cie_table_append(struct cie_table *table,
+		struct dwarfw_cie *cie, uint32_t personality_sym, size_t offset) {
+	struct cie_offset *entry = &table->cies[table->len];
+	entry->cie = cie;
+	entry->personality_sym = personality_sym;
+	entry->offset = offset;
+	entry->content_key.value = cie_hash(cie);
+	entry->content_key.personality_sym = personality_sym;
+
+	struct hash_entry *hash_entry = hash_table_insert(&table->by_content,
+		&entry->content_key, sizeof(entry->content_key));
+	if (hash_entry == NULL ||
+			!cie_table_insert_pointer(table, cie, personality_sym, entry)) {
+		return NULL;
+	}
+	entry->next = hash_entry->value;
+	hash_entry->value = entry;
+
+	++table->len;
+	table->last = entry;
+	return entry;
+}
+
+enum cie_relocation {
+	CIE_RELOCATION_NONE,
+	CIE_RELOCATION_FDE, // only FDE locations are relocated
+	CIE_RELOCATION_FDE_REL, // same, with REL relocations
+	CIE_RELOCATION_EH, // personalities are relocated too
+};
+
+// Returns the CIE entry for the FDEs of cie, writing the CIE on first use
+static struct cie_offset *cie_table_add(struct cie_table *table,
+		struct dwarfw_cie *cie, uint32_t personality_sym,
+		enum cie_relocation relocation, size_t *written, FILE *f) {
+	struct cie_offset *entry = cie_table_find(table, cie, personality_sym);
+	if (entry != NULL) {
+		return entry;
+	}
+	entry = &table->cies[table->len];
+
+	// Personalities are given relative to the start of the section, but
+	// dwarfw_cie_write expects them relative to the start of the CIE
+	struct dwarfw_cie local = *cie;
+	if (relocation == CIE_RELOCATION_NONE && !cie->debug_frame &&
+			pointer_is_relative(cie->augmentation_data.personality_encoding)) {
+		local.augmentation_data.personality -= *written;
+	}
+
+	size_t n = 0;
+	GElf_Rela *personality_rela = &entry->personality_rela;
+	switch (relocation) {
+	case CIE_RELOCATION_NONE:
+		n = dwarfw_cie_write(&local, f);
+		break;
+	case CIE_RELOCATION_FDE:
+		// Personalities can only be relocated by dwarfw_eh_frame_write_eh
+		n = dwarfw_cie_write_rela(&local, personality_rela, f);
+		if (GELF_R_TYPE(personality_rela->r_info) != R_X86_64_NONE) {
+			n = 0;
+		}
+		break;
+	case CIE_RELOCATION_FDE_REL:
+		n = dwarfw_cie_write_rel(&local, f);
+		break;
+	case CIE_RELOCATION_EH:
+		n = dwarfw_cie_write_rela(&local, personality_rela, f);
+		personality_rela->r_offset += *written;
+		break;
+	}
+	if (n == 0) {
+		return NULL;
+	}
+
+	entry = cie_table_append(table, cie, personality_sym, *written);
+	*written += n;
+	return entry;
+}
+
+static uint32_t fde_personality_sym(struct dwarfw_fde_relas *eh_relas,
+		size_t i) {
+	return eh_relas != NULL ? GELF_R_SYM(eh_relas[i].personality.r_info) : 0;
+}
+
+static void rela_set(GElf_Rela *dst, const GElf_Rela *src, size_t offset) {
+	// Keep the symbol chosen by the caller
+	uint32_t sym = GELF_R_SYM(dst->r_info);
+	*dst = *src;
+	dst->r_offset += offset;
+	dst->r_info = GELF_R_INFO(sym, GELF_R_TYPE(src->r_info));
+}
+
+static size_t eh_frame_write(struct dwarfw_fde *fdes, size_t fdes_len,
+		const uint64_t *hotness, size_t *fde_offsets, GElf_Rela *relas,
+		struct dwarfw_fde_relas *eh_relas, GElf_Rel *rels, FILE *f) {
+	size_t n, written = 0;
+
+	enum cie_relocation relocation = CIE_RELOCATION_NONE;
+	if (eh_relas != NULL) {
+		relocation = CIE_RELOCATION_EH;
+	} else if (relas != NULL) {
+		relocation = CIE_RELOCATION_FDE;
+	} else if (rels != NULL) {
+		relocation = CIE_RELOCATION_FDE_REL;
+	}
+
+	struct cie_table cies;
+	size_t *order = fde_order(hotness, fdes_len);
+	if (!cie_table_init(&cies, fdes_len) || order == NULL) {
+		goto error;
+	}
+
+	// CIEs go first: every unwind through one of the FDEs touches them
+	for (size_t i = 0; i < fdes_len; ++i) {
+		if (!cie_table_add(&cies, fdes[order[i]].cie,
+				fde_personality_sym(eh_relas, order[i]), relocation, &written,
+				f)) {
+			goto error;
+		}
+	}
+
+	for (size_t i = 0; i < fdes_len; ++i) {
+		size_t j = order[i];
+		struct dwarfw_fde *fde = &fdes[j];
+
+		struct cie_offset *cie_entry = cie_table_find(&cies, fde->cie,
+			fde_personality_sym(eh_relas, j));
+		if (fde->cie->debug_frame) {
+			fde->cie_pointer = cie_entry->offset;
+		} else {
+			fde->cie_pointer = written - cie_entry->offset;
+		}
+
+		// Locations are given relative to the start of the section, but
+		// dwarfw_fde_write expects them relative to the start of the FDE
+		struct dwarfw_fde local = *fde;
+		struct dwarfw_cie *cie = fde->cie;
+		if (relocation == CIE_RELOCATION_NONE && !cie->debug_frame) {
+			if (pointer_is_relative(cie->augmentation_data.pointer_encoding)) {
+				local.initial_location -= written;
+			}
+			if (local.has_lsda &&
+					pointer_is_relative(cie->augmentation_data.lsda_encoding)) {
+				local.lsda -= written;
+			}
+		}
+
+		if (eh_relas != NULL) {
+			GElf_Rela rela, lsda_rela;
+			n = dwarfw_fde_write_lsda(&local, &rela, &lsda_rela, f);
+			rela_set(&eh_relas[j].location, &rela, written);
+			rela_set(&eh_relas[j].lsda, &lsda_rela, written);
+			rela_set(&eh_relas[j].personality, &cie_entry->personality_rela, 0);
+		} else if (relas != NULL) {
+			n = dwarfw_fde_write(&local, &relas[j], f);
+			relas[j].r_offset += written;
+		} else if (rels != NULL) {
+			n = dwarfw_fde_write_rel(&local, &rels[j], f);
+			rels[j].r_offset += written;
+		} else {
+			n = dwarfw_fde_write(&local, NULL, f);
+		}
+		if (n == 0) {
+			goto error;
+		}
+		if (fde_offsets != NULL) {
+			fde_offsets[j] = written;
+		}
+		written += n;
+	}
+
+	free(order);
+	cie_table_finish(&cies);
+	return written;
+
+error:
+	free(order);
+	cie_table_finish(&cies);
+	return 0;
+}
+
+size_t dwarfw_eh_frame_size(struct dwarfw_fde *fdes, size_t fdes_len) {
+	size_t n, size = 0;
+
+	struct cie_table cies;
+	if (!cie_table_init(&cies, fdes_len)) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < fdes_len; ++i) {
+		struct dwarfw_cie *cie = fdes[i].cie;
+		if (cie_table_find(&cies, cie, 0) == NULL) {
+			if (!(n = dwarfw_cie_size(cie))) {
+				goto error;
+			}
+			if (cie_table_append(&cies, cie, 0, size) == NULL) {
+				goto error;
+			}
+			size += n;
+		}
+
+		if (!(n = dwarfw_fde_size(&fdes[i]))) {
+			goto error;
+		}
+		size += n;
+	}
+
+	cie_table_finish(&cies);
+	return size;
+
+error:
+	cie_table_finish(&cies);
+	return 0;
+}
+
+size_t dwarfw_eh_frame_write(struct dwarfw_fde *fdes, size_t fdes_len,
+		const uint64_t *hotness, size_t *fde_offsets, GElf_Rela *relas,
+		FILE *f) {
+	return eh_frame_write(fdes, fdes_len, hotness, fde_offsets, relas, NULL,
+		NULL, f);
+}
+
+size_t dwarfw_eh_frame_write_rel(struct dwarfw_fde *fdes, size_t fdes_len,
+		const uint64_t *hotness, size_t *fde_offsets, GElf_Rel *rels,
+		FILE *f) {
+	return eh_frame_write(fdes, fdes_len, hotness, fde_offsets, NULL, NULL,
+		rels, f);
+}
+
+size_t dwarfw_eh_frame_write_eh(struct dwarfw_fde *fdes, size_t fdes_len,
+		const uint64_t *hotness, size_t *fde_offsets,
+		struct dwarfw_fde_relas *relas, FILE *f) {
+	return eh_frame_write(fdes, fdes_len, hotness, fde_offsets, NULL, relas,
+		NULL, f);
+}
+
+size_t dwarfw_eh_frame_write_columns(struct dwarfw_cie *cies, size_t cies_len,
+		const struct dwarfw_fde_columns *columns, size_t *fde_offsets,
+		GElf_Rela *relas, FILE *f) {
+	size_t n, written = 0;
+
+	enum cie_relocation relocation =
+		relas != NULL ? CIE_RELOCATION_FDE : CIE_RELOCATION_NONE;
+	const uint32_t *cie_indices = columns->cie_indices;
+	struct cie_table table;
+	if (!cie_table_init(&table, cies_len)) {
+		return 0;
+	}
+
+	// CIEs go first, in the same order as with dwarfw_eh_frame_write
+	for (size_t i = 0; i < columns->fdes_len; ++i) {
+		if (cie_indices[i] >= cies_len ||
+				!cie_table_add(&table, &cies[cie_indices[i]], 0, relocation,
+					&written, f)) {
+			goto error;
+		}
+	}
+
+	const uint32_t *insn_offsets = columns->instruction_offsets;
+	for (size_t i = 0; i < columns->fdes_len; ++i) {
+		struct dwarfw_cie *cie = &cies[cie_indices[i]];
+		size_t cie_offset = cie_table_find(&table, cie, 0)->offset;
+		if (insn_offsets[i + 1] < insn_offsets[i]) {
+			goto error;
+		}
+
+		struct dwarfw_fde fde = {
+			.cie = cie,
+			.cie_pointer = cie->debug_frame ? cie_offset : written - cie_offset,
+			.initial_location = columns->base + columns->starts[i],
+			.address_range = columns->ranges[i],
+			.instructions_length = insn_offsets[i + 1] - insn_offsets[i],
+			.instructions = columns->instructions + insn_offsets[i],
+		};
+		if (relas == NULL && !cie->debug_frame &&
+				pointer_is_relative(cie->augmentation_data.pointer_encoding)) {
+			fde.initial_location -= written;
+		}
+
+		if (relas != NULL) {
+			n = dwarfw_fde_write(&fde, &relas[i], f);
+			relas[i].r_offset += written;
+		} else {
+			n = dwarfw_fde_write(&fde, NULL, f);
+		}
+		if (n == 0) {
+			goto error;
+		}
+		if (fde_offsets != NULL) {
+			fde_offsets[i] = written;
+		}
+		written += n;
+	}
+
+	cie_table_finish(&table);
+	return written;
+
+error:
+	cie_table_finish(&table);
+	return 0;
+}
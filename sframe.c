@@ -0,0 +1,276 @@
+#include <dwarfw.h>
+#include <string.h>
+
+// DWARF register numbers for x86_64
+#define REG_FP 6
+#define REG_SP 7
+
+// The return address is pushed by the call instruction
+#define RA_OFFSET -8
+
+#define SFRAME_MAGIC 0xDEE2
+#define SFRAME_VERSION_2 2
+#define SFRAME_F_FDE_SORTED 0x1
+#define SFRAME_ABI_AMD64_ENDIAN_LITTLE 3
+
+#define SFRAME_HEADER_SIZE 28
+#define SFRAME_FDE_SIZE 20
+#define SFRAME_FRE_MAX_SIZE (4 + 1 + 2 * 4)
+
+enum sframe_fre_type {
+	SFRAME_FRE_TYPE_ADDR1 = 0,
+	SFRAME_FRE_TYPE_ADDR2 = 1,
+	SFRAME_FRE_TYPE_ADDR4 = 2,
+};
+
+enum sframe_base_reg {
+	SFRAME_BASE_REG_FP = 0,
+	SFRAME_BASE_REG_SP = 1,
+};
+
+enum sframe_fre_offset_size {
+	SFRAME_FRE_OFFSET_1B = 0,
+	SFRAME_FRE_OFFSET_2B = 1,
+	SFRAME_FRE_OFFSET_4B = 2,
+};
+
+// Frame row entry. The return address is always at a fixed offset from the
+// CFA on x86_64, so it isn't recorded.
+struct fre {
+	uint32_t start; // from the start of the function
+	uint8_t base_reg; // enum sframe_base_reg
+	int32_t cfa_offset;
+	int32_t fp_offset; // from the CFA, 0 if the frame pointer isn't saved
+};
+
+static bool fits_s32(long long int value) {
+	return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool row_to_fre(const struct dwarfw_unwind_row *row, struct fre *fre) {
+	memset(fre, 0, sizeof(*fre));
+
+	switch (row->cfa_register) {
+	case REG_SP:
+		fre->base_reg = SFRAME_BASE_REG_SP;
+		break;
+	case REG_FP:
+		fre->base_reg = SFRAME_BASE_REG_FP;
+		break;
+	default:
+		return false;
+	}
+
+	if (row->ra_offset != 0 && row->ra_offset != RA_OFFSET) {
+		return false;
+	}
+	if (!fits_s32(row->cfa_offset) || !fits_s32(row->fp_offset)) {
+		return false;
+	}
+
+	fre->start = row->offset;
+	fre->cfa_offset = row->cfa_offset;
+	fre->fp_offset = row->fp_offset;
+	return true;
+}
+
+static uint8_t fre_type(uint32_t range) {
+	if (range <= UINT8_MAX + 1) {
+		return SFRAME_FRE_TYPE_ADDR1;
+	} else if (range <= UINT16_MAX + 1) {
+		return SFRAME_FRE_TYPE_ADDR2;
+	}
+	return SFRAME_FRE_TYPE_ADDR4;
+}
+
+static uint8_t offset_size(int32_t offset) {
+	if (offset >= INT8_MIN && offset <= INT8_MAX) {
+		return SFRAME_FRE_OFFSET_1B;
+	} else if (offset >= INT16_MIN && offset <= INT16_MAX) {
+		return SFRAME_FRE_OFFSET_2B;
+	}
+	return SFRAME_FRE_OFFSET_4B;
+}
+
+static char *put_offset(int32_t value, uint8_t size, char *p) {
+	switch (size) {
+	case SFRAME_FRE_OFFSET_1B:;
+		int8_t s8 = value;
+		memcpy(p, &s8, sizeof(s8));
+		return p + sizeof(s8);
+	case SFRAME_FRE_OFFSET_2B:;
+		int16_t s16 = value;
+		memcpy(p, &s16, sizeof(s16));
+		return p + sizeof(s16);
+	default:
+		memcpy(p, &value, sizeof(value));
+		return p + sizeof(value);
+	}
+}
+
+// Encodes a FRE in its smallest form, returns its size
+static size_t fre_encode(const struct fre *fre, uint8_t type, char *buf) {
+	char *p = buf;
+	switch (type) {
+	case SFRAME_FRE_TYPE_ADDR1:;
+		uint8_t u8 = fre->start;
+		memcpy(p, &u8, sizeof(u8));
+		p += sizeof(u8);
+		break;
+	case SFRAME_FRE_TYPE_ADDR2:;
+		uint16_t u16 = fre->start;
+		memcpy(p, &u16, sizeof(u16));
+		p += sizeof(u16);
+		break;
+	default:
+		memcpy(p, &fre->start, sizeof(fre->start));
+		p += sizeof(fre->start);
+		break;
+	}
+
+	// All offsets of a FRE have the same size
+	uint8_t offsets_len = fre->fp_offset != 0 ? 2 : 1;
+	uint8_t size = offset_size(fre->cfa_offset);
+	uint8_t fp_size = offset_size(fre->fp_offset);
+	if (fp_size > size) {
+		size = fp_size;
+	}
+
+	*p++ = fre->base_reg | (offsets_len << 1) | (size << 5);
+	p = put_offset(fre->cfa_offset, size, p);
+	if (fre->fp_offset != 0) {
+		p = put_offset(fre->fp_offset, size, p);
+	}
+	return p - buf;
+}
+
+// Walks the FREs of a function, writing them if f isn't NULL. Returns false if
+// a row can't be described or on write error.
+static bool fres_walk(const struct dwarfw_unwind_function *func, FILE *f,
+		uint32_t *fres_len, uint32_t *fres_size) {
+	uint8_t type = fre_type(func->range);
+	*fres_len = *fres_size = 0;
+
+	// Identical consecutive rows only need one FRE
+	struct fre prev = {0};
+	for (size_t i = 0; i < func->rows_len; ++i) {
+		const struct dwarfw_unwind_row *row = &func->rows[i];
+		if (row->offset >= func->range) {
+			break;
+		}
+
+		struct fre fre;
+		if (!row_to_fre(row, &fre)) {
+			return false;
+		}
+		if (i > 0 && fre.base_reg == prev.base_reg &&
+				fre.cfa_offset == prev.cfa_offset &&
+				fre.fp_offset == prev.fp_offset) {
+			continue;
+		}
+		prev = fre;
+
+		char buf[SFRAME_FRE_MAX_SIZE];
+		size_t n = fre_encode(&fre, type, buf);
+		if (f != NULL && !fwrite(buf, 1, n, f)) {
+			return false;
+		}
+		++*fres_len;
+		*fres_size += n;
+	}
+
+	return *fres_len > 0;
+}
+
+static bool function_fits(const struct dwarfw_unwind_function *func,
+		uint64_t address) {
+	int64_t start = func->location - address;
+	return start >= INT32_MIN && start <= INT32_MAX;
+}
+
+size_t dwarfw_sframe_write(const struct dwarfw_unwind_function *functions,
+		size_t functions_len, uint64_t address, FILE *f) {
+	// Functions which can't be described are left out, count the others
+	uint32_t fdes_len = 0, fres_len = 0, fres_size = 0;
+	for (size_t i = 0; i < functions_len; ++i) {
+		const struct dwarfw_unwind_function *func = &functions[i];
+		if (i > 0 && func->location < functions[i - 1].location) {
+			return 0;
+		}
+
+		uint32_t len, size;
+		if (!function_fits(func, address) || !fres_walk(func, NULL, &len,
+				&size)) {
+			continue;
+		}
+		if (fdes_len == UINT32_MAX || size > UINT32_MAX - fres_size) {
+			return 0;
+		}
+		++fdes_len;
+		fres_len += len;
+		fres_size += size;
+	}
+	if (fdes_len > (UINT32_MAX - fres_size) / SFRAME_FDE_SIZE) {
+		return 0;
+	}
+
+	char header[SFRAME_HEADER_SIZE] = {0};
+	uint16_t magic = SFRAME_MAGIC;
+	memcpy(&header[0], &magic, sizeof(magic));
+	header[2] = SFRAME_VERSION_2;
+	header[3] = SFRAME_F_FDE_SORTED;
+	header[4] = SFRAME_ABI_AMD64_ENDIAN_LITTLE;
+	header[5] = 0; // The frame pointer isn't at a fixed offset
+	header[6] = RA_OFFSET;
+	header[7] = 0; // No auxiliary header
+	uint32_t fdes_off = 0, fres_off = fdes_len * SFRAME_FDE_SIZE;
+	memcpy(&header[8], &fdes_len, sizeof(fdes_len));
+	memcpy(&header[12], &fres_len, sizeof(fres_len));
+	memcpy(&header[16], &fres_size, sizeof(fres_size));
+	memcpy(&header[20], &fdes_off, sizeof(fdes_off));
+	memcpy(&header[24], &fres_off, sizeof(fres_off));
+	if (!fwrite(header, 1, sizeof(header), f)) {
+		return 0;
+	}
+	size_t written = sizeof(header);
+
+	uint32_t fre_off = 0;
+	for (size_t i = 0; i < functions_len; ++i) {
+		const struct dwarfw_unwind_function *func = &functions[i];
+		uint32_t len, size;
+		if (!function_fits(func, address) || !fres_walk(func, NULL, &len,
+				&size)) {
+			continue;
+		}
+
+		char fde[SFRAME_FDE_SIZE] = {0};
+		int32_t start = func->location - address;
+		uint32_t range = func->range;
+		memcpy(&fde[0], &start, sizeof(start));
+		memcpy(&fde[4], &range, sizeof(range));
+		memcpy(&fde[8], &fre_off, sizeof(fre_off));
+		memcpy(&fde[12], &len, sizeof(len));
+		fde[16] = fre_type(func->range); // PC-increment FDE
+		if (!fwrite(fde, 1, sizeof(fde), f)) {
+			return 0;
+		}
+		written += sizeof(fde);
+		fre_off += size;
+	}
+
+	for (size_t i = 0; i < functions_len; ++i) {
+		const struct dwarfw_unwind_function *func = &functions[i];
+		uint32_t len, size;
+		if (!function_fits(func, address) || !fres_walk(func, NULL, &len,
+				&size)) {
+			continue;
+		}
+		// The function has been checked, this can only fail to write
+		if (!fres_walk(func, f, &len, &size)) {
+			return 0;
+		}
+		written += size;
+	}
+
+	return written;
+}
@@ -0,0 +1,447 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Fallback for systems without this "read and write, mmaping if possible" cmd
+#ifndef ELF_C_RDWR_MMAP
+#define ELF_C_RDWR_MMAP ELF_C_RDWR
+#endif
+
+#define EH_FRAME_ALIGN 8
+
+static const char usage[] =
+	"usage: dwarfw-patch [-j jobs] [list]\n"
+	"\n"
+	"Adds .eh_frame and .rela.eh_frame sections covering .text to object files.\n"
+	"Each line of the list (standard input by default) is an object file,\n"
+	"optionally followed by a file containing the raw FDE instructions. The\n"
+	"default instructions describe a frame pointer prologue.\n";
+
+struct job {
+	char *path;
+	char *instructions_path;
+	double duration;
+	bool ok;
+};
+
+struct worker {
+	pthread_t thread;
+
+	// Reused from one file to the next
+	char *buf;
+	size_t buf_cap;
+	char *instructions;
+	size_t instructions_cap;
+};
+
+static struct job *jobs = NULL;
+static size_t jobs_len = 0;
+static atomic_size_t next_job = 0;
+
+static struct dwarfw_cie cie = {
+	.version = 1,
+	.augmentation = "zR",
+	.code_alignment = 1,
+	.data_alignment = -8,
+	.return_address_register = 16,
+	.augmentation_data = {
+		.pointer_encoding = DW_EH_PE_sdata4 | DW_EH_PE_pcrel,
+	},
+};
+static char *default_instructions = NULL;
+static size_t default_instructions_len = 0;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool encode_instructions(void) {
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+	if (f == NULL) {
+		return false;
+	}
+	dwarfw_cie_write_def_cfa(&cie, 7, 8, f);
+	dwarfw_cie_write_offset(&cie, 16, -8, f);
+	fclose(f);
+	cie.instructions = buf;
+	cie.instructions_length = len;
+
+	f = open_memstream(&default_instructions, &default_instructions_len);
+	if (f == NULL) {
+		return false;
+	}
+	dwarfw_cie_write_advance_loc(&cie, 1, f);
+	dwarfw_cie_write_def_cfa_offset(&cie, 16, f);
+	dwarfw_cie_write_offset(&cie, 6, -16, f);
+	dwarfw_cie_write_advance_loc(&cie, 3, f);
+	dwarfw_cie_write_def_cfa_register(&cie, 6, f);
+	fclose(f);
+
+	return true;
+}
+
+static bool read_instructions(struct worker *worker, const char *path,
+		size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return false;
+	}
+
+	*len = 0;
+	while (true) {
+		if (*len == worker->instructions_cap) {
+			size_t cap = worker->instructions_cap == 0 ?
+				256 : 2 * worker->instructions_cap;
+			char *instructions = realloc(worker->instructions, cap);
+			if (instructions == NULL) {
+				fclose(f);
+				return false;
+			}
+			worker->instructions = instructions;
+			worker->instructions_cap = cap;
+		}
+
+		size_t n = fread(worker->instructions + *len, 1,
+			worker->instructions_cap - *len, f);
+		if (n == 0) {
+			break;
+		}
+		*len += n;
+	}
+
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+// Encodes .eh_frame in the worker's buffer. Its size is known upfront, the
+// CIE doesn't use a LEB128 pointer encoding.
+static size_t encode_eh_frame(struct worker *worker, struct dwarfw_fde *fde,
+		GElf_Rela *rela) {
+	size_t len = dwarfw_eh_frame_size(fde, 1);
+	if (len == 0) {
+		return 0;
+	}
+	// fmemopen needs room for a trailing null byte
+	if (worker->buf_cap < len + 1) {
+		char *buf = realloc(worker->buf, len + 1);
+		if (buf == NULL) {
+			return 0;
+		}
+		worker->buf = buf;
+		worker->buf_cap = len + 1;
+	}
+
+	FILE *f = fmemopen(worker->buf, worker->buf_cap, "w");
+	if (f == NULL) {
+		return 0;
+	}
+	setvbuf(f, NULL, _IONBF, 0);
+	size_t n = dwarfw_eh_frame_write(fde, 1, NULL, NULL, rela, f);
+	fclose(f);
+	return n;
+}
+
+static bool add_section_data(Elf_Scn *scn, void *buf, size_t len,
+		size_t align) {
+	Elf_Data *data = elf_newdata(scn);
+	if (data == NULL) {
+		return false;
+	}
+	data->d_buf = buf;
+	data->d_size = len;
+	data->d_align = align;
+	return true;
+}
+
+static bool patch_elf(struct worker *worker, struct job *job, Elf *elf,
+		struct dwarfw_elf *ctx) {
+	if (dwarfw_elf_find_section(ctx, ".eh_frame") != NULL) {
+		fprintf(stderr, "%s: already has an .eh_frame section\n", job->path);
+		return false;
+	}
+
+	Elf_Scn *text = dwarfw_elf_find_section(ctx, ".text");
+	Elf_Scn *symtab = dwarfw_elf_find_section(ctx, ".symtab");
+	if (text == NULL || symtab == NULL) {
+		fprintf(stderr, "%s: missing .text or .symtab section\n", job->path);
+		return false;
+	}
+
+	GElf_Shdr text_shdr;
+	if (!gelf_getshdr(text, &text_shdr)) {
+		return false;
+	}
+
+	GElf_Sym text_sym;
+	int text_sym_idx =
+		dwarfw_elf_find_section_symbol(ctx, elf_ndxscn(text), &text_sym);
+	if (text_sym_idx < 0) {
+		fprintf(stderr, "%s: can't find .text section symbol\n", job->path);
+		return false;
+	}
+
+	struct dwarfw_fde fde = {
+		.cie = &cie,
+		.initial_location = 0,
+		.address_range = text_shdr.sh_size,
+		.instructions_length = default_instructions_len,
+		.instructions = default_instructions,
+	};
+	if (job->instructions_path != NULL) {
+		if (!read_instructions(worker, job->instructions_path,
+				&fde.instructions_length)) {
+			return false;
+		}
+		fde.instructions = worker->instructions;
+	}
+
+	GElf_Rela rela;
+	size_t len = encode_eh_frame(worker, &fde, &rela);
+	if (len == 0) {
+		fprintf(stderr, "%s: failed to encode .eh_frame\n", job->path);
+		return false;
+	}
+	rela.r_info = GELF_R_INFO(text_sym_idx, GELF_R_TYPE(rela.r_info));
+
+	Elf_Scn *eh_frame = dwarfw_elf_create_section(ctx, ".eh_frame");
+	if (eh_frame == NULL || !add_section_data(eh_frame, worker->buf, len,
+			EH_FRAME_ALIGN)) {
+		return false;
+	}
+	GElf_Shdr shdr;
+	if (!gelf_getshdr(eh_frame, &shdr)) {
+		return false;
+	}
+	shdr.sh_size = len;
+	shdr.sh_type = SHT_PROGBITS;
+	shdr.sh_addralign = EH_FRAME_ALIGN;
+	shdr.sh_flags = SHF_ALLOC;
+	if (!gelf_update_shdr(eh_frame, &shdr)) {
+		return false;
+	}
+
+	Elf_Scn *rela_scn = dwarfw_elf_create_section(ctx, ".rela.eh_frame");
+	if (rela_scn == NULL ||
+			!add_section_data(rela_scn, &rela, sizeof(rela), 8)) {
+		return false;
+	}
+	if (!gelf_getshdr(rela_scn, &shdr)) {
+		return false;
+	}
+	shdr.sh_size = sizeof(rela);
+	shdr.sh_type = SHT_RELA;
+	shdr.sh_addralign = 8;
+	shdr.sh_link = elf_ndxscn(symtab);
+	shdr.sh_info = elf_ndxscn(eh_frame);
+	shdr.sh_flags = SHF_INFO_LINK;
+	if (!gelf_update_shdr(rela_scn, &shdr)) {
+		return false;
+	}
+
+	// The section data points to the worker buffer and rela: write now
+	elf_flagelf(elf, ELF_C_SET, ELF_F_DIRTY);
+	if (elf_update(elf, ELF_C_WRITE) < 0) {
+		fprintf(stderr, "%s: elf_update() failed: %s\n", job->path,
+			elf_errmsg(-1));
+		return false;
+	}
+
+	return true;
+}
+
+static bool patch_file(struct worker *worker, struct job *job) {
+	int fd = open(job->path, O_RDWR, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: cannot open\n", job->path);
+		return false;
+	}
+
+	bool ok = false;
+	Elf *elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL);
+	if (elf == NULL) {
+		fprintf(stderr, "%s: elf_begin() failed: %s\n", job->path,
+			elf_errmsg(-1));
+	} else if (elf_kind(elf) != ELF_K_ELF) {
+		fprintf(stderr, "%s: not an ELF object\n", job->path);
+	} else {
+		struct dwarfw_elf *ctx = dwarfw_elf_create(elf);
+		if (ctx == NULL) {
+			fprintf(stderr, "%s: dwarfw_elf_create() failed\n", job->path);
+		} else {
+			ok = patch_elf(worker, job, elf, ctx);
+			dwarfw_elf_destroy(ctx);
+		}
+	}
+
+	elf_end(elf);
+	close(fd);
+	return ok;
+}
+
+static void *worker_run(void *data) {
+	struct worker *worker = data;
+
+	while (true) {
+		size_t i = atomic_fetch_add(&next_job, 1);
+		if (i >= jobs_len) {
+			break;
+		}
+
+		struct job *job = &jobs[i];
+		double start = now();
+		job->ok = patch_file(worker, job);
+		job->duration = now() - start;
+
+		printf("%s: %s in %.3f ms\n", job->path, job->ok ? "patched" : "failed",
+			job->duration * 1e3);
+	}
+
+	return NULL;
+}
+
+static bool read_jobs(FILE *f) {
+	char *line = NULL;
+	size_t line_cap = 0;
+	size_t jobs_cap = 0;
+
+	ssize_t n;
+	while ((n = getline(&line, &line_cap, f)) > 0) {
+		char *saveptr;
+		char *path = strtok_r(line, " \t\n", &saveptr);
+		if (path == NULL) {
+			continue; // Empty line
+		}
+		char *instructions_path = strtok_r(NULL, " \t\n", &saveptr);
+
+		if (jobs_len == jobs_cap) {
+			jobs_cap = jobs_cap == 0 ? 64 : 2 * jobs_cap;
+			struct job *new_jobs = realloc(jobs, jobs_cap * sizeof(struct job));
+			if (new_jobs == NULL) {
+				free(line);
+				return false;
+			}
+			jobs = new_jobs;
+		}
+
+		struct job *job = &jobs[jobs_len];
+		*job = (struct job){
+			.path = strdup(path),
+			.instructions_path =
+				instructions_path != NULL ? strdup(instructions_path) : NULL,
+		};
+		if (job->path == NULL ||
+				(instructions_path != NULL && job->instructions_path == NULL)) {
+			free(job->path);
+			free(job->instructions_path);
+			free(line);
+			return false;
+		}
+		++jobs_len;
+	}
+
+	free(line);
+	return !ferror(f);
+}
+
+int main(int argc, char **argv) {
+	long jobs_nr = sysconf(_SC_NPROCESSORS_ONLN);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hj:")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs_nr = strtol(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (jobs_nr < 1) {
+		jobs_nr = 1;
+	}
+
+	FILE *list = stdin;
+	if (optind < argc) {
+		list = fopen(argv[optind], "r");
+		if (list == NULL) {
+			fprintf(stderr, "Cannot open %s\n", argv[optind]);
+			return 1;
+		}
+	}
+	if (!read_jobs(list)) {
+		fprintf(stderr, "Failed to read the file list\n");
+		return 1;
+	}
+	if (list != stdin) {
+		fclose(list);
+	}
+
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		fprintf(stderr, "ELF library initialization failed: %s\n", elf_errmsg(-1));
+		return 1;
+	}
+	if (!encode_instructions()) {
+		return 1;
+	}
+
+	if ((size_t)jobs_nr > jobs_len) {
+		jobs_nr = jobs_len > 0 ? jobs_len : 1;
+	}
+	struct worker *workers = calloc(jobs_nr, sizeof(struct worker));
+	if (workers == NULL) {
+		return 1;
+	}
+
+	double start = now();
+	for (long i = 0; i < jobs_nr; ++i) {
+		if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+			fprintf(stderr, "pthread_create() failed\n");
+			return 1;
+		}
+	}
+	for (long i = 0; i < jobs_nr; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		free(workers[i].buf);
+		free(workers[i].instructions);
+	}
+	double wall = now() - start;
+
+	size_t failed = 0;
+	double busy = 0;
+	for (size_t i = 0; i < jobs_len; ++i) {
+		busy += jobs[i].duration;
+		if (!jobs[i].ok) {
+			++failed;
+		}
+		free(jobs[i].path);
+		free(jobs[i].instructions_path);
+	}
+
+	printf("%zu files (%zu failed) in %.3f ms with %ld jobs, "
+		"%.3f ms per file, %.1f files/s\n", jobs_len, failed, wall * 1e3,
+		jobs_nr, jobs_len > 0 ? busy * 1e3 / jobs_len : 0,
+		wall > 0 ? jobs_len / wall : 0);
+
+	free(jobs);
+	free(workers);
+	free((char *)cie.instructions);
+	free(default_instructions);
+	return failed > 0;
+}
@@ -0,0 +1,628 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dwarf.h>
+#include <dwarfw.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char usage[] =
+	"usage: dwarfw-size [-j jobs] [-v] [file...]\n"
+	"\n"
+	"Reports how the bytes of the .eh_frame sections of ELF files are spent.\n"
+	"Files are read from standard input, one per line, if none are given,\n"
+	"files which aren't ELF are skipped.\n"
+	"Duplicate FDEs are only counted in linked files, where locations are\n"
+	"final.\n";
+
+static const char *opcode_names[256] = {
+	[DW_CFA_nop] = "DW_CFA_nop",
+	[DW_CFA_set_loc] = "DW_CFA_set_loc",
+	[DW_CFA_advance_loc1] = "DW_CFA_advance_loc1",
+	[DW_CFA_advance_loc2] = "DW_CFA_advance_loc2",
+	[DW_CFA_advance_loc4] = "DW_CFA_advance_loc4",
+	[DW_CFA_offset_extended] = "DW_CFA_offset_extended",
+	[DW_CFA_restore_extended] = "DW_CFA_restore_extended",
+	[DW_CFA_undefined] = "DW_CFA_undefined",
+	[DW_CFA_same_value] = "DW_CFA_same_value",
+	[DW_CFA_register] = "DW_CFA_register",
+	[DW_CFA_remember_state] = "DW_CFA_remember_state",
+	[DW_CFA_restore_state] = "DW_CFA_restore_state",
+	[DW_CFA_def_cfa] = "DW_CFA_def_cfa",
+	[DW_CFA_def_cfa_register] = "DW_CFA_def_cfa_register",
+	[DW_CFA_def_cfa_offset] = "DW_CFA_def_cfa_offset",
+	[DW_CFA_def_cfa_expression] = "DW_CFA_def_cfa_expression",
+	[DW_CFA_expression] = "DW_CFA_expression",
+	[DW_CFA_offset_extended_sf] = "DW_CFA_offset_extended_sf",
+	[DW_CFA_def_cfa_sf] = "DW_CFA_def_cfa_sf",
+	[DW_CFA_def_cfa_offset_sf] = "DW_CFA_def_cfa_offset_sf",
+	[DW_CFA_val_offset] = "DW_CFA_val_offset",
+	[DW_CFA_val_offset_sf] = "DW_CFA_val_offset_sf",
+	[DW_CFA_val_expression] = "DW_CFA_val_expression",
+	[DW_CFA_GNU_args_size] = "DW_CFA_GNU_args_size",
+	[DW_CFA_GNU_negative_offset_extended] =
+		"DW_CFA_GNU_negative_offset_extended",
+	[DW_CFA_advance_loc] = "DW_CFA_advance_loc",
+	[DW_CFA_offset] = "DW_CFA_offset",
+	[DW_CFA_restore] = "DW_CFA_restore",
+};
+
+struct stats {
+	size_t files, failed, not_elf, missing;
+
+	uint64_t section_bytes;
+	uint64_t cies, cie_bytes;
+	uint64_t fdes, fde_bytes;
+
+	uint64_t header_bytes, instruction_bytes, padding_bytes, other_bytes;
+
+	uint64_t dup_cies, dup_cie_bytes;
+	uint64_t dup_fdes, dup_fde_bytes;
+
+	// Bytes saved by re-encoding instructions in their shortest form
+	uint64_t shortest_savings;
+
+	uint64_t opcodes[256];
+	uint64_t opcode_bytes[256];
+};
+
+struct record {
+	const char *buf;
+	size_t len;
+	uint64_t location;
+	uint64_t address_range;
+};
+
+struct cie_entry {
+	size_t offset;
+	struct dwarfw_cie cie;
+};
+
+struct worker {
+	pthread_t thread;
+	struct stats stats;
+
+	// Reused from one file to the next
+	struct cie_entry *cie_entries;
+	size_t cie_entries_len, cie_entries_cap;
+	struct record *cies, *fdes;
+	size_t cies_len, cies_cap, fdes_len, fdes_cap;
+
+	// Scratch stream to measure re-encoded instructions
+	char scratch_buf[64];
+	FILE *scratch;
+};
+
+static char **paths = NULL;
+static size_t paths_len = 0;
+static atomic_size_t next_path = 0;
+static bool verbose = false;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool push_record(struct record **records, size_t *len, size_t *cap,
+		struct record *rec) {
+	if (*len == *cap) {
+		size_t new_cap = *cap == 0 ? 256 : 2 * *cap;
+		struct record *new_records =
+			realloc(*records, new_cap * sizeof(struct record));
+		if (new_records == NULL) {
+			return false;
+		}
+		*records = new_records;
+		*cap = new_cap;
+	}
+	(*records)[(*len)++] = *rec;
+	return true;
+}
+
+static bool push_cie(struct worker *worker, size_t offset,
+		struct dwarfw_cie *cie) {
+	if (worker->cie_entries_len == worker->cie_entries_cap) {
+		size_t cap = worker->cie_entries_cap == 0 ?
+			16 : 2 * worker->cie_entries_cap;
+		struct cie_entry *entries =
+			realloc(worker->cie_entries, cap * sizeof(struct cie_entry));
+		if (entries == NULL) {
+			return false;
+		}
+		worker->cie_entries = entries;
+		worker->cie_entries_cap = cap;
+	}
+	worker->cie_entries[worker->cie_entries_len++] = (struct cie_entry){
+		.offset = offset,
+		.cie = *cie,
+	};
+	return true;
+}
+
+// CIEs are found in section order, so entries are sorted by offset
+static struct dwarfw_cie *find_cie(struct worker *worker, size_t offset) {
+	size_t lo = 0, hi = worker->cie_entries_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (worker->cie_entries[mid].offset < offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == worker->cie_entries_len ||
+			worker->cie_entries[lo].offset != offset) {
+		return NULL;
+	}
+	return &worker->cie_entries[lo].cie;
+}
+
+// Size of the shortest encoding of an instruction, or 0 if unknown
+static size_t shortest_size(struct worker *worker, struct dwarfw_cie *cie,
+		struct dwarfw_instruction *insn) {
+	long long int data_alignment = cie->data_alignment;
+	bool factored = data_alignment != 0 && insn->operand % data_alignment == 0;
+
+	FILE *f = worker->scratch;
+	rewind(f);
+	switch (insn->opcode) {
+	case DW_CFA_advance_loc:
+	case DW_CFA_advance_loc1:
+	case DW_CFA_advance_loc2:
+	case DW_CFA_advance_loc4:
+		if (cie->code_alignment == 0 || insn->operand < 0 ||
+				insn->operand > UINT32_MAX ||
+				insn->operand % cie->code_alignment != 0) {
+			return 0;
+		}
+		return dwarfw_cie_write_advance_loc(cie, insn->operand, f);
+	case DW_CFA_offset:
+	case DW_CFA_offset_extended:
+	case DW_CFA_offset_extended_sf:
+	case DW_CFA_GNU_negative_offset_extended:
+		return factored ?
+			dwarfw_cie_write_offset(cie, insn->reg, insn->operand, f) : 0;
+	case DW_CFA_val_offset:
+	case DW_CFA_val_offset_sf:
+		return factored ?
+			dwarfw_cie_write_val_offset(cie, insn->reg, insn->operand, f) : 0;
+	case DW_CFA_restore:
+	case DW_CFA_restore_extended:
+		return dwarfw_cie_write_restore(cie, insn->reg, f);
+	case DW_CFA_def_cfa:
+	case DW_CFA_def_cfa_sf:
+		if (insn->operand < 0 && !factored) {
+			return 0;
+		}
+		return dwarfw_cie_write_def_cfa(cie, insn->reg, insn->operand, f);
+	case DW_CFA_def_cfa_offset:
+	case DW_CFA_def_cfa_offset_sf:
+		if (insn->operand < 0 && !factored) {
+			return 0;
+		}
+		return dwarfw_cie_write_def_cfa_offset(cie, insn->operand, f);
+	case DW_CFA_def_cfa_register:
+		return dwarfw_cie_write_def_cfa_register(cie, insn->reg, f);
+	case DW_CFA_undefined:
+		return dwarfw_cie_write_undefined(cie, insn->reg, f);
+	case DW_CFA_same_value:
+		return dwarfw_cie_write_same_value(cie, insn->reg, f);
+	case DW_CFA_register:
+		return dwarfw_cie_write_register(cie, insn->reg, insn->operand, f);
+	default:
+		return 0;
+	}
+}
+
+static void analyze_instructions(struct worker *worker, struct dwarfw_cie *cie,
+		const char *buf, size_t len) {
+	struct stats *stats = &worker->stats;
+
+	// Trailing nops are padding, others are accounted once followed by a
+	// real instruction
+	size_t nops = 0, nops_bytes = 0;
+	size_t read = 0, end = 0;
+	while (read < len) {
+		struct dwarfw_instruction insn;
+		size_t n = dwarfw_cie_read_instruction(cie, buf + read, len - read,
+			&insn);
+		if (n == 0) {
+			stats->other_bytes += len - read; // Unknown or truncated
+			len = read;
+			break;
+		}
+		read += n;
+
+		if (insn.opcode == DW_CFA_nop) {
+			++nops;
+			nops_bytes += n;
+			continue;
+		}
+		stats->opcodes[DW_CFA_nop] += nops;
+		stats->opcode_bytes[DW_CFA_nop] += nops_bytes;
+		nops = nops_bytes = 0;
+
+		++stats->opcodes[insn.opcode];
+		stats->opcode_bytes[insn.opcode] += n;
+
+		size_t shortest = shortest_size(worker, cie, &insn);
+		if (shortest > 0 && shortest < n) {
+			stats->shortest_savings += n - shortest;
+		}
+
+		end = read;
+	}
+
+	stats->instruction_bytes += end;
+	stats->padding_bytes += len - end;
+}
+
+static int cie_record_cmp(const void *a, const void *b) {
+	const struct record *ra = a, *rb = b;
+	if (ra->len != rb->len) {
+		return ra->len < rb->len ? -1 : 1;
+	}
+	return memcmp(ra->buf, rb->buf, ra->len);
+}
+
+static int fde_record_cmp(const void *a, const void *b) {
+	const struct record *ra = a, *rb = b;
+	if (ra->location != rb->location) {
+		return ra->location < rb->location ? -1 : 1;
+	}
+	return (ra->address_range > rb->address_range) -
+		(ra->address_range < rb->address_range);
+}
+
+static void count_duplicates(struct record *records, size_t len,
+		int (*cmp)(const void *, const void *), uint64_t *dups,
+		uint64_t *dup_bytes) {
+	qsort(records, len, sizeof(struct record), cmp);
+	for (size_t i = 1; i < len; ++i) {
+		if (cmp(&records[i - 1], &records[i]) == 0) {
+			++*dups;
+			*dup_bytes += records[i].len;
+		}
+	}
+}
+
+static bool analyze_eh_frame(struct worker *worker, const char *path,
+		const char *buf, size_t len, uint64_t address, bool relocatable) {
+	struct stats *stats = &worker->stats;
+	worker->cie_entries_len = worker->cies_len = worker->fdes_len = 0;
+
+	stats->section_bytes += len;
+
+	size_t offset = 0;
+	while (offset < len) {
+		uint64_t cie_pointer;
+		size_t n = dwarfw_record_read(buf + offset, len - offset, &cie_pointer);
+		if (n == 0) {
+			break; // Terminator or garbage
+		}
+
+		const char *rec_buf = buf + offset;
+		struct record rec = { .buf = rec_buf, .len = n };
+		if (cie_pointer == 0) {
+			struct dwarfw_cie cie;
+			if (!dwarfw_cie_read(rec_buf, n, &cie) ||
+					!push_cie(worker, offset, &cie) ||
+					!push_record(&worker->cies, &worker->cies_len,
+						&worker->cies_cap, &rec)) {
+				fprintf(stderr, "%s: invalid CIE at 0x%zx\n", path, offset);
+				return false;
+			}
+
+			++stats->cies;
+			stats->cie_bytes += n;
+			stats->header_bytes += n - cie.instructions_length;
+			analyze_instructions(worker, &cie, cie.instructions,
+				cie.instructions_length);
+		} else {
+			struct dwarfw_cie *cie = cie_pointer <= offset ?
+				find_cie(worker, offset - cie_pointer) : NULL;
+			struct dwarfw_fde fde;
+			if (cie == NULL || !dwarfw_fde_read(rec_buf, n, cie, &fde)) {
+				fprintf(stderr, "%s: invalid FDE at 0x%zx\n", path, offset);
+				return false;
+			}
+
+			rec.location = fde.initial_location;
+			if ((cie->augmentation_data.pointer_encoding & 0x70) ==
+					DW_EH_PE_pcrel) {
+				rec.location += address + offset;
+			}
+			rec.address_range = fde.address_range;
+			if (!relocatable && !push_record(&worker->fdes, &worker->fdes_len,
+					&worker->fdes_cap, &rec)) {
+				return false;
+			}
+
+			++stats->fdes;
+			stats->fde_bytes += n;
+			stats->header_bytes += n - fde.instructions_length;
+			analyze_instructions(worker, cie, fde.instructions,
+				fde.instructions_length);
+		}
+
+		offset += n;
+	}
+	stats->other_bytes += len - offset;
+
+	count_duplicates(worker->cies, worker->cies_len, cie_record_cmp,
+		&stats->dup_cies, &stats->dup_cie_bytes);
+	count_duplicates(worker->fdes, worker->fdes_len, fde_record_cmp,
+		&stats->dup_fdes, &stats->dup_fde_bytes);
+
+	if (verbose) {
+		printf("%s: %zu bytes, %zu CIEs, %zu FDEs\n", path, len,
+			worker->cie_entries_len, worker->fdes_len);
+	}
+	return true;
+}
+
+static bool analyze_file(struct worker *worker, const char *path) {
+	int fd = open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return false;
+	}
+
+	bool ok = false;
+	Elf *elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+	struct dwarfw_elf *ctx = NULL;
+	GElf_Ehdr ehdr;
+	if (elf == NULL || elf_kind(elf) != ELF_K_ELF ||
+			gelf_getehdr(elf, &ehdr) == NULL) {
+		// Scripts and data files are expected when scanning whole trees
+		++worker->stats.not_elf;
+		ok = true;
+		goto out;
+	}
+
+	ctx = dwarfw_elf_create(elf);
+	if (ctx == NULL) {
+		fprintf(stderr, "%s: dwarfw_elf_create() failed\n", path);
+		goto out;
+	}
+
+	Elf_Scn *scn = dwarfw_elf_find_section(ctx, ".eh_frame");
+	if (scn == NULL) {
+		++worker->stats.missing;
+		ok = true;
+		goto out;
+	}
+
+	GElf_Shdr shdr;
+	Elf_Data *data = elf_getdata(scn, NULL);
+	if (gelf_getshdr(scn, &shdr) == NULL || data == NULL) {
+		fprintf(stderr, "%s: can't read .eh_frame\n", path);
+		goto out;
+	}
+	if (shdr.sh_type == SHT_NOBITS) {
+		ok = true;
+		goto out;
+	}
+
+	ok = analyze_eh_frame(worker, path, data->d_buf, data->d_size,
+		shdr.sh_addr, ehdr.e_type == ET_REL);
+
+out:
+	dwarfw_elf_destroy(ctx);
+	elf_end(elf);
+	close(fd);
+	return ok;
+}
+
+static void *worker_run(void *data) {
+	struct worker *worker = data;
+
+	while (true) {
+		size_t i = atomic_fetch_add(&next_path, 1);
+		if (i >= paths_len) {
+			break;
+		}
+
+		++worker->stats.files;
+		if (!analyze_file(worker, paths[i])) {
+			++worker->stats.failed;
+		}
+	}
+
+	return NULL;
+}
+
+static bool push_path(const char *path, size_t *cap) {
+	if (paths_len == *cap) {
+		*cap = *cap == 0 ? 64 : 2 * *cap;
+		char **new_paths = realloc(paths, *cap * sizeof(char *));
+		if (new_paths == NULL) {
+			return false;
+		}
+		paths = new_paths;
+	}
+	paths[paths_len] = strdup(path);
+	return paths[paths_len++] != NULL;
+}
+
+static bool read_paths(FILE *f) {
+	char *line = NULL;
+	size_t line_cap = 0;
+	size_t paths_cap = 0;
+
+	ssize_t n;
+	while ((n = getline(&line, &line_cap, f)) > 0) {
+		if (line[n - 1] == '\n') {
+			line[n - 1] = '\0';
+		}
+		if (line[0] != '\0' && !push_path(line, &paths_cap)) {
+			free(line);
+			return false;
+		}
+	}
+
+	free(line);
+	return !ferror(f);
+}
+
+static void stats_add(struct stats *total, const struct stats *stats) {
+	total->files += stats->files;
+	total->failed += stats->failed;
+	total->not_elf += stats->not_elf;
+	total->missing += stats->missing;
+	total->section_bytes += stats->section_bytes;
+	total->cies += stats->cies;
+	total->cie_bytes += stats->cie_bytes;
+	total->fdes += stats->fdes;
+	total->fde_bytes += stats->fde_bytes;
+	total->header_bytes += stats->header_bytes;
+	total->instruction_bytes += stats->instruction_bytes;
+	total->padding_bytes += stats->padding_bytes;
+	total->other_bytes += stats->other_bytes;
+	total->dup_cies += stats->dup_cies;
+	total->dup_cie_bytes += stats->dup_cie_bytes;
+	total->dup_fdes += stats->dup_fdes;
+	total->dup_fde_bytes += stats->dup_fde_bytes;
+	total->shortest_savings += stats->shortest_savings;
+	for (size_t i = 0; i < 256; ++i) {
+		total->opcodes[i] += stats->opcodes[i];
+		total->opcode_bytes[i] += stats->opcode_bytes[i];
+	}
+}
+
+static double percent(uint64_t part, uint64_t total) {
+	return total > 0 ? 100.0 * part / total : 0;
+}
+
+static void print_stats(const struct stats *s) {
+	uint64_t total = s->section_bytes;
+
+	printf(".eh_frame: %lu bytes\n", total);
+	printf("  CIEs: %lu, %lu bytes (%.1f%%, %.1f per CIE)\n", s->cies,
+		s->cie_bytes, percent(s->cie_bytes, total),
+		s->cies > 0 ? (double)s->cie_bytes / s->cies : 0);
+	printf("  FDEs: %lu, %lu bytes (%.1f%%, %.1f per FDE)\n", s->fdes,
+		s->fde_bytes, percent(s->fde_bytes, total),
+		s->fdes > 0 ? (double)s->fde_bytes / s->fdes : 0);
+	printf("  headers: %lu bytes (%.1f%%)\n", s->header_bytes,
+		percent(s->header_bytes, total));
+	printf("  instructions: %lu bytes (%.1f%%)\n", s->instruction_bytes,
+		percent(s->instruction_bytes, total));
+	printf("  padding: %lu bytes (%.1f%%)\n", s->padding_bytes,
+		percent(s->padding_bytes, total));
+	printf("  other: %lu bytes (%.1f%%)\n", s->other_bytes,
+		percent(s->other_bytes, total));
+
+	printf("savings estimate:\n");
+	printf("  duplicate CIEs: %lu, %lu bytes\n", s->dup_cies, s->dup_cie_bytes);
+	printf("  duplicate FDEs: %lu, %lu bytes\n", s->dup_fdes, s->dup_fde_bytes);
+	printf("  shortest-form instructions: %lu bytes\n", s->shortest_savings);
+
+	printf("opcodes:\n");
+	for (size_t i = 0; i < 256; ++i) {
+		if (s->opcodes[i] == 0) {
+			continue;
+		}
+		const char *name = opcode_names[i];
+		if (name != NULL) {
+			printf("  %-36s", name);
+		} else {
+			printf("  0x%02zx%32s", i, "");
+		}
+		printf(" %10lu %10lu bytes (%.1f%%)\n", s->opcodes[i],
+			s->opcode_bytes[i], percent(s->opcode_bytes[i], total));
+	}
+}
+
+int main(int argc, char **argv) {
+	long jobs_nr = sysconf(_SC_NPROCESSORS_ONLN);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hj:v")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs_nr = strtol(optarg, NULL, 10);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (jobs_nr < 1) {
+		jobs_nr = 1;
+	}
+
+	if (optind < argc) {
+		size_t paths_cap = 0;
+		for (int i = optind; i < argc; ++i) {
+			if (!push_path(argv[i], &paths_cap)) {
+				return 1;
+			}
+		}
+	} else if (!read_paths(stdin)) {
+		fprintf(stderr, "Failed to read the file list\n");
+		return 1;
+	}
+
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		fprintf(stderr, "ELF library initialization failed: %s\n", elf_errmsg(-1));
+		return 1;
+	}
+
+	if ((size_t)jobs_nr > paths_len) {
+		jobs_nr = paths_len > 0 ? paths_len : 1;
+	}
+	struct worker *workers = calloc(jobs_nr, sizeof(struct worker));
+	if (workers == NULL) {
+		return 1;
+	}
+
+	double start = now();
+	for (long i = 0; i < jobs_nr; ++i) {
+		struct worker *worker = &workers[i];
+		worker->scratch = fmemopen(worker->scratch_buf,
+			sizeof(worker->scratch_buf), "w");
+		if (worker->scratch == NULL) {
+			return 1;
+		}
+		setvbuf(worker->scratch, NULL, _IONBF, 0);
+		if (pthread_create(&worker->thread, NULL, worker_run, worker)) {
+			fprintf(stderr, "pthread_create() failed\n");
+			return 1;
+		}
+	}
+
+	struct stats total = {0};
+	for (long i = 0; i < jobs_nr; ++i) {
+		struct worker *worker = &workers[i];
+		pthread_join(worker->thread, NULL);
+		stats_add(&total, &worker->stats);
+		fclose(worker->scratch);
+		free(worker->cie_entries);
+		free(worker->cies);
+		free(worker->fdes);
+	}
+	double wall = now() - start;
+
+	printf("%zu files (%zu failed, %zu not ELF, %zu without .eh_frame) "
+		"in %.3f ms with %ld jobs\n", total.files, total.failed, total.not_elf,
+		total.missing, wall * 1e3, jobs_nr);
+	print_stats(&total);
+
+	for (size_t i = 0; i < paths_len; ++i) {
+		free(paths[i]);
+	}
+	free(paths);
+	free(workers);
+	return total.failed > 0;
+}
@@ -0,0 +1,82 @@
+#include <dwarfw.h>
+
+// DWARF register numbers for x86_64
+#define REG_FP 6
+#define REG_SP 7
+
+// State set up by the initial instructions of an x86_64 CIE: the CFA is the
+// stack pointer before the call and the return address was pushed below it
+static const struct dwarfw_unwind_row initial_row = {
+	.cfa_register = REG_SP,
+	.cfa_offset = 8,
+	.ra_offset = -8,
+};
+
+// Writes the instructions going from prev to row, none if they are identical
+static bool row_write(struct dwarfw_cie *cie,
+		const struct dwarfw_unwind_row *prev,
+		const struct dwarfw_unwind_row *row, FILE *f) {
+	if (row->offset > prev->offset &&
+			!dwarfw_cie_write_advance_loc(cie, row->offset - prev->offset, f)) {
+		return false;
+	}
+
+	size_t n = 1;
+	if (row->cfa_register != prev->cfa_register &&
+			row->cfa_offset != prev->cfa_offset) {
+		n = dwarfw_cie_write_def_cfa(cie, row->cfa_register, row->cfa_offset,
+			f);
+	} else if (row->cfa_register != prev->cfa_register) {
+		n = dwarfw_cie_write_def_cfa_register(cie, row->cfa_register, f);
+	} else if (row->cfa_offset != prev->cfa_offset) {
+		n = dwarfw_cie_write_def_cfa_offset(cie, row->cfa_offset, f);
+	}
+	if (!n) {
+		return false;
+	}
+
+	// An offset of 0 goes back to the CIE's rule
+	if (row->fp_offset != prev->fp_offset) {
+		if (row->fp_offset == 0) {
+			n = dwarfw_cie_write_restore(cie, REG_FP, f);
+		} else {
+			n = dwarfw_cie_write_offset(cie, REG_FP, row->fp_offset, f);
+		}
+		if (!n) {
+			return false;
+		}
+	}
+
+	long long int prev_ra_offset =
+		prev->ra_offset != 0 ? prev->ra_offset : initial_row.ra_offset;
+	long long int ra_offset =
+		row->ra_offset != 0 ? row->ra_offset : initial_row.ra_offset;
+	if (ra_offset != prev_ra_offset) {
+		if (ra_offset == initial_row.ra_offset) {
+			n = dwarfw_cie_write_restore(cie, cie->return_address_register, f);
+		} else {
+			n = dwarfw_cie_write_offset(cie, cie->return_address_register,
+				ra_offset, f);
+		}
+		if (!n) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool dwarfw_unwind_rows_write(struct dwarfw_cie *cie,
+		const struct dwarfw_unwind_row *rows, size_t rows_len, FILE *f) {
+	const struct dwarfw_unwind_row *prev = &initial_row;
+	for (size_t i = 0; i < rows_len; ++i) {
+		if (i > 0 && rows[i].offset < prev->offset) {
+			return false;
+		}
+		if (!row_write(cie, prev, &rows[i], f)) {
+			return false;
+		}
+		prev = &rows[i];
+	}
+	return true;
+}
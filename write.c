@@ -11,3 +11,7 @@ size_t write_u16(uint16_t b, FILE *f) {
 size_t write_u32(uint32_t b, FILE *f) {
 	return fwrite(&b, 1, sizeof(b), f);
 }
+
+size_t write_u64(uint64_t b, FILE *f) {
+	return fwrite(&b, 1, sizeof(b), f);
+}